@@ -0,0 +1,1054 @@
+#include "include/nes.h"
+
+#include <stdio.h>
+#include <time.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sys/time.h>
+#endif
+using namespace std;
+using namespace NES;
+
+// 計測用
+// bench [name]  nameを省略すると全部やる
+
+static double now()
+{
+	return (double)clock() / CLOCKS_PER_SEC;
+}
+// スレッドを使う時はこっち、clock()だと全スレッドのCPU時間になる
+static double wall()
+{
+#ifdef _WIN32
+	return GetTickCount() / 1000.0;
+#else
+	timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+#endif
+}
+
+// 生成されたルールコードっぽいソースをlines行ぐらい作る
+static string make_source(int lines)
+{
+	string src;
+	char buf[256];
+	for (int i = 0; lines > 0; i++, lines -= 11)
+	{
+		sprintf(buf,
+			"// rule %d\n"
+			"def rule%d(a : int, b : int) : int\n"
+			"{\n"
+			"\tvar x = a + b * %d;\n"
+			"\tvar y = x - (a << 2);\n"
+			"\tif (x < y && a != b)\n"
+			"\t\tx = y;\n"
+			"\twhile (y > 0)\n"
+			"\t\ty = y - 1; /* loop */\n"
+			"\treturn x + y;\n"
+			"}\n", i, i, i % 100);
+		src += buf;
+	}
+	src += "def main() { rule0(1, 2); }\n";
+	return src;
+}
+
+static void bench_compile()
+{
+	printf("compile: synthetic script\n");
+	printf("%8s %10s %10s %12s\n", "lines", "parse[s]", "compile[s]", "us/line");
+	for (int lines = 12500; lines <= 100000; lines *= 2)
+	{
+		string src = make_source(lines);
+
+		double t0 = now();
+		{
+			Tokenizer t(src);
+			Parser p(&t);
+			shptr<AST::NameSpace> ns = p.Parse();
+			if (!ns)
+			{
+				printf("parse fail\n");
+				return;
+			}
+		}
+		double t1 = now();
+		Environment env = nes::compile_IL(src);
+		double t2 = now();
+		if (!env)
+		{
+			printf("compile fail\n");
+			return;
+		}
+		printf("%8d %10.3f %10.3f %12.3f\n", lines, t1 - t0, t2 - t1, (t2 - t1) * 1e6 / lines);
+		fflush(stdout);
+	}
+}
+
+// 演算子だらけの式をひたすら並べる
+static string make_expression_source(int lines)
+{
+	string src = "def exprs(a : int, b : int, c : int, d : int) : int\n{\n\tvar x = 0;\n";
+	char buf[256];
+	for (int i = 0; i < lines; i++)
+	{
+		sprintf(buf, "\tx = (a + b * %d - c / (d + 1)) << 2 | a & b ^ c %% 7 + -d;\n"
+					"\tx += a < b && c >= d || a == %d ? x * 3 + 1 : (x >> 1) - ~a;\n", i % 100, i);
+		src += buf;
+	}
+	src += "\treturn x;\n}\n";
+	return src;
+}
+
+static void bench_expression()
+{
+	printf("expression: parse only\n");
+	printf("%8s %10s %10s %12s\n", "lines", "lex[s]", "parse[s]", "ns/token");
+	for (int lines = 25000; lines <= 200000; lines *= 2)
+	{
+		string src = make_expression_source(lines / 2);
+
+		double t0 = now();
+		Tokenizer t(src);
+		double t1 = now();
+		Parser p(&t);
+		shptr<AST::NameSpace> ns = p.Parse();
+		double t2 = now();
+		if (!ns)
+		{
+			printf("parse fail\n");
+			return;
+		}
+		printf("%8d %10.3f %10.3f %12.3f\n", lines, t1 - t0, t2 - t1, (t2 - t1) * 1e9 / t.size());
+		fflush(stdout);
+	}
+}
+
+// 巨大な関数1個、分岐だらけ
+static string make_function_source(int statements)
+{
+	string src = "def big(a : int) : int\n{\n\tvar x = a;\n";
+	char buf[256];
+	for (int i = 0; i < statements; i++)
+	{
+		sprintf(buf, "\tif (x < %d) x = x + %d; else x = x - 1;\n", i, i % 7);
+		src += buf;
+	}
+	src += "\treturn x;\n}\n";
+	return src;
+}
+
+static void bench_codegen()
+{
+	printf("codegen: one big function (10 IL ops per statement)\n");
+	printf("%8s %10s %10s %10s\n", "ops", "IL[s]", "native[s]", "bytes");
+	for (int statements = 1000; statements <= 8000; statements *= 2)
+	{
+		string src = make_function_source(statements);
+
+		double t0 = now();
+		Environment env = nes::compile_IL(src);
+		double t1 = now();
+		if (!env)
+		{
+			printf("compile fail\n");
+			return;
+		}
+		Native n = env->gen();
+		double t2 = now();
+		if (!n)
+		{
+			printf("gen fail\n");
+			return;
+		}
+		printf("%8d %10.3f %10.3f %10d\n", statements * 10, t1 - t0, t2 - t1, (int)n->code.size());
+		fflush(stdout);
+	}
+}
+
+// sample/while_else.nesのループを回数だけ増やしたもの
+static string make_loop_source(int n)
+{
+	char buf[1024];
+	sprintf(buf,
+		"def main() : int\n"
+		"{\n"
+		"\tvar i = 0;\n"
+		"\tvar n = 0;\n"
+		"\twhile (i < %d)\n"
+		"\t{\n"
+		"\t\tif (i == 102)\n"
+		"\t\t{\n"
+		"\t\t\ti++;\n"
+		"\t\t\tcontinue;\n"
+		"\t\t}\n"
+		"\t\tn++;\n"
+		"\t\ti++;\n"
+		"\t}\n"
+		"\telse\n"
+		"\t{\n"
+		"\t\tn++;\n"
+		"\t}\n"
+		"\ti = 0;\n"
+		"\twhile (i < %d)\n"
+		"\t{\n"
+		"\t\tif (i == %d)\n"
+		"\t\t\tbreak;\n"
+		"\t\tn++;\n"
+		"\t\ti++;\n"
+		"\t}\n"
+		"\treturn n;\n"
+		"}\n", n, n, n - 1);
+	return buf;
+}
+
+static void bench_loop()
+{
+	printf("loop: IL interpreter\n");
+	printf("%10s %10s %12s %10s\n", "iter", "run[s]", "ns/iter", "result");
+	for (int n = 1250000; n <= 10000000; n *= 2)
+	{
+		Environment env = nes::compile_IL(make_loop_source(n));
+		if (!env)
+		{
+			printf("compile fail\n");
+			return;
+		}
+		double t0 = now();
+		int r = env->run();
+		double t1 = now();
+		printf("%10d %10.3f %12.3f %10d\n", n * 2, t1 - t0, (t1 - t0) * 1e9 / (n * 2), r);
+		fflush(stdout);
+	}
+}
+
+static void bench_fib()
+{
+	printf("fib: fib(30), IL interpreter vs bytecode\n");
+	printf("%10s %10s %10s\n", "mode", "run[s]", "result");
+	const char *src =
+		"def fib(n : int) : int\n"
+		"\treturn (n < 2) ? 1 : (fib(n-1) + fib(n-2));\n"
+		"def main() : int\n"
+		"\treturn fib(30);\n";
+	for (int bc = 0; bc < 2; bc++)
+	{
+		Environment env = nes::compile_IL(src);
+		if (!env)
+		{
+			printf("compile fail\n");
+			return;
+		}
+		env->useBytecode(bc != 0);
+		double t0 = now();
+		int r = env->run();
+		double t1 = now();
+		printf("%10s %10.3f %10d\n", bc ? "bytecode" : "IL", t1 - t0, r);
+		fflush(stdout);
+	}
+}
+
+// JITの一時変数をレジスタに置くかどうか
+static void bench_jit()
+{
+	printf("jit: native code, register allocation off/on\n");
+	printf("%10s %10s %10s %10s\n", "func", "reg", "run[s]", "result");
+	const char *src =
+		"def fib(n : int) : int\n"
+		"\treturn (n < 2) ? 1 : (fib(n-1) + fib(n-2));\n"
+		"def kernel(n : int) : int\n"
+		"{\n"
+		"\tvar i = 0;\n"
+		"\tvar s = 0;\n"
+		"\twhile (i < n)\n"
+		"\t{\n"
+		"\t\ts += i * i - (i >> 1) + (i & 3) ^ (i | 8);\n"
+		"\t\ti++;\n"
+		"\t}\n"
+		"\treturn s;\n"
+		"}\n";
+	const char *name[] = {"fib", "kernel"};
+	const int arg[] = {32, 100000000};
+	for (int f = 0; f < 2; f++)
+	{
+		for (int reg = 0; reg < 2; reg++)
+		{
+			Environment env = nes::compile_IL(src);
+			if (!env)
+			{
+				printf("compile fail\n");
+				return;
+			}
+			env->useRegister(reg != 0);
+			Native n = env->gen();
+			if (!n)
+			{
+				printf("gen fail\n");
+				return;
+			}
+			typedef int (*func)(int);
+			func fn = (func)n->get(name[f]);
+			double t0 = now();
+			int r = fn(arg[f]);
+			double t1 = now();
+			printf("%10s %10s %10.3f %10d\n", name[f], reg ? "on" : "off", t1 - t0, r);
+			fflush(stdout);
+		}
+	}
+}
+
+// 中間言語のコピー伝播の有無
+static void bench_optimize()
+{
+	printf("optimize: copy propagation off/on\n");
+	printf("%10s %10s %10s %10s %10s\n", "optimize", "IL[s]", "bytecode[s]", "native[s]", "result");
+	const char *src =
+		"def kernel(n : int) : int\n"
+		"{\n"
+		"\tvar i = 0;\n"
+		"\tvar s = 0;\n"
+		"\twhile (i < n)\n"
+		"\t{\n"
+		"\t\tvar a = i * 3;\n"
+		"\t\tvar b = a;\n"
+		"\t\ts += b - (i >> 1);\n"
+		"\t\ts = s > 100000 ? s - 100000 : s;\n"
+		"\t\ti = i + 1;\n"
+		"\t}\n"
+		"\treturn s;\n"
+		"}\n"
+		"def main() : int\n"
+		"\treturn kernel(3000000);\n";
+	for (int opt = 0; opt < 2; opt++)
+	{
+		double t[3];
+		int r = 0;
+		for (int mode = 0; mode < 3; mode++)
+		{
+			Environment env = nes::compile_IL(src, opt != 0);
+			if (!env)
+			{
+				printf("compile fail\n");
+				return;
+			}
+			double t0 = now();
+			if (mode < 2)
+			{
+				env->useBytecode(mode == 1);
+				r = env->run();
+			}
+			else
+			{
+				Native n = env->gen();
+				if (!n)
+				{
+					printf("gen fail\n");
+					return;
+				}
+				t0 = now();
+				r = ((int (*)())n->get("main"))();
+			}
+			t[mode] = now() - t0;
+		}
+		printf("%10s %10.3f %10.3f %10.3f %10d\n", opt ? "on" : "off", t[0], t[1], t[2], r);
+		fflush(stdout);
+	}
+}
+
+// 小さい関数の展開の有無
+static void bench_inline()
+{
+	printf("inline: small leaf functions off/on\n");
+	printf("%10s %10s %10s %10s %10s %10s\n", "inline", "IL[s]", "bytecode[s]", "native[s]", "result", "inlined");
+	const char *src =
+		"def add(a : int, b : int) : int\n"
+		"\treturn a + b;\n"
+		"def max(a : int, b : int) : int\n"
+		"{\n"
+		"\tif (a > b)\n"
+		"\t\treturn a;\n"
+		"\treturn b;\n"
+		"}\n"
+		"def main() : int\n"
+		"{\n"
+		"\tvar i = 0;\n"
+		"\tvar s = 0;\n"
+		"\twhile (i < 3000000)\n"
+		"\t{\n"
+		"\t\ts = add(s, max(i & 7, 3));\n"
+		"\t\ti = add(i, 1);\n"
+		"\t}\n"
+		"\treturn s;\n"
+		"}\n";
+	for (int on = 0; on < 2; on++)
+	{
+		double t[3];
+		int r = 0, inlined = 0;
+		for (int mode = 0; mode < 3; mode++)
+		{
+			Environment env = nes::compile_IL(src, true, on ? 128 : 0);
+			if (!env)
+			{
+				printf("compile fail\n");
+				return;
+			}
+			inlined = env->getInlined().size();
+			double t0 = now();
+			if (mode < 2)
+			{
+				env->useBytecode(mode == 1);
+				r = env->run();
+			}
+			else
+			{
+				Native n = env->gen();
+				if (!n)
+				{
+					printf("gen fail\n");
+					return;
+				}
+				t0 = now();
+				r = ((int (*)())n->get("main"))();
+			}
+			t[mode] = now() - t0;
+		}
+		printf("%10s %10.3f %10.3f %10.3f %10d %10d\n", on ? "on" : "off", t[0], t[1], t[2], r, inlined);
+		fflush(stdout);
+	}
+}
+
+static void bench_tail()
+{
+	printf("tail: tail recursion without/with optimize (deep = 3000000 calls deep)\n");
+	printf("%10s %10s %10s %10s %10s\n", "optimize", "IL[s]", "bytecode[s]", "native[s]", "result");
+	const char *src =
+		"def sum(n : int, acc : int) : int\n"
+		"{\n"
+		"\tif (n == 0)\n"
+		"\t\treturn acc;\n"
+		"\treturn sum(n - 1, (acc + n) & 65535);\n"
+		"}\n"
+		"def main() : int\n"
+		"{\n"
+		"\tvar i = 0;\n"
+		"\tvar s = 0;\n"
+		"\twhile (i < 3000)\n"
+		"\t{\n"
+		"\t\ts = (s + sum(1000, i)) & 65535;\n"
+		"\t\ti = i + 1;\n"
+		"\t}\n"
+		"\treturn s;\n"
+		"}\n";
+	const char *deep =
+		"def sum(n : int, acc : int) : int\n"
+		"{\n"
+		"\tif (n == 0)\n"
+		"\t\treturn acc;\n"
+		"\treturn sum(n - 1, (acc + n) & 65535);\n"
+		"}\n"
+		"def main() : int\n"
+		"\treturn sum(3000000, 0);\n";
+	for (int on = 0; on < 3; on++)
+	{
+		double t[3];
+		int r = 0;
+		for (int mode = 0; mode < 3; mode++)
+		{
+			Environment env = nes::compile_IL(on == 2 ? deep : src, on != 0);
+			if (!env)
+			{
+				printf("compile fail\n");
+				return;
+			}
+			double t0 = now();
+			if (mode < 2)
+			{
+				env->useBytecode(mode == 1);
+				r = env->run();
+			}
+			else
+			{
+				Native n = env->gen();
+				if (!n)
+				{
+					printf("gen fail\n");
+					return;
+				}
+				t0 = now();
+				r = ((int (*)())n->get("main"))();
+			}
+			t[mode] = now() - t0;
+		}
+		printf("%10s %10.3f %10.3f %10.3f %10d\n", on == 2 ? "deep" : on ? "on" : "off", t[0], t[1], t[2], r);
+		fflush(stdout);
+	}
+}
+
+// 一時変数の場所の使い回しでフレームがどれだけ縮むか
+static void bench_frame()
+{
+	printf("frame: frame size of a recursive function with many temps (depth = 200000)\n");
+	printf("%10s %10s %10s %10s %10s\n", "optimize", "frame", "IL[s]", "bytecode[s]", "result");
+	const char *src =
+		"def f(n : int) : int\n"
+		"{\n"
+		"\tif (n == 0)\n"
+		"\t\treturn 0;\n"
+		"\tvar a = (n * 3 + 1) & 255;\n"
+		"\tvar b = (n * 5 + 2) & 255;\n"
+		"\tvar c = 'a';\n"
+		"\tif (a > b && b > 3 || a == b)\n"
+		"\t\tc++;\n"
+		"\treturn (f(n - 1) + a * b + (a - b) * (a + b) + (c == 'b' ? 1 : 0)) & 65535;\n"
+		"}\n"
+		"def main() : int\n"
+		"\treturn f(200000);\n";
+	for (int on = 0; on < 2; on++)
+	{
+		double t[2];
+		int r = 0, frame = 0;
+		for (int mode = 0; mode < 2; mode++)
+		{
+			Environment env = nes::compile_IL(src, on != 0);
+			if (!env)
+			{
+				printf("compile fail\n");
+				return;
+			}
+			frame = env->getFrameSize("f");
+			env->setStackSize(0x4000000);
+			env->useBytecode(mode == 1);
+			double t0 = now();
+			r = env->run();
+			t[mode] = now() - t0;
+		}
+		printf("%10s %10d %10.3f %10.3f %10d\n", on ? "on" : "off", frame, t[0], t[1], r);
+		fflush(stdout);
+	}
+}
+
+// 名前で直接呼ぶのと関数ポインタを通して呼ぶの
+static void bench_call()
+{
+	printf("call: direct call by name vs call through a function pointer\n");
+	printf("%10s %10s %10s %10s %10s\n", "call", "IL[s]", "bytecode[s]", "native[s]", "result");
+	const char *src[2] = {
+		"def add(a : int, b : int) : int\n"
+		"\treturn a + b;\n"
+		"def main() : int\n"
+		"{\n"
+		"\tvar i = 0;\n"
+		"\tvar s = 0;\n"
+		"\twhile (i < 3000000)\n"
+		"\t{\n"
+		"\t\ts = add(s, i) & 65535;\n"
+		"\t\ti = i + 1;\n"
+		"\t}\n"
+		"\treturn s;\n"
+		"}\n",
+		"def add(a : int, b : int) : int\n"
+		"\treturn a + b;\n"
+		"def main() : int\n"
+		"{\n"
+		"\tvar f = add;\n"
+		"\tvar i = 0;\n"
+		"\tvar s = 0;\n"
+		"\twhile (i < 3000000)\n"
+		"\t{\n"
+		"\t\ts = f(s, i) & 65535;\n"
+		"\t\ti = i + 1;\n"
+		"\t}\n"
+		"\treturn s;\n"
+		"}\n",
+	};
+	for (int k = 0; k < 2; k++)
+	{
+		double t[3];
+		int r = 0;
+		for (int mode = 0; mode < 3; mode++)
+		{
+			// 展開されると呼ばなくなるので展開はしない
+			Environment env = nes::compile_IL(src[k], true, 0);
+			if (!env)
+			{
+				printf("compile fail\n");
+				return;
+			}
+			double t0 = now();
+			if (mode < 2)
+			{
+				env->useBytecode(mode == 1);
+				r = env->run();
+			}
+			else
+			{
+				Native n = env->gen();
+				if (!n)
+				{
+					printf("gen fail\n");
+					return;
+				}
+				t0 = now();
+				r = ((int (*)())n->get("main"))();
+			}
+			t[mode] = now() - t0;
+		}
+		printf("%10s %10.3f %10.3f %10.3f %10d\n", k ? "pointer" : "direct", t[0], t[1], t[2], r);
+		fflush(stdout);
+	}
+}
+
+// Cからスクリプトの関数を1回呼ぶ重さ、名前で呼ぶのと引いておいたのを呼ぶの
+static void bench_api()
+{
+	printf("api: per-call overhead of calling a script function from C++ (ns/call)\n");
+	printf("%10s %10s %10s %10s %10s\n", "call", "IL", "bytecode", "native", "result");
+	const char *src =
+		"def add(a : int, b : int) : int\n"
+		"\treturn a + b;\n"
+		"def main() : int\n"
+		"\treturn 0;\n";
+	Environment env = nes::compile_IL(src);
+	if (!env)
+	{
+		printf("compile fail\n");
+		return;
+	}
+	Native n = env->gen();
+	if (!n)
+	{
+		printf("gen fail\n");
+		return;
+	}
+	const int count = 1000000, ncount = 10000000;
+	for (int k = 0; k < 2; k++)
+	{
+		double t[3];
+		int r = 0;
+		for (int mode = 0; mode < 3; mode++)
+		{
+			env->useBytecode(mode == 1);
+			IL::Handle<int (int, int)> h = env->lookup<int (int, int)>("add", mode == 2 ? n : Native());
+			int c = mode == 2 ? ncount : count;
+			r = 0;
+			double t0 = now();
+			for (int i = 0; i < c; i++)
+			{
+				if (k)
+					r = env->call(h, r, 1);
+				else if (mode < 2)
+					r = env->call("add", r, 1);
+				else
+					r = ((int (*)(int, int))n->get("add"))(r, 1);
+			}
+			t[mode] = (now() - t0) * 1e9 / c;
+		}
+		printf("%10s %10.1f %10.1f %10.1f %10d\n", k ? "handle" : "name", t[0], t[1], t[2], r);
+		fflush(stdout);
+	}
+}
+
+// 1回コンパイルしたのを、スレッドごとにExecutionContextを作って同時に呼ぶ
+struct Worker
+{
+	IL::Environment *env;
+	IL::Handle<int (int)> fib;
+	int count;
+	int result;
+};
+#ifdef _WIN32
+static DWORD WINAPI work(LPVOID p)
+#else
+static void *work(void *p)
+#endif
+{
+	Worker *w = (Worker*)p;
+	ExecutionContext cx(w->env);
+	for (int i = 0; i < w->count; i++)
+		w->result = cx.call(w->fib, 20);
+	return 0;
+}
+static void bench_threads()
+{
+	printf("threads: fib(20) from many threads sharing one compiled script\n");
+	printf("%10s %10s %10s %10s %10s\n", "threads", "IL[call/s]", "bytecode", "speedup", "result");
+	const char *src =
+		"def fib(n : int) : int\n"
+		"{\n"
+		"\tif (n < 2)\n"
+		"\t\treturn n;\n"
+		"\treturn fib(n - 1) + fib(n - 2);\n"
+		"}\n";
+	Environment env = nes::compile_IL(src);
+	if (!env)
+	{
+		printf("compile fail\n");
+		return;
+	}
+	IL::Handle<int (int)> fib = env->lookup<int (int)>("fib");	// 型を作るので先に引いておく
+	const int count = 200;
+	double base[2] = {0, 0};
+	for (int n = 1; n <= 8; n *= 2)
+	{
+		double rate[2];
+		int r = 0;
+		for (int mode = 0; mode < 2; mode++)
+		{
+			env->useBytecode(mode == 1);
+			Worker w[8];
+			double t0 = wall();
+		#ifdef _WIN32
+			HANDLE th[8];
+			for (int i = 0; i < n; i++)
+			{
+				w[i].env = env;
+				w[i].fib = fib;
+				w[i].count = count;
+				th[i] = CreateThread(NULL, 0, work, &w[i], 0, NULL);
+			}
+			WaitForMultipleObjects(n, th, TRUE, INFINITE);
+			for (int i = 0; i < n; i++)
+				CloseHandle(th[i]);
+		#else
+			pthread_t th[8];
+			for (int i = 0; i < n; i++)
+			{
+				w[i].env = env;
+				w[i].fib = fib;
+				w[i].count = count;
+				pthread_create(&th[i], NULL, work, &w[i]);
+			}
+			for (int i = 0; i < n; i++)
+				pthread_join(th[i], NULL);
+		#endif
+			rate[mode] = n * count / (wall() - t0);
+			r = w[n - 1].result;
+		}
+		if (n == 1)
+		{
+			base[0] = rate[0];
+			base[1] = rate[1];
+		}
+		printf("%10d %10.0f %10.0f %10.2f %10d\n", n, rate[0], rate[1], rate[1] / base[1], r);
+		fflush(stdout);
+	}
+}
+
+// テナントごとに別々の状態を持つ時、コンパイルからやり直すのとインスタンスを作るの
+static void bench_instance()
+{
+	printf("instance: 100 tenants with their own globals, compile each vs one code + instances\n");
+	printf("%10s %10s %10s %10s %10s\n", "tenants", "create[us]", "bytes", "fib[ns]", "result");
+	const char *src =
+		"var hits : int[256];\n"
+		"var total : int = 0;\n"
+		"def hit(k : int) : int\n"
+		"{\n"
+		"\thits[k & 255] = hits[k & 255] + 1;\n"
+		"\ttotal = total + 1;\n"
+		"\treturn total;\n"
+		"}\n"
+		"def fib(n : int) : int\n"
+		"{\n"
+		"\tif (n < 2)\n"
+		"\t\treturn n;\n"
+		"\treturn fib(n - 1) + fib(n - 2);\n"
+		"}\n";
+	const int tenants = 100, count = 1000;
+	for (int mode = 0; mode < 2; mode++)
+	{
+		vector<Environment> envs;
+		vector<Native> natives;
+		vector<shptr<Instance> > instances;
+		Environment env;
+		Native n;
+		double t0 = now();
+		if (mode == 1)
+		{
+			env = nes::compile_IL(src);
+			if (!env)
+			{
+				printf("compile fail\n");
+				return;
+			}
+			env->useInstance();
+			n = env->gen();
+			if (!n)
+			{
+				printf("gen fail\n");
+				return;
+			}
+		}
+		int bytes = 0;
+		for (int i = 0; i < tenants; i++)
+		{
+			if (mode == 0)
+			{
+				Environment e = nes::compile_IL(src);
+				Native m = e ? e->gen() : Native();
+				if (!m)
+				{
+					printf("gen fail\n");
+					return;
+				}
+				envs.push_back(e);
+				natives.push_back(m);
+				bytes += m->code.size() + m->image().size();
+			}
+			else
+			{
+				instances.push_back(new Instance(n));
+				bytes += instances.back()->size();
+			}
+		}
+		double create = (now() - t0) * 1e6 / tenants;
+		int r = 0;
+		IL::Handle<int (int)> hit, fib;
+		if (mode == 1)
+		{
+			hit = env->lookup<int (int)>("hit");
+			fib = env->lookup<int (int)>("fib");
+		}
+		for (int k = 0; k < count; k++)
+			for (int i = 0; i < tenants; i++)
+				r += mode ? instances[i]->call(hit, k) : ((int (*)(int))natives[i]->get("hit"))(k);
+		double t1 = now();
+		for (int i = 0; i < tenants; i++)
+			r += mode ? instances[i]->call(fib, 15) : ((int (*)(int))natives[i]->get("fib"))(15);
+		double t = (now() - t1) * 1e9 / tenants;
+		printf("%10s %10.1f %10d %10.1f %10d\n", mode ? "instance" : "compile", create, bytes / tenants, t, r);
+		fflush(stdout);
+	}
+}
+
+// リクエストごとにスクリプトの状態を初期化が終わった所に戻す重さ
+static void bench_reset()
+{
+	printf("reset: put 64KB of globals back to the state after initialization (us/reset)\n");
+	printf("%10s %10s %10s %10s\n", "reset", "time[us]", "bytes", "result");
+	const char *src =
+		"var table : int[16384];\n"
+		"var total : int = 100;\n"
+		"def hit(k : int) : int\n"
+		"{\n"
+		"\ttable[k & 16383] = table[k & 16383] + 1;\n"
+		"\ttotal = total + 1;\n"
+		"\treturn total;\n"
+		"}\n";
+	Environment env = nes::compile_IL(src);
+	if (!env)
+	{
+		printf("compile fail\n");
+		return;
+	}
+	IL::Snapshot s = env->snapshot();
+	env->useInstance();
+	Native n = env->gen();
+	if (!n)
+	{
+		printf("gen fail\n");
+		return;
+	}
+	Instance inst(n);
+	IL::Handle<int (int)> hit = env->lookup<int (int)>("hit");
+	const char *names[] = {"compile", "snapshot", "instance"};
+	for (int mode = 0; mode < 3; mode++)
+	{
+		int count = mode ? 10000 : 20, r = 0;
+		double t = 0;
+		Environment e = env;
+		IL::Handle<int (int)> h = hit;
+		for (int i = 0; i < count; i++)
+		{
+			// 1リクエスト分書き換えてから戻す
+			if (mode == 2)
+				inst.call(h, i);
+			else
+				e->call(h, i);
+			double t0 = now();
+			if (mode == 0)
+			{
+				e = nes::compile_IL(src);
+				h = e->lookup<int (int)>("hit");
+			}
+			else if (mode == 1)
+				e->restore(s);
+			else
+				inst.reset();
+			t += now() - t0;
+			r = mode == 2 ? inst.call(h, i) : e->call(h, i);
+		}
+		printf("%10s %10.2f %10d %10d\n", names[mode], t * 1e6 / count, (int)s.size(), r);
+		fflush(stdout);
+	}
+}
+
+// 燃料を数える分の重さ、中間言語は-1なら数えない、JITはuseFuel()の有無
+static void bench_fuel()
+{
+	printf("fuel: cost of metering back-edges and calls\n");
+	printf("%10s %10s %10s %10s %10s\n", "mode", "func", "fuel", "run[s]", "result");
+	const char *src =
+		"def fib(n : int) : int\n"
+		"\treturn (n < 2) ? 1 : (fib(n-1) + fib(n-2));\n"
+		"def kernel(n : int) : int\n"
+		"{\n"
+		"\tvar i = 0;\n"
+		"\tvar s = 0;\n"
+		"\twhile (i < n)\n"
+		"\t{\n"
+		"\t\ts += i * i - (i >> 1);\n"
+		"\t\ti++;\n"
+		"\t}\n"
+		"\treturn s;\n"
+		"}\n";
+	const char *modes[] = {"IL", "bytecode", "jit"};
+	const char *name[] = {"fib", "kernel"};
+	for (int mode = 0; mode < 3; mode++)
+	{
+		for (int f = 0; f < 2; f++)
+		{
+			for (int on = 0; on < 2; on++)
+			{
+				Environment env = nes::compile_IL(src);
+				if (!env)
+				{
+					printf("compile fail\n");
+					return;
+				}
+				int arg = mode == 2 ? (f ? 100000000 : 32) : (f ? 5000000 : 27);
+				IL::Handle<int (int)> h = env->lookup<int (int)>(name[f]);
+				double t0, t1;
+				int r;
+				if (mode < 2)
+				{
+					env->useBytecode(mode == 1);
+					ExecutionContext cx(env);
+					cx.setFuel(on ? 0x7FFFFFFF : -1);
+					t0 = now();
+					r = cx.call(h, arg);
+					t1 = now();
+				}
+				else
+				{
+					env->useFuel(on != 0);
+					Native n = env->gen();
+					if (!n)
+					{
+						printf("gen fail\n");
+						return;
+					}
+					h = env->lookup<int (int)>(name[f], n);
+					t0 = now();
+					r = env->call(h, arg);
+					t1 = now();
+				}
+				printf("%10s %10s %10s %10.3f %10d\n", modes[mode], name[f], on ? "on" : "off", t1 - t0, r);
+				fflush(stdout);
+			}
+		}
+	}
+}
+
+// 短いスクリプトと長く回るスクリプトを、中間言語だけ、最初に全部JIT、段を上げる、で頭から最後まで
+// 回ってる途中の関数は乗り換えない(展開された葉関数のループもそう)ので、長い方は呼ぶ回数で稼ぐ
+static void bench_tiered()
+{
+	printf("tiered: compile + run, IL only vs JIT everything up front vs interpret then JIT hot functions\n");
+	printf("%10s %10s %10s %10s\n", "script", "mode", "time[ms]", "result");
+	const char *lib =
+		"def fib(n : int) : int\n"
+		"\treturn (n < 2) ? 1 : (fib(n-1) + fib(n-2));\n";
+	const char *name[] = {"short", "long"};
+	const char *mains[] = {
+		"def main() : int\n"
+		"\treturn fib(5);\n",
+		"def main() : int\n"
+		"{\n"
+		"\tvar i = 0;\n"
+		"\tvar s = 0;\n"
+		"\twhile (i < 100)\n"
+		"\t{\n"
+		"\t\ts += fib(20);\n"
+		"\t\ti++;\n"
+		"\t}\n"
+		"\treturn s;\n"
+		"}\n",
+	};
+	const char *modes[] = {"IL", "jit", "tiered"};
+	for (int s = 0; s < 2; s++)
+	{
+		string src = string(lib) + mains[s];
+		for (int mode = 0; mode < 3; mode++)
+		{
+			double t0 = now();
+			Environment env = nes::compile_IL(src);
+			if (!env)
+			{
+				printf("compile fail\n");
+				return;
+			}
+			int r;
+			if (mode == 1)
+			{
+				Native n = env->gen();
+				if (!n)
+				{
+					printf("gen fail\n");
+					return;
+				}
+				r = ((int (*)())n->get("main"))();
+			}
+			else
+			{
+				env->useTiered(mode == 2 ? 1000 : 0);
+				r = env->run();
+			}
+			double t1 = now();
+			printf("%10s %10s %10.3f %10d\n", name[s], modes[mode], (t1 - t0) * 1e3, r);
+			fflush(stdout);
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	string name = argc < 2 ? "" : argv[1];
+	if (name.empty() || name == "compile")
+		bench_compile();
+	if (name.empty() || name == "expression")
+		bench_expression();
+	if (name.empty() || name == "codegen")
+		bench_codegen();
+	if (name.empty() || name == "loop")
+		bench_loop();
+	if (name.empty() || name == "fib")
+		bench_fib();
+	if (name.empty() || name == "jit")
+		bench_jit();
+	if (name.empty() || name == "optimize")
+		bench_optimize();
+	if (name.empty() || name == "inline")
+		bench_inline();
+	if (name.empty() || name == "tail")
+		bench_tail();
+	if (name.empty() || name == "frame")
+		bench_frame();
+	if (name.empty() || name == "call")
+		bench_call();
+	if (name.empty() || name == "api")
+		bench_api();
+	if (name.empty() || name == "threads")
+		bench_threads();
+	if (name.empty() || name == "instance")
+		bench_instance();
+	if (name.empty() || name == "reset")
+		bench_reset();
+	if (name.empty() || name == "fuel")
+		bench_fuel();
+	if (name.empty() || name == "tiered")
+		bench_tiered();
+	return 0;
+}
@@ -0,0 +1,118 @@
+#ifndef NES_ASSEMBLER_H
+#define NES_ASSEMBLER_H
+
+#include <vector>
+#include <set>
+
+#include "x64.h"
+
+namespace NES{
+
+// 関数1つ分の機械語を組み立てる
+// ジャンプ先はラベルの番号で指定して、ラベルの位置が決まった所で埋める
+// 後ろに飛ぶのは距離が分かってるので短い方で吐く
+// 前に飛ぶのは短い方で吐いておいて、届かなかったら長くして最初から吐き直す
+// 長くしたジャンプはlongsに覚えておくので、同じ物を吐けば同じ大きさになる
+class Assembler
+{
+public:
+	typedef cpu::code code;
+	typedef std::set<int> Long;	// 長くする前に飛ぶジャンプの通し番号
+
+	code &Codes(){return c;}
+	// 吐き始める、labelsはラベルの数
+	void begin(int labels, Long *l)
+	{
+		c.clear();
+		label.assign(labels, -1);
+		fixup.clear();
+		longs = l;
+		jumps = 0;
+		retry = false;
+	}
+	// 吐き終わり、届かないジャンプがあって吐き直すならfalse
+	bool end()
+	{
+		return !retry && fixup.empty();
+	}
+	// ラベルを今の位置に置いて、そこに飛んでくるジャンプを埋める
+	void bind(int l)
+	{
+		label[l] = c.size();
+		for (int i = 0; i < (int)fixup.size(); )
+		{
+			Fixup &f = fixup[i];
+			if (f.label != l)
+			{
+				i++;
+				continue;
+			}
+			int j = label[l] - f.end;
+			if (!f.wide)
+			{
+				if (cpu::imm8(j))
+					c[f.end - 1] = j;
+				else
+				{
+					longs->insert(f.jump);
+					retry = true;
+				}
+			}
+			else
+			{
+				for (int k = 0; k < 4; k++)
+					c[f.end - 4 + k] = (dword)j >> (k * 8);
+			}
+			fixup.erase(fixup.begin() + i);
+		}
+	}
+	void jmp(int l){jcc(-1, l);}
+	// ccが負ならjmp
+	void jcc(int cc, int l)
+	{
+		int n = jumps++;
+		if (label[l] >= 0)
+		{
+			int j = label[l] - ((int)c.size() + 2);
+			if (cpu::imm8(j))
+				emit(cc, j, false);
+			else
+				emit(cc, label[l] - ((int)c.size() + (cc < 0 ? 5 : 6)), true);
+			return;
+		}
+		Fixup f;
+		f.label = l;
+		f.jump = n;
+		f.wide = longs->count(n) != 0;
+		emit(cc, 0, f.wide);
+		f.end = c.size();
+		fixup.push_back(f);
+	}
+
+private:
+	typedef cpu::dword dword;
+	struct Fixup
+	{
+		int label;
+		int end;	// ジャンプ命令の次の位置
+		int jump;
+		bool wide;
+	};
+	code c;
+	std::vector<int> label;
+	std::vector<Fixup> fixup;
+	Long *longs;
+	int jumps;
+	bool retry;
+
+	void emit(int cc, int j, bool wide)
+	{
+		if (cc < 0)
+			wide ? cpu::jmp(c, j) : cpu::jmp8(c, j);
+		else
+			wide ? cpu::jcc(c, cc, j) : cpu::jcc8(c, cc, j);
+	}
+};
+
+}
+#endif
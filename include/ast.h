@@ -53,13 +53,13 @@ namespace AST
 		};
 		struct PrimitiveFunction : NameElement
 		{
-			PrimitiveFunction(const string &s, VType t, int v, int a) : NameElement(s), type(t), val(v), address(a){}
+			PrimitiveFunction(const string &s, VType t, const void *f, int a) : NameElement(s), type(t), func(f), address(a){}
 			void gene(Environment *env)
 			{
-				env->addGlobal(name, type, val, address);
+				env->addNative(name, type, func, address);
 			}
 		private:
-			int val;
+			const void *func;
 			VType type;
 			int address;
 		};
@@ -76,14 +76,14 @@ namespace AST
 
 				IL::FuncPtr *t = new IL::FuncPtr(new IL::Primitive(IL::ValueType::Int));
 				t->add(new IL::Pointer(new IL::Primitive(IL::ValueType::Char)));
-				dic["puts"] = new PrimitiveFunction("puts", t, (int)&std::puts, 8);
+				dic["puts"] = new PrimitiveFunction("puts", t, (const void*)&std::puts, 8);
 
 				t = new IL::FuncPtr(new IL::Primitive(IL::ValueType::Int));
 				t->add(new IL::Primitive(IL::ValueType::Int));
-				dic["putchar"] = new PrimitiveFunction("putchar", t, (int)&std::putchar, 0);
+				dic["putchar"] = new PrimitiveFunction("putchar", t, (const void*)&std::putchar, 0);
 
 				t = new IL::FuncPtr(new IL::Primitive(IL::ValueType::Int));
-				dic["getchar"] = new PrimitiveFunction("getchar", t, (int)&std::getchar, 4);
+				dic["getchar"] = new PrimitiveFunction("getchar", t, (const void*)&std::getchar, 4);
 			}
 			NameSpace(const string &s) : NameElement(s){}
 			bool Add(element e)
@@ -129,10 +129,15 @@ namespace AST
 		int getTemp()																	{return ienv->getTemp();}
 		void addType(const string &name, VType type)									{ienv->addType(name, type);}
 		int addGlobal(const string &name, VType type, int val = 0, int address = -1)	{return ienv->addGlobal(name, type, val, address);}
+		int addNative(const string &name, VType type, const void *func, int address)	{return ienv->addNative(name, type, func, address);}
 		int addString(const string &s)													{return ienv->addString(s);}
-		void initGlobal(const string &name)												{ienv->runInit(name);}
+		void initGlobal(const string &name)
+		{
+			if (!ienv->runInit(name))
+				err(name + " initializer did not finish");
+		}
 		void EnterFunction(const string &s, VType r)									{ienv->EnterFunction(s, r);}
-		void LeaveFunction()															{ienv->LeaveFunction();}
+		void LeaveFunction()															{ienv->resolve();ienv->LeaveFunction();}
 		void EnterLoop(int breakLabel, int continueLabel)								{break_label.push_back(breakLabel);continue_label.push_back(continueLabel);}
 		void LeaveLoop()																{break_label.pop_back();continue_label.pop_back();}
 		int getBreakLabel()																{return break_label.back();}
@@ -157,9 +162,11 @@ namespace AST
 		void LeaveNameSpace()				{ienv->LeaveNameSpace();}
 		ValueInfo getNVar(const string &s)	{return ienv->last_ns->get(ienv, s);}
 
-		shptr<IL::Environment> gen()
+		shptr<IL::Environment> gen(bool optimize = true, int inline_budget = 128)
 		{
 			ienv = new IL::Environment();
+			ienv->useOptimize(optimize);
+			ienv->useInline(inline_budget);
 			ns->gen(this);
 			if (errors)
 			{
@@ -185,9 +192,84 @@ namespace AST
 	};
 	typedef shptr<TypeBase> Type;
 
+	// 畳み込んだ定数、int uint char boolだけ
+	struct Constant
+	{
+		Constant() : x(0), type(IL::ValueType::Void){}
+		Constant(int i, IL::ValueType::primitive t) : x(i), type(t){}
+		int x;
+		IL::ValueType::primitive type;
+		bool is(IL::ValueType::primitive t){return type == t;}
+		bool isInt(){return type == IL::ValueType::Int || type == IL::ValueType::UInt;}
+		unsigned int u(){return (unsigned int)x;}
+		ValueInfo gen(Environment *env)
+		{
+			ValueInfo to(env->getTemp(), new IL::Primitive(type));
+			env->pushcode(new IL::getInt(to.address, x));
+			return to;
+		}
+	};
+
 	struct Expression
 	{
 		virtual ~Expression(){}
+		// 定数に畳めるならtrue、コードは出さない
+		virtual bool constant(Environment *env, Constant &c){return false;}
+		// 型名(enumとか)の時はその型
+		virtual VType typeName(Environment *env){return NULL;}
+		// 関数の名前の時はその関数(直接呼べる)
+		virtual IL::Function *function(Environment *env){return NULL;}
+		// 条件がwhenの時にlabelへ飛ぶ、条件の型を返す
+		VType genJump(Environment *env, bool when, int label)
+		{
+			Constant c;
+			if (constant(env, c) && c.is(IL::ValueType::Bool))
+			{
+				// どっちに行くかもう決まってる
+				if (!c.x == !when)
+					env->pushcode(new IL::jump(label));
+				return new IL::Primitive(IL::ValueType::Bool);
+			}
+			return genBranch(env, when, label);
+		}
+		// 比較とかは値を作らずにそのまま飛べる
+		virtual VType genBranch(Environment *env, bool when, int label)
+		{
+			ValueInfo v = genR(env);
+			if (when)
+				env->pushcode(new IL::jump_true(v.address, label));
+			else
+				env->pushcode(new IL::jump_false(v.address, label));
+			return v.type;
+		}
+		// 2の冪ならその指数
+		static int log2(int x)
+		{
+			if (x <= 0 || (x & (x - 1)))
+				return -1;
+			int k = 0;
+			while (x >>= 1)
+				k++;
+			return k;
+		}
+		// index*sizeを計算して入ってる場所を返す、2の冪ならシフトにする
+		static int genScale(Environment *env, int to, int index, int size)
+		{
+			int k = log2(size);
+			if (k == 0)
+				return index;
+			if (k > 0)
+			{
+				env->pushcode(new IL::getInt(to, k));
+				env->pushcode(new IL::ishl(to, index, to));
+			}
+			else
+			{
+				env->pushcode(new IL::getInt(to, size));
+				env->pushcode(new IL::imul(to, index, to));
+			}
+			return to;
+		}
 		virtual ValueInfo genL(Environment *env)
 		{
 			env->err("not L-value");
@@ -204,8 +286,13 @@ namespace AST
 			}
 			if (v.type->isP(IL::ValueType::Array))
 			{
+				if (v.isMemory())
+					return ValueInfo(v.address, new IL::Pointer(v.type->get()));
 				ValueInfo to(env->getTemp(), new IL::Pointer(v.type->get()));
-				env->pushcode(new IL::getLocalPtr(to.address, v.address));
+				if (v.isGlobal())
+					env->pushcode(new IL::getGlobalPtr(to.address, v.address));
+				else
+					env->pushcode(new IL::getLocalPtr(to.address, v.address));
 				return to;
 			}
 			if (v.isStack())
@@ -226,7 +313,7 @@ namespace AST
 			}
 			else if (v.atype == ValueInfo::function)
 			{
-				IL::Function *f = (IL::Function*)v.address;
+				IL::Function *f = (IL::Function*)v.object;
 				ValueInfo to(env->getTemp(), f->getFuncPtr());
 				env->pushcode(new IL::getFunction(to.address, f));
 				return to;
@@ -254,12 +341,31 @@ namespace AST
 			return v;
 		}
 		ValueInfo genR(Environment *env){return LtoR(env, genL(env));}
+		VType typeName(Environment *env)
+		{
+			ValueInfo v = env->getVariable(name);
+			if (v.atype == ValueInfo::TypeName)
+				return v.type;
+			return NULL;
+		}
+		IL::Function *function(Environment *env)
+		{
+			ValueInfo v = env->getVariable(name);
+			if (v.atype == ValueInfo::function)
+				return (IL::Function*)v.object;
+			return NULL;
+		}
 	private:
 		string name;
 	};
 	struct Int : Term
 	{
 		Int(int i){x = i;}
+		bool constant(Environment *env, Constant &c)
+		{
+			c = Constant(x, IL::ValueType::Int);
+			return true;
+		}
 		ValueInfo genR(Environment *env)
 		{
 			ValueInfo to(env->getTemp(), new IL::Primitive(IL::ValueType::Int));
@@ -284,6 +390,11 @@ namespace AST
 	struct Char : Term
 	{
 		Char(char c){x = c;}
+		bool constant(Environment *env, Constant &c)
+		{
+			c = Constant(x, IL::ValueType::Char);
+			return true;
+		}
 		ValueInfo genR(Environment *env)
 		{
 			ValueInfo to(env->getTemp(), new IL::Primitive(IL::ValueType::Char));
@@ -445,6 +556,7 @@ namespace AST
 	struct Plus : UnaryExpression
 	{
 		Plus(Exp x) : UnaryExpression(x){}
+		bool constant(Environment *env, Constant &c){return e->constant(env, c);}
 		ValueInfo genR(Environment *env)
 		{
 			return e->genR(env);
@@ -453,8 +565,18 @@ namespace AST
 	struct Minus : UnaryExpression
 	{
 		Minus(Exp x) : UnaryExpression(x){}
+		bool constant(Environment *env, Constant &c)
+		{
+			if (!e->constant(env, c) || !c.is(IL::ValueType::Int))
+				return false;
+			c.x = 0u - c.u();
+			return true;
+		}
 		ValueInfo genR(Environment *env)
 		{
+			Constant c;
+			if (constant(env, c))
+				return c.gen(env);
 			ValueInfo ri = e->genR(env);
 			ValueInfo to(env->getTemp(), ri.type);
 			if (ri.type->isP(IL::ValueType::Int))
@@ -469,8 +591,25 @@ namespace AST
 	struct Not : UnaryExpression
 	{
 		Not(Exp x) : UnaryExpression(x){}
+		bool constant(Environment *env, Constant &c)
+		{
+			if (!e->constant(env, c) || !c.is(IL::ValueType::Bool))
+				return false;
+			c.x = !c.x;
+			return true;
+		}
+		VType genBranch(Environment *env, bool when, int label)
+		{
+			VType t = e->genJump(env, !when, label);
+			if (!t->isP(IL::ValueType::Bool))
+				env->err("this type do not '!' operation");
+			return t;
+		}
 		ValueInfo genR(Environment *env)
 		{
+			Constant c;
+			if (constant(env, c))
+				return c.gen(env);
 			ValueInfo ri = e->genR(env);
 			ValueInfo to(env->getTemp(), ri.type);
 			if (ri.type->isP(IL::ValueType::Bool))
@@ -483,8 +622,18 @@ namespace AST
 	struct Compl : UnaryExpression
 	{
 		Compl(Exp x) : UnaryExpression(x){}
+		bool constant(Environment *env, Constant &c)
+		{
+			if (!e->constant(env, c) || !c.isInt())
+				return false;
+			c.x = ~c.u();
+			return true;
+		}
 		ValueInfo genR(Environment *env)
 		{
+			Constant c;
+			if (constant(env, c))
+				return c.gen(env);
 			ValueInfo ri = e->genR(env);
 			ValueInfo to(env->getTemp(), ri.type);
 			if (ri.type->isP(IL::ValueType::Int) || ri.type->isP(IL::ValueType::UInt))
@@ -549,29 +698,127 @@ namespace AST
 		}
 		ValueInfo genR(Environment *env)
 		{
-			ValueInfo li = l->genR(env);
-			ValueInfo ri = r->genR(env);
-			ValueInfo to = env->getTemp();
-			to.type = li.type;
+			Constant c;
+			if (constant(env, c))
+				return c.gen(env);
+			ValueInfo li, ri, to;
+			if (l->constant(env, c))
+			{
+				// 定数は副作用が無いので右を先に出してもいい
+				ri = r->genR(env);
+				if (commutative() && identity(ri, c, true))
+					return ri;
+				if (commutative() && reduce(env, ri, c, to))
+					return to;
+				li = c.gen(env);
+			}
+			else
+			{
+				li = l->genR(env);
+				if (r->constant(env, c))
+				{
+					if (identity(li, c, false))
+						return li;
+					if (reduce(env, li, c, to))
+						return to;
+				}
+				ri = r->genR(env);
+			}
+			to = ValueInfo(env->getTemp(), li.type);
 			gen(env, to, li, ri);
 			return to;
 		}
 		virtual void gen(Environment *env, ValueInfo &to, ValueInfo &li, ValueInfo &ri){}
+		// 両方定数なら計算しておく、型の組み合わせはgen()と同じにする
+		bool constant(Environment *env, Constant &c)
+		{
+			Constant a, b;
+			return l->constant(env, a) && r->constant(env, b) && calc(a, b, c);
+		}
+		virtual bool calc(Constant &a, Constant &b, Constant &c){return false;}
+		// x+0とかx*1とか、xがそのまま答えになる時、leftは定数が左の時
+		virtual bool identity(ValueInfo &x, Constant &c, bool left){return false;}
+		// x*2^kとか、もっと軽い命令で済む時
+		virtual bool reduce(Environment *env, ValueInfo &x, Constant &c, ValueInfo &to){return false;}
+		virtual bool commutative(){return false;}
+		// int同士かuint同士
+		static bool same(VType t, Constant &c)
+		{
+			return (t->isP(IL::ValueType::Int) && c.is(IL::ValueType::Int)) || (t->isP(IL::ValueType::UInt) && c.is(IL::ValueType::UInt));
+		}
+		static bool same(Constant &a, Constant &b)
+		{
+			return a.isInt() && a.type == b.type;
+		}
+		// 比べられる組み合わせなら、符号付きのintで比べられる値にする
+		static bool order(Constant &a, Constant &b, int &x, int &y)
+		{
+			if (a.is(IL::ValueType::Int) && b.is(IL::ValueType::Int))
+			{
+				x = a.x;
+				y = b.x;
+				return true;
+			}
+			if (a.is(IL::ValueType::UInt) && b.is(IL::ValueType::UInt))
+			{
+				x = (int)(a.u() ^ 0x80000000u);
+				y = (int)(b.u() ^ 0x80000000u);
+				return true;
+			}
+			if (a.is(IL::ValueType::Char) && b.is(IL::ValueType::Char))
+			{
+				x = (char)a.x;
+				y = (char)b.x;
+				return true;
+			}
+			return false;
+		}
 	protected:
 		Exp l;
 		Exp r;
 	};
-	struct Add : BinaryExpression
+	// 比較演算子、分岐の条件の時は0/1を作らずにjump_cmpにする
+	struct Compare : BinaryExpression
 	{
-		Add(Exp left, Exp right) : BinaryExpression(left, right){}
-		ValueInfo genR(Environment *env)
+		Compare(Exp left, Exp right) : BinaryExpression(left, right){}
+		// 型に合った比較命令(BC::iltとか)、無ければ-1
+		virtual int cmpop(VType l, VType r){return -1;}
+		VType genBranch(Environment *env, bool when, int label)
 		{
 			ValueInfo li = l->genR(env);
 			ValueInfo ri = r->genR(env);
-			ValueInfo to(env->getTemp(), li.type);
-			gen(env, to, li, ri);
-			return to;
+			int op = cmpop(li.type, ri.type);
+			if (op < 0)
+			{
+				ValueInfo to(env->getTemp(), li.type);
+				gen(env, to, li, ri);
+				if (when)
+					env->pushcode(new IL::jump_true(to.address, label));
+				else
+					env->pushcode(new IL::jump_false(to.address, label));
+				return to.type;
+			}
+			env->pushcode(new IL::jump_cmp(when ? op : IL::jump_cmp::negate(op), li.address, ri.address, label));
+			return new IL::Primitive(IL::ValueType::Bool);
 		}
+	};
+	struct Add : BinaryExpression
+	{
+		Add(Exp left, Exp right) : BinaryExpression(left, right){}
+		bool calc(Constant &a, Constant &b, Constant &c)
+		{
+			if (!same(a, b) && !(a.is(IL::ValueType::Char) && b.isInt()))
+				return false;
+			c = Constant(a.u() + b.u(), a.type);
+			return true;
+		}
+		bool identity(ValueInfo &x, Constant &c, bool left)
+		{
+			if (c.x != 0)
+				return false;
+			return same(x.type, c) || (!left && x.type->isP(IL::ValueType::Char) && c.isInt());
+		}
+		bool commutative(){return true;}
 		void gen(Environment *env, ValueInfo &to, ValueInfo &li, ValueInfo &ri)
 		{
 			if (li.type->isP(IL::ValueType::Int))
@@ -584,10 +831,8 @@ namespace AST
 				else if (ri.type->isP(IL::ValueType::Pointer))
 				{
 					to.type = ri.type;
-					int size = ri.type->get()->getSize();
-					env->pushcode(new IL::getInt(to.address, size));
-					env->pushcode(new IL::imul(to.address, li.address, to.address));
-					env->pushcode(new IL::iadd(to.address, to.address, ri.address));
+					int i = genScale(env, to.address, li.address, ri.type->get()->getSize());
+					env->pushcode(new IL::iadd(to.address, i, ri.address));
 					return;
 				}
 			}
@@ -601,10 +846,8 @@ namespace AST
 				else if (ri.type->isP(IL::ValueType::Pointer))
 				{
 					to.type = ri.type;
-					int size = ri.type->get()->getSize();
-					env->pushcode(new IL::getInt(to.address, size));
-					env->pushcode(new IL::imul(to.address, li.address, to.address));
-					env->pushcode(new IL::iadd(to.address, to.address, ri.address));
+					int i = genScale(env, to.address, li.address, ri.type->get()->getSize());
+					env->pushcode(new IL::iadd(to.address, i, ri.address));
 					return;
 				}
 			}
@@ -628,10 +871,8 @@ namespace AST
 			{
 				if (ri.type->isP(IL::ValueType::Int) || ri.type->isP(IL::ValueType::UInt))
 				{
-					int size = ri.type->get()->getSize();
-					env->pushcode(new IL::getInt(to.address, size));
-					env->pushcode(new IL::imul(to.address, ri.address, to.address));
-					env->pushcode(new IL::iadd(to.address, to.address, li.address));
+					int i = genScale(env, to.address, ri.address, li.type->get()->getSize());
+					env->pushcode(new IL::iadd(to.address, i, li.address));
 					return;
 				}
 			}
@@ -641,6 +882,17 @@ namespace AST
 	struct Sub : BinaryExpression
 	{
 		Sub(Exp left, Exp right) : BinaryExpression(left, right){}
+		bool calc(Constant &a, Constant &b, Constant &c)
+		{
+			if (!same(a, b) && !(a.is(IL::ValueType::Char) && (b.isInt() || b.is(IL::ValueType::Char))))
+				return false;
+			c = Constant(a.u() - b.u(), a.type);
+			return true;
+		}
+		bool identity(ValueInfo &x, Constant &c, bool left)
+		{
+			return c.x == 0 && (same(x.type, c) || (x.type->isP(IL::ValueType::Char) && (c.isInt() || c.is(IL::ValueType::Char))));
+		}
 		void gen(Environment *env, ValueInfo &to, ValueInfo &li, ValueInfo &ri)
 		{
 			if (li.type->isP(IL::ValueType::Int))
@@ -679,10 +931,8 @@ namespace AST
 			{
 				if (ri.type->isP(IL::ValueType::Int) || ri.type->isP(IL::ValueType::UInt))
 				{
-					int size = ri.type->get()->getSize();
-					env->pushcode(new IL::getInt(to.address, size));
-					env->pushcode(new IL::imul(to.address, ri.address, to.address));
-					env->pushcode(new IL::isub(to.address, to.address, li.address));
+					int i = genScale(env, to.address, ri.address, li.type->get()->getSize());
+					env->pushcode(new IL::isub(to.address, li.address, i));
 					return;
 				}
 				else if (ri.type->isP(IL::ValueType::Pointer))
@@ -698,6 +948,25 @@ namespace AST
 	struct Mul : BinaryExpression
 	{
 		Mul(Exp left, Exp right) : BinaryExpression(left, right){}
+		bool calc(Constant &a, Constant &b, Constant &c)
+		{
+			if (!same(a, b))
+				return false;
+			c = Constant(a.u() * b.u(), a.type);
+			return true;
+		}
+		bool identity(ValueInfo &x, Constant &c, bool left){return c.x == 1 && same(x.type, c);}
+		bool reduce(Environment *env, ValueInfo &x, Constant &c, ValueInfo &to)
+		{
+			int k = log2(c.x);
+			if (k <= 0 || !same(x.type, c))
+				return false;
+			to = ValueInfo(env->getTemp(), x.type);
+			env->pushcode(new IL::getInt(to.address, k));
+			env->pushcode(new IL::ishl(to.address, x.address, to.address));
+			return true;
+		}
+		bool commutative(){return true;}
 		void gen(Environment *env, ValueInfo &to, ValueInfo &li, ValueInfo &ri)
 		{
 			if (li.type->isP(IL::ValueType::Int))
@@ -730,6 +999,15 @@ namespace AST
 	struct Div : BinaryExpression
 	{
 		Div(Exp left, Exp right) : BinaryExpression(left, right){}
+		// JITは符号無しで割るので、負の数が絡む時は畳まない
+		bool calc(Constant &a, Constant &b, Constant &c)
+		{
+			if (!same(a, b) || a.x < 0 || b.x <= 0)
+				return false;
+			c = Constant(a.x / b.x, a.type);
+			return true;
+		}
+		bool identity(ValueInfo &x, Constant &c, bool left){return c.x == 1 && same(x.type, c);}
 		void gen(Environment *env, ValueInfo &to, ValueInfo &li, ValueInfo &ri)
 		{
 			if (li.type->isP(IL::ValueType::Int))
@@ -762,6 +1040,13 @@ namespace AST
 	struct Mod : BinaryExpression
 	{
 		Mod(Exp left, Exp right) : BinaryExpression(left, right){}
+		bool calc(Constant &a, Constant &b, Constant &c)
+		{
+			if (!same(a, b) || a.x < 0 || b.x <= 0)
+				return false;
+			c = Constant(a.x % b.x, a.type);
+			return true;
+		}
 		void gen(Environment *env, ValueInfo &to, ValueInfo &li, ValueInfo &ri)
 		{
 			if (li.type->isP(IL::ValueType::Int))
@@ -786,6 +1071,17 @@ namespace AST
 	struct SHL : BinaryExpression
 	{
 		SHL(Exp left, Exp right) : BinaryExpression(left, right){}
+		bool calc(Constant &a, Constant &b, Constant &c)
+		{
+			if (!a.isInt() || !b.isInt() || b.u() >= 32)
+				return false;
+			c = Constant(a.u() << b.x, a.type);
+			return true;
+		}
+		bool identity(ValueInfo &x, Constant &c, bool left)
+		{
+			return c.x == 0 && c.isInt() && (x.type->isP(IL::ValueType::Int) || x.type->isP(IL::ValueType::UInt));
+		}
 		void gen(Environment *env, ValueInfo &to, ValueInfo &li, ValueInfo &ri)
 		{
 			if (li.type->isP(IL::ValueType::Int))
@@ -810,6 +1106,20 @@ namespace AST
 	struct SHR : BinaryExpression
 	{
 		SHR(Exp left, Exp right) : BinaryExpression(left, right){}
+		bool calc(Constant &a, Constant &b, Constant &c)
+		{
+			if (!a.isInt() || !b.isInt() || b.u() >= 32)
+				return false;
+			if (a.is(IL::ValueType::Int))
+				c = Constant(a.x >> b.x, a.type);
+			else
+				c = Constant(a.u() >> b.x, a.type);
+			return true;
+		}
+		bool identity(ValueInfo &x, Constant &c, bool left)
+		{
+			return c.x == 0 && c.isInt() && (x.type->isP(IL::ValueType::Int) || x.type->isP(IL::ValueType::UInt));
+		}
 		void gen(Environment *env, ValueInfo &to, ValueInfo &li, ValueInfo &ri)
 		{
 			if (li.type->isP(IL::ValueType::Int))
@@ -834,6 +1144,15 @@ namespace AST
 	struct AND : BinaryExpression
 	{
 		AND(Exp left, Exp right) : BinaryExpression(left, right){}
+		bool calc(Constant &a, Constant &b, Constant &c)
+		{
+			if (!same(a, b))
+				return false;
+			c = Constant(a.x & b.x, a.type);
+			return true;
+		}
+		bool identity(ValueInfo &x, Constant &c, bool left){return c.x == -1 && same(x.type, c);}
+		bool commutative(){return true;}
 		void gen(Environment *env, ValueInfo &to, ValueInfo &li, ValueInfo &ri)
 		{
 			if (li.type->isP(IL::ValueType::Int))
@@ -858,6 +1177,15 @@ namespace AST
 	struct XOR : BinaryExpression
 	{
 		XOR(Exp left, Exp right) : BinaryExpression(left, right){}
+		bool calc(Constant &a, Constant &b, Constant &c)
+		{
+			if (!same(a, b))
+				return false;
+			c = Constant(a.x ^ b.x, a.type);
+			return true;
+		}
+		bool identity(ValueInfo &x, Constant &c, bool left){return c.x == 0 && same(x.type, c);}
+		bool commutative(){return true;}
 		void gen(Environment *env, ValueInfo &to, ValueInfo &li, ValueInfo &ri)
 		{
 			if (li.type->isP(IL::ValueType::Int))
@@ -882,6 +1210,15 @@ namespace AST
 	struct OR : BinaryExpression
 	{
 		OR(Exp left, Exp right) : BinaryExpression(left, right){}
+		bool calc(Constant &a, Constant &b, Constant &c)
+		{
+			if (!same(a, b))
+				return false;
+			c = Constant(a.x | b.x, a.type);
+			return true;
+		}
+		bool identity(ValueInfo &x, Constant &c, bool left){return c.x == 0 && same(x.type, c);}
+		bool commutative(){return true;}
 		void gen(Environment *env, ValueInfo &to, ValueInfo &li, ValueInfo &ri)
 		{
 			if (li.type->isP(IL::ValueType::Int))
@@ -903,9 +1240,29 @@ namespace AST
 			env->err("this type do not '|' operation");
 		}
 	};
-	struct LT : BinaryExpression
+	struct LT : Compare
 	{
-		LT(Exp left, Exp right) : BinaryExpression(left, right){}
+		LT(Exp left, Exp right) : Compare(left, right){}
+		int cmpop(VType l, VType r)
+		{
+			if (l->isP(IL::ValueType::Int) && r->isP(IL::ValueType::Int))
+				return IL::BC::ilt;
+			if (l->isP(IL::ValueType::UInt) && r->isP(IL::ValueType::UInt))
+				return IL::BC::ult;
+			if (l->isP(IL::ValueType::Char) && r->isP(IL::ValueType::Char))
+				return IL::BC::clt;
+			if (l->isP(IL::ValueType::Pointer) && r->isP(IL::ValueType::Pointer))
+				return IL::BC::ult;
+			return -1;
+		}
+		bool calc(Constant &a, Constant &b, Constant &c)
+		{
+			int x, y;
+			if (!order(a, b, x, y))
+				return false;
+			c = Constant(x < y, IL::ValueType::Bool);
+			return true;
+		}
 		void gen(Environment *env, ValueInfo &to, ValueInfo &li, ValueInfo &ri)
 		{
 			to.type = new IL::Primitive(IL::ValueType::Bool);
@@ -951,9 +1308,29 @@ namespace AST
 			env->err("this type do not '<' operation");
 		}
 	};
-	struct LE : BinaryExpression
+	struct LE : Compare
 	{
-		LE(Exp left, Exp right) : BinaryExpression(left, right){}
+		LE(Exp left, Exp right) : Compare(left, right){}
+		int cmpop(VType l, VType r)
+		{
+			if (l->isP(IL::ValueType::Int) && r->isP(IL::ValueType::Int))
+				return IL::BC::ile;
+			if (l->isP(IL::ValueType::UInt) && r->isP(IL::ValueType::UInt))
+				return IL::BC::ule;
+			if (l->isP(IL::ValueType::Char) && r->isP(IL::ValueType::Char))
+				return IL::BC::cle;
+			if (l->isP(IL::ValueType::Pointer) && r->isP(IL::ValueType::Pointer))
+				return IL::BC::ule;
+			return -1;
+		}
+		bool calc(Constant &a, Constant &b, Constant &c)
+		{
+			int x, y;
+			if (!order(a, b, x, y))
+				return false;
+			c = Constant(x <= y, IL::ValueType::Bool);
+			return true;
+		}
 		void gen(Environment *env, ValueInfo &to, ValueInfo &li, ValueInfo &ri)
 		{
 			to.type = new IL::Primitive(IL::ValueType::Bool);
@@ -999,9 +1376,29 @@ namespace AST
 			env->err("this type do not '<=' operation");
 		}
 	};
-	struct GT : BinaryExpression
+	struct GT : Compare
 	{
-		GT(Exp left, Exp right) : BinaryExpression(left, right){}
+		GT(Exp left, Exp right) : Compare(left, right){}
+		int cmpop(VType l, VType r)
+		{
+			if (l->isP(IL::ValueType::Int) && r->isP(IL::ValueType::Int))
+				return IL::BC::igt;
+			if (l->isP(IL::ValueType::UInt) && r->isP(IL::ValueType::UInt))
+				return IL::BC::ugt;
+			if (l->isP(IL::ValueType::Char) && r->isP(IL::ValueType::Char))
+				return IL::BC::cgt;
+			if (l->isP(IL::ValueType::Pointer) && r->isP(IL::ValueType::Pointer))
+				return IL::BC::ugt;
+			return -1;
+		}
+		bool calc(Constant &a, Constant &b, Constant &c)
+		{
+			int x, y;
+			if (!order(a, b, x, y))
+				return false;
+			c = Constant(x > y, IL::ValueType::Bool);
+			return true;
+		}
 		void gen(Environment *env, ValueInfo &to, ValueInfo &li, ValueInfo &ri)
 		{
 			to.type = new IL::Primitive(IL::ValueType::Bool);
@@ -1047,9 +1444,29 @@ namespace AST
 			env->err("this type do not '>' operation");
 		}
 	};
-	struct GE : BinaryExpression
+	struct GE : Compare
 	{
-		GE(Exp left, Exp right) : BinaryExpression(left, right){}
+		GE(Exp left, Exp right) : Compare(left, right){}
+		int cmpop(VType l, VType r)
+		{
+			if (l->isP(IL::ValueType::Int) && r->isP(IL::ValueType::Int))
+				return IL::BC::ige;
+			if (l->isP(IL::ValueType::UInt) && r->isP(IL::ValueType::UInt))
+				return IL::BC::uge;
+			if (l->isP(IL::ValueType::Char) && r->isP(IL::ValueType::Char))
+				return IL::BC::cge;
+			if (l->isP(IL::ValueType::Pointer) && r->isP(IL::ValueType::Pointer))
+				return IL::BC::uge;
+			return -1;
+		}
+		bool calc(Constant &a, Constant &b, Constant &c)
+		{
+			int x, y;
+			if (!order(a, b, x, y))
+				return false;
+			c = Constant(x >= y, IL::ValueType::Bool);
+			return true;
+		}
 		void gen(Environment *env, ValueInfo &to, ValueInfo &li, ValueInfo &ri)
 		{
 			to.type = new IL::Primitive(IL::ValueType::Bool);
@@ -1095,9 +1512,26 @@ namespace AST
 			env->err("this type do not '>=' operation");
 		}
 	};
-	struct EQ : BinaryExpression
+	struct EQ : Compare
 	{
-		EQ(Exp left, Exp right) : BinaryExpression(left, right){}
+		EQ(Exp left, Exp right) : Compare(left, right){}
+		int cmpop(VType l, VType r)
+		{
+			if (l->isP(IL::ValueType::Char) && r->isP(IL::ValueType::Char))
+				return IL::BC::ceq;
+			if ((l->isP(IL::ValueType::Int) && r->isP(IL::ValueType::Int)) || (l->isP(IL::ValueType::UInt) && r->isP(IL::ValueType::UInt))
+				|| (l->isP(IL::ValueType::Float) && r->isP(IL::ValueType::Float)) || (l->isP(IL::ValueType::Pointer) && r->isP(IL::ValueType::Pointer)))
+				return IL::BC::ieq;
+			return -1;
+		}
+		bool calc(Constant &a, Constant &b, Constant &c)
+		{
+			int x, y;
+			if (!order(a, b, x, y))
+				return false;
+			c = Constant(x == y, IL::ValueType::Bool);
+			return true;
+		}
 		void gen(Environment *env, ValueInfo &to, ValueInfo &li, ValueInfo &ri)
 		{
 			to.type = new IL::Primitive(IL::ValueType::Bool);
@@ -1144,9 +1578,26 @@ namespace AST
 			env->err("this type do not '==' operation");
 		}
 	};
-	struct NE : BinaryExpression
+	struct NE : Compare
 	{
-		NE(Exp left, Exp right) : BinaryExpression(left, right){}
+		NE(Exp left, Exp right) : Compare(left, right){}
+		int cmpop(VType l, VType r)
+		{
+			if (l->isP(IL::ValueType::Char) && r->isP(IL::ValueType::Char))
+				return IL::BC::cne;
+			if ((l->isP(IL::ValueType::Int) && r->isP(IL::ValueType::Int)) || (l->isP(IL::ValueType::UInt) && r->isP(IL::ValueType::UInt))
+				|| (l->isP(IL::ValueType::Float) && r->isP(IL::ValueType::Float)) || (l->isP(IL::ValueType::Pointer) && r->isP(IL::ValueType::Pointer)))
+				return IL::BC::ine;
+			return -1;
+		}
+		bool calc(Constant &a, Constant &b, Constant &c)
+		{
+			int x, y;
+			if (!order(a, b, x, y))
+				return false;
+			c = Constant(x != y, IL::ValueType::Bool);
+			return true;
+		}
 		void gen(Environment *env, ValueInfo &to, ValueInfo &li, ValueInfo &ri)
 		{
 			to.type = new IL::Primitive(IL::ValueType::Bool);
@@ -1196,40 +1647,98 @@ namespace AST
 	struct BOOL_AND : BinaryExpression
 	{
 		BOOL_AND(Exp left, Exp right) : BinaryExpression(left, right){}
+		bool calc(Constant &a, Constant &b, Constant &c)
+		{
+			if (!a.is(IL::ValueType::Bool) || !b.is(IL::ValueType::Bool))
+				return false;
+			c = Constant(a.x && b.x, IL::ValueType::Bool);
+			return true;
+		}
 		ValueInfo genR(Environment *env)
 		{
-			ValueInfo li = l->genR(env);
+			Constant c;
+			if (constant(env, c))
+				return c.gen(env);
+			// 左が定数なら右を見るかどうかはもう決まってる
+			if (l->constant(env, c) && c.is(IL::ValueType::Bool))
+				return c.x == 1 ? r->genR(env) : c.gen(env);
 			int l1 = env->getLabel();
 			int l2 = env->getLabel();
 			ValueInfo to(env->getTemp(), new IL::Primitive(IL::ValueType::Bool));
-			env->pushcode(new IL::jump_true(li.address, l1));
-			env->pushcode(new IL::assign(to.address, li.address));
-			env->pushcode(new IL::jump(l2));
-			env->addLabel(l1);
+			l->genJump(env, false, l1);
 			ValueInfo ri = r->genR(env);
 			env->pushcode(new IL::assign(to.address, ri.address));
+			env->pushcode(new IL::jump(l2));
+			env->addLabel(l1);
+			env->pushcode(new IL::getInt(to.address, 0));
 			env->addLabel(l2);
 			return to;
 		}
+		VType genBranch(Environment *env, bool when, int label)
+		{
+			if (!when)
+			{
+				// 左で決まったら右は見ない
+				l->genJump(env, when, label);
+				r->genJump(env, when, label);
+			}
+			else
+			{
+				int skip = env->getLabel();
+				l->genJump(env, !when, skip);
+				r->genJump(env, when, label);
+				env->addLabel(skip);
+			}
+			return new IL::Primitive(IL::ValueType::Bool);
+		}
 	};
 	struct BOOL_OR : BinaryExpression
 	{
 		BOOL_OR(Exp left, Exp right) : BinaryExpression(left, right){}
+		bool calc(Constant &a, Constant &b, Constant &c)
+		{
+			if (!a.is(IL::ValueType::Bool) || !b.is(IL::ValueType::Bool))
+				return false;
+			c = Constant(a.x || b.x, IL::ValueType::Bool);
+			return true;
+		}
 		ValueInfo genR(Environment *env)
 		{
-			ValueInfo li = l->genR(env);
+			Constant c;
+			if (constant(env, c))
+				return c.gen(env);
+			// 左が定数なら右を見るかどうかはもう決まってる
+			if (l->constant(env, c) && c.is(IL::ValueType::Bool))
+				return c.x == 0 ? r->genR(env) : c.gen(env);
 			int l1 = env->getLabel();
 			int l2 = env->getLabel();
 			ValueInfo to(env->getTemp(), new IL::Primitive(IL::ValueType::Bool));
-			env->pushcode(new IL::jump_false(li.address, l1));
-			env->pushcode(new IL::assign(to.address, li.address));
-			env->pushcode(new IL::jump(l2));
-			env->addLabel(l1);
+			l->genJump(env, true, l1);
 			ValueInfo ri = r->genR(env);
 			env->pushcode(new IL::assign(to.address, ri.address));
+			env->pushcode(new IL::jump(l2));
+			env->addLabel(l1);
+			env->pushcode(new IL::getInt(to.address, 1));
 			env->addLabel(l2);
 			return to;
 		}
+		VType genBranch(Environment *env, bool when, int label)
+		{
+			if (when)
+			{
+				// 左で決まったら右は見ない
+				l->genJump(env, when, label);
+				r->genJump(env, when, label);
+			}
+			else
+			{
+				int skip = env->getLabel();
+				l->genJump(env, !when, skip);
+				r->genJump(env, when, label);
+				env->addLabel(skip);
+			}
+			return new IL::Primitive(IL::ValueType::Bool);
+		}
 	};
 	struct Assign : BinaryExpression
 	{
@@ -1458,16 +1967,25 @@ namespace AST
 			l = left;
 			r = right;
 		}
+		bool constant(Environment *env, Constant &x)
+		{
+			Constant ct, lt, rt;
+			if (!c->constant(env, ct) || !ct.is(IL::ValueType::Bool) || !l->constant(env, lt) || !r->constant(env, rt) || lt.type != rt.type)
+				return false;
+			x = ct.x ? lt : rt;
+			return true;
+		}
 		ValueInfo genL(Environment *env)
 		{
-			ValueInfo ci = c->genR(env);
-			if (!ci.type->isP(IL::ValueType::Bool))
+			Constant x;
+			if (constant(env, x))
+				return x.gen(env);
+			int l1 = env->getLabel();
+			int l2 = env->getLabel();
+			if (!c->genJump(env, false, l1)->isP(IL::ValueType::Bool))
 			{
 				env->err("(cond)?: only bool");
 			}
-			int l1 = env->getLabel();
-			int l2 = env->getLabel();
-			env->pushcode(new IL::jump_false(ci.address, l1));
 			ValueInfo li = l->genR(env);
 			ValueInfo to(env->getTemp(), li.type);
 			env->pushcode(new IL::assign(to.address, li.address));
@@ -1490,7 +2008,9 @@ namespace AST
 		void Add(Exp a)	{args.push_back(a);}
 		ValueInfo genR(Environment *env)
 		{
-			ValueInfo f = func->genR(env);
+			// 名前で呼んでるなら呼ぶ値は作らない
+			IL::Function *direct = func->function(env);
+			ValueInfo f = direct ? ValueInfo(0, direct->getFuncPtr()) : func->genR(env);
 			ValueInfo to(env->getTemp(), f.type->get());
 
 			if (!f.type->isP(IL::ValueType::Function))
@@ -1505,19 +2025,22 @@ namespace AST
 				env->err("argnum");
 				return to;
 			}
-			int i = 0;
+			int i = (int)args.size();	// 後ろから積むので型も後ろから見る
 			for (vector<Exp>::reverse_iterator it = args.rbegin(); it != args.rend(); ++it)
 			{
 				ValueInfo a = (*it)->genR(env);
 				env->pushcode(new IL::push(a.address));
-				if (!a.type->isT(f.type->getA(i++)))
+				if (!a.type->isT(f.type->getA(--i)))
 				{
 					env->err("mismatch argument type");
 					return to;
 				}
 				argsize += 4;
 			}
-			env->pushcode(new IL::call(to.address, f.address));
+			if (direct)
+				env->pushcode(new IL::call_direct(direct));
+			else
+				env->pushcode(new IL::call(to.address, f.address));
 			env->pushcode(new IL::pop_arg(argsize));
 			env->pushcode(new IL::get_return(to.address));
 			return to;
@@ -1532,7 +2055,6 @@ namespace AST
 		ValueInfo genL(Environment *env)
 		{
 			ValueInfo e = exp->genR(env);
-			ValueInfo i = index->genR(env);
 
 			if (!e.type->isP(IL::ValueType::Pointer))
 			{
@@ -1543,9 +2065,24 @@ namespace AST
 
 			int size = e.type->get()->getSize();
 			ValueInfo to(env->getTemp(), e.type->get());
-			env->pushcode(new IL::getInt(to.address, size));
-			env->pushcode(new IL::imul(to.address, i.address, to.address));
-			env->pushcode(new IL::iadd(to.address, to.address, e.address));
+			Constant c;
+			if (index->constant(env, c) && c.isInt())
+			{
+				// 添字が定数ならずらす量も定数
+				if (c.x == 0)
+					to.address = e.address;
+				else
+				{
+					env->pushcode(new IL::getInt(to.address, c.x * size));
+					env->pushcode(new IL::iadd(to.address, to.address, e.address));
+				}
+			}
+			else
+			{
+				ValueInfo i = index->genR(env);
+				int s = genScale(env, to.address, i.address, size);
+				env->pushcode(new IL::iadd(to.address, s, e.address));
+			}
 			to.atype = ValueInfo::memory;
 			return to;
 		}
@@ -1556,6 +2093,14 @@ namespace AST
 	struct Member : Expression
 	{
 		Member(Exp e, const string &s) : exp(e), name(s){}
+		bool constant(Environment *env, Constant &c)
+		{
+			VType t = exp->typeName(env);
+			if (!t)
+				return false;
+			c = Constant(t->getMember(name).address, IL::ValueType::Int);
+			return true;
+		}
 		ValueInfo genL(Environment *env)
 		{
 			ValueInfo v = exp->genL(env);
@@ -1577,10 +2122,13 @@ namespace AST
 			v.type = m.type;
 			if (v.atype == ValueInfo::memory)
 			{
-				int t = env->getTemp();
-				env->pushcode(new IL::getInt(t, m.address));
-				env->pushcode(new IL::iadd(t, v.address, t));
-				v.address = t;
+				if (m.address)
+				{
+					int t = env->getTemp();
+					env->pushcode(new IL::getInt(t, m.address));
+					env->pushcode(new IL::iadd(t, v.address, t));
+					v.address = t;
+				}
 			}
 			else
 			{
@@ -1789,13 +2337,11 @@ namespace AST
 		If(Exp c, State i, State e) : cond(c), if_s(i), else_s(e){}
 		void gen_state(Environment *env)
 		{
-			ValueInfo ci = cond->genR(env);
-			if (!ci.type->isP(IL::ValueType::Bool))
+			int l1 = env->getLabel();
+			if (!cond->genJump(env, false, l1)->isP(IL::ValueType::Bool))
 			{
 				env->err("if (cond) only bool");
 			}
-			int l1 = env->getLabel();
-			env->pushcode(new IL::jump_false(ci.address, l1));
 			env->newState();
 			if_s->gen(env);
 			if (else_s)
@@ -1824,14 +2370,12 @@ namespace AST
 			int l_break = env->getLabel();
 			int l_continue = env->getLabel();
 			env->addLabel(l_continue);
-			ValueInfo ci = cond->genR(env);
-			if (!ci.type->isP(IL::ValueType::Bool))
+			int l_else = else_s ? env->getLabel() : l_break;
+			if (!cond->genJump(env, false, l_else)->isP(IL::ValueType::Bool))
 			{
 				env->err("while (cond) only bool");
 			}
 			env->EnterLoop(l_break, l_continue);
-			int l_else = else_s ? env->getLabel() : l_break;
-			env->pushcode(new IL::jump_false(ci.address, l_else));
 			env->newState();
 			state->gen(env);
 			env->pushcode(new IL::jump(l_continue));
@@ -0,0 +1,216 @@
+#ifndef NES_CODEMEM_H
+#define NES_CODEMEM_H
+
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#include <pthread.h>
+#endif
+
+#include "x64.h"
+
+namespace NES{
+
+// スレッド間の排他、C++98なのでOSのを使う
+class Mutex
+{
+public:
+#ifdef _WIN32
+	Mutex()			{InitializeCriticalSection(&m);}
+	~Mutex()		{DeleteCriticalSection(&m);}
+	void lock()		{EnterCriticalSection(&m);}
+	void unlock()	{LeaveCriticalSection(&m);}
+private:
+	CRITICAL_SECTION m;
+#else
+	Mutex()			{pthread_mutex_init(&m, NULL);}
+	~Mutex()		{pthread_mutex_destroy(&m);}
+	void lock()		{pthread_mutex_lock(&m);}
+	void unlock()	{pthread_mutex_unlock(&m);}
+private:
+	pthread_mutex_t m;
+#endif
+	Mutex(const Mutex &);
+	void operator=(const Mutex &);
+};
+// スコープを抜けたら外す
+class Lock
+{
+public:
+	Lock(Mutex &m) : m(m){m.lock();}
+	~Lock(){m.unlock();}
+private:
+	Mutex &m;
+	Lock(const Lock &);
+	void operator=(const Lock &);
+};
+
+// 生成したコードを置くメモリ
+// 同じメモリを書く用(RW)と実行する用(RX)の2か所に映して、書くのはRWの方から
+// 書けて実行も出来るページは作らないし、書いてる間も同じページにある他のスクリプトは実行出来たまま
+// 小さいスクリプトがページを1枚ずつ使わない様に、まとめて取った塊から切り出す
+// 塊の出し入れはロックするので、別のスレッドで同時にコンパイルしてもいい
+class CodeMemory
+{
+public:
+	typedef unsigned char byte;
+	enum{ChunkSize = 0x10000, Align = 16};
+
+	// 終了時に解放しない(静的なNativeが後から返しに来るかもしれないので)
+	static CodeMemory &get()
+	{
+		static CodeMemory *m = new CodeMemory;
+		return *m;
+	}
+
+	// sizeバイト取る、返すのは実行する方の番地、中身はwrite()で書く
+	byte *alloc(int size)
+	{
+		Lock l(mutex);
+		size = (size + Align - 1) / Align * Align;
+		if (size <= 0)
+			size = Align;
+		if (chunks.empty() || chunks.back().used + size > chunks.back().size)
+		{
+			Chunk c;
+			c.size = (std::max)((int)ChunkSize, (size + page - 1) / page * page);
+			if (!map(c))
+				return NULL;
+			c.used = 0;
+			c.live = 0;
+			chunks.push_back(c);
+		}
+		Chunk &c = chunks.back();
+		byte *p = c.base + c.used;
+		c.used += size;
+		c.live++;
+		return p;
+	}
+	// 使わなくなった塊から返す、今切り出してる塊は最初から使い直す
+	void free(byte *p)
+	{
+		Lock l(mutex);
+		for (std::vector<Chunk>::iterator it = chunks.begin(); it != chunks.end(); ++it)
+		{
+			if (p < it->base || p >= it->base + it->size)
+				continue;
+			if (--it->live)
+				return;
+			if (it + 1 == chunks.end())
+			{
+				it->used = 0;
+				return;
+			}
+			unmap(*it);
+			chunks.erase(it);
+			return;
+		}
+	}
+	// 書く用の方から書く、実行する方の保護は変えない
+	bool write(byte *p, const void *src, int size)
+	{
+		if (size <= 0)
+			return true;
+		byte *rw = NULL;
+		{
+			Lock l(mutex);
+			for (std::vector<Chunk>::iterator it = chunks.begin(); it != chunks.end(); ++it)
+				if (p >= it->base && p + size <= it->base + it->size)
+					rw = it->rw + (p - it->base);
+		}
+		if (!rw)
+			return false;
+		std::memcpy(rw, src, size);
+	#ifdef _WIN32
+		FlushInstructionCache(GetCurrentProcess(), p, size);
+	#endif
+		return true;
+	}
+
+private:
+	struct Chunk
+	{
+		byte *base;	// 実行する方(RX)
+		byte *rw;	// 書く方(RW)
+		int size;
+		int used;
+		int live;
+	#ifdef _WIN32
+		HANDLE section;
+	#endif
+	};
+	std::vector<Chunk> chunks;
+	int page;
+	Mutex mutex;
+
+	CodeMemory()
+	{
+	#ifdef _WIN32
+		SYSTEM_INFO si;
+		GetSystemInfo(&si);
+		page = si.dwAllocationGranularity;	// 映す位置はこれの倍数
+	#else
+		page = sysconf(_SC_PAGESIZE);
+	#endif
+	}
+
+	static bool map(Chunk &c)
+	{
+	#ifdef _WIN32
+		c.section = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_EXECUTE_READWRITE, 0, c.size, NULL);
+		if (!c.section)
+			return false;
+		c.rw = (byte*)MapViewOfFile(c.section, FILE_MAP_WRITE, 0, 0, c.size);
+		c.base = (byte*)MapViewOfFile(c.section, FILE_MAP_READ | FILE_MAP_EXECUTE, 0, 0, c.size);
+		if (c.rw && c.base)
+			return true;
+		unmap(c);
+		return false;
+	#else
+		int fd = memfd_create("nes-code", MFD_CLOEXEC);
+		if (fd < 0)
+			return false;
+		if (ftruncate(fd, c.size) != 0)
+		{
+			close(fd);
+			return false;
+		}
+		int flags = MAP_SHARED;
+	#ifdef NES_X64
+		flags |= MAP_32BIT;	// 番地を32bitで持つので実行する方は下位2GBに置く
+	#endif
+		void *x = mmap(NULL, c.size, PROT_READ | PROT_EXEC, flags, fd, 0);
+		void *w = mmap(NULL, c.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);	// 映してあれば閉じてもいい
+		c.base = x == MAP_FAILED ? NULL : (byte*)x;
+		c.rw = w == MAP_FAILED ? NULL : (byte*)w;
+		if (c.base && c.rw)
+			return true;
+		unmap(c);
+		return false;
+	#endif
+	}
+	static void unmap(Chunk &c)
+	{
+	#ifdef _WIN32
+		if (c.rw)
+			UnmapViewOfFile(c.rw);
+		if (c.base)
+			UnmapViewOfFile(c.base);
+		CloseHandle(c.section);
+	#else
+		if (c.rw)
+			munmap(c.rw, c.size);
+		if (c.base)
+			munmap(c.base, c.size);
+	#endif
+	}
+};
+
+}
+#endif
@@ -3,11 +3,18 @@
 
 #include <string>
 #include <map>
+#include <set>
 #include <vector>
 #include <cstdio>
 #include <cstring>
+#include <algorithm>
 
-#include "x86.h"
+#include "x64.h"
+#include "codemem.h"
+#include "assembler.h"
+#ifdef NES_X64
+#include <new>
+#endif
 
 namespace NES{
 
@@ -110,7 +117,42 @@ namespace IL
 	using std::vector;
 	class ValueType;
 	typedef shptr<ValueType> VType;
-	typedef unsigned long dword;
+	typedef unsigned int dword;	// 値は64bitでも32bit
+#ifdef NES_X64
+	// 中間言語実行でも値は32bitなので、スクリプトから番地が見えるところは下位2GBに置く
+	template<class T> struct LowAllocator : std::allocator<T>
+	{
+		template<class U> struct rebind{typedef LowAllocator<U> other;};
+		LowAllocator(){}
+		LowAllocator(const LowAllocator &){}
+		template<class U> LowAllocator(const LowAllocator<U> &){}
+		T *allocate(size_t n, const void * = 0)
+		{
+			void *p = mmap(NULL, n * sizeof(T), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+			if (p == MAP_FAILED)
+				throw std::bad_alloc();
+			return (T*)p;
+		}
+		void deallocate(T *p, size_t n){munmap(p, n * sizeof(T));}
+	};
+	typedef vector<unsigned char, LowAllocator<unsigned char> > Bytes;
+#else
+	typedef vector<unsigned char> Bytes;
+#endif
+	// グローバル変数の写し、初期化が終わった所で取っておいて、戻す時はmemcpyするだけ
+	typedef vector<unsigned char> Snapshot;
+	inline Snapshot takeSnapshot(const Bytes &b, int size)
+	{
+		return Snapshot(b.begin(), b.begin() + size);
+	}
+	inline bool restoreSnapshot(Bytes &b, const Snapshot &s)
+	{
+		if (s.size() > b.size())
+			return false;
+		if (!s.empty())
+			std::memcpy(&b[0], &s[0], s.size());
+		return true;
+	}
 	struct VarInfo
 	{
 		string name;
@@ -184,7 +226,7 @@ namespace IL
 	struct Pointer : ValueType
 	{
 		Pointer(VType t):type(t){}
-		int getSize(){return sizeof(void*);}
+		int getSize(){return 4;}	// スクリプトのポインタは64bitでも32bit
 		bool isP(primitive p){return p == ValueType::Pointer;}
 		bool isT(ValueType *t)
 		{
@@ -201,7 +243,7 @@ namespace IL
 	struct FuncPtr : ValueType
 	{
 		FuncPtr(VType r) : ret(r){}
-		int getSize(){return sizeof(void*);}
+		int getSize(){return 4;}
 		void add(VType t){args.push_back(t);}
 		bool isP(primitive p){return p == ValueType::Function;}
 		bool isT(ValueType *t)
@@ -310,17 +352,20 @@ namespace IL
 		{
 			atype = no;
 			address = 0;
+			object = NULL;
 		}
 		ValueInfo(int a)
 		{
 			atype = temp;
 			address = a;
+			object = NULL;
 		}
 		ValueInfo(int a, VType t)
 		{
 			atype = temp;
 			address = a;
 			type = t;
+			object = NULL;
 		}
 		enum address_type
 		{
@@ -335,29 +380,255 @@ namespace IL
 		} atype;
 		int address;
 		VType type;
+		void *object;	// 関数の時はその実体、64bitだとaddressには入らないので
 		bool isStack()	{return atype == local || atype == temp;}
 		bool isGlobal()	{return atype == global;}
 		bool isMemory()	{return atype == memory;}
 	};
 
+	// 命令が読み書きするスタック上の場所
+	struct Operand
+	{
+		enum
+		{
+			Read = 1,
+			Write = 2,
+			Memory = 4,		// 番地を取ったりバイト単位で触ったりするのでレジスタには置けない
+			Byte = 8,		// 1byteしか触らない(charとbool)
+		};
+		Operand(int *s, int f) : slot(s), flags(f){}
+		int *slot;
+		int flags;
+	};
+	typedef vector<Operand> Operands;
+
 	class Environment;
+	class ExecutionContext;
 	struct opcode
 	{
+		opcode() : index(0){}
 		virtual ~opcode(){}
-		virtual int getSize() = 0;
-		virtual int run(Environment *env) = 0;
+		virtual int run(ExecutionContext *cx) = 0;
 		virtual void gen(Environment *env) = 0;
+		virtual void resolve(Environment *env){}	// 関数を吐き終わった後に一回だけ呼ばれる
+		virtual void lower(Environment *env) = 0;	// バイトコードに変換
+		virtual void operands(Operands &o){}
+		virtual int clobber(){return 0;}			// 壊すレジスタ(eax, ecxは常に壊す)
+		virtual int branch(){return -1;}			// ジャンプ先の中間言語の位置
+		virtual bool copy(){return false;}			// スタック間で4byteコピーするだけ(assign)
+		virtual opcode *clone() = 0;				// 関数を展開する時に複製する
+		virtual int *jumpLabel(){return NULL;}		// ジャンプ先のラベル、展開する時に付け替える
+		int index;	// 関数内での中間言語の位置
+		bool backward(int target){return target <= index;}	// ループの後ろから頭に飛ぶ、燃料を減らす所
+	};
+
+	// バイトコード
+	// 命令番号の後にオペランドがintで並ぶ、ジャンプ先は関数内での位置
+	// スタック上の変数は引数の基点からのバイト位置にしておく
+	struct BC
+	{
+		enum Op
+		{
+			getFunction, getGlobal, getMemory, getGlobalPtr, getLocalPtr, getInt, getChar, getFloat,
+			incL, incG, incM, cincL, cincG, cincM, pincL, pincG, pincM,
+			decL, decG, decM, cdecL, cdecG, cdecM, pdecL, pdecG, pdecM,
+			minus, fminus, Not, Compl,
+			iadd, fadd, isub, fsub, imul, fmul, idiv, fdiv, imod,
+			ishl, ishr, ushr, iand, ior, ixor,
+			ilt, ult, clt, ile, ule, cle, igt, ugt, cgt, ige, uge, cge, ieq, ceq, ine, cne,
+			assign, cassign, set_global, cset_global, set_memory, cset_memory,
+			set_return, Return, push, call, call_direct, pop_arg, get_return,
+			jump_true, jump_false, jump, end,
+			loop, fuel,	// 後ろに飛ぶ所で燃料を減らす、loopは減らしてjump
+			// 比較して分岐、並びはiltからcneと同じ
+			jilt, jult, jclt, jile, jule, jcle, jigt, jugt, jcgt, jige, juge, jcge, jieq, jceq, jine, jcne,
+		};
+	};
+
+	// Cの型とスクリプトの型の対応と、値の受け渡し(値は全部4byteのintで持つ)
+	// ポインタは指してる先の型までは見ない
+	template<class T> struct CType
+	{
+		static bool is(VType t){return false;}
+	};
+	template<class T> struct CValue
+	{
+		static int from(T v){return (int)v;}
+		static T to(int v){return (T)v;}
+	};
+	template<> struct CType<void>			{static bool is(VType t){return !t || t->isP(ValueType::Void);}};
+	template<> struct CType<int>			{static bool is(VType t){return t->isP(ValueType::Int) || t->isP(ValueType::Enum);}};
+	template<> struct CType<unsigned int>	{static bool is(VType t){return t->isP(ValueType::UInt);}};
+	template<> struct CType<char>			{static bool is(VType t){return t->isP(ValueType::Char);}};
+	template<> struct CType<bool>			{static bool is(VType t){return t->isP(ValueType::Bool);}};
+	template<> struct CType<float>			{static bool is(VType t){return t->isP(ValueType::Float);}};
+	template<class T> struct CType<T*>		{static bool is(VType t){return t->isP(ValueType::Pointer) || t->isP(ValueType::Array);}};
+	template<> struct CValue<void>
+	{
+		static void to(int v){}
+	};
+	template<> struct CValue<float>
+	{
+		static int from(float v){int i;std::memcpy(&i, &v, 4);return i;}
+		static float to(int v){float f;std::memcpy(&f, &v, 4);return f;}
+	};
+	template<class T> struct CValue<T*>
+	{
+		static int from(T *v){return (int)(size_t)v;}
+		static T *to(int v){return (T*)(size_t)v;}
+	};
+	// Cの関数を関数の型に合わせて呼ぶ、ある分の引数しか読まない
+	// aは最初の引数、スクリプトのスタックは後ろの引数ほど下にあるのでa[-1]が2番目
+	// 値は全部4byteのintで持ってるので、floatはビットのまま渡す
+	// 32bitは引数が全部スタックに乗るので、型で違うのはfloatの戻り値(st0で返る)だけ
+	// x64はfloatの引数をxmmで渡して戻り値もxmm0なので、floatの引数があれば並べ直して呼ぶ
+	struct Invoke
+	{
+		typedef int (*Thunk)(const void *f, const int *a);
+		enum{MaxArgs = 16};
+		Invoke() : args(-1), floats(0), ret(false), thunk(NULL){}
+		Invoke(int n, int f = 0, bool r = false) : args(n), floats(f), ret(r), thunk(get(n, r)){}
+		// 関数の型から、引数が多すぎたら呼べない
+		static Invoke of(VType t)
+		{
+			int f = 0;
+			for (int i = 0; i < t->getASize() && i < MaxArgs; i++)
+				if (t->getA(i)->isP(ValueType::Float))
+					f |= 1 << i;
+			return Invoke(t->getASize(), f, t->get() && t->get()->isP(ValueType::Float));
+		}
+		bool operator!() const{return !thunk;}
+		int operator()(const void *f, const int *a) const
+		{
+		#ifdef NES_X64
+			if (floats)
+				return ret ? mixed<float>(f, a, args, floats) : mixed<int>(f, a, args, floats);
+		#endif
+			return thunk(f, a);
+		}
+		int args;
+		int floats;	// floatの引数、1番目が最下位ビット
+		bool ret;	// floatを返す
+	private:
+		Thunk thunk;
+		template<class R> static int call0(const void *f, const int *a){return CValue<R>::from(((R (*)())f)());}
+		template<class R> static int call1(const void *f, const int *a){return CValue<R>::from(((R (*)(int))f)(a[0]));}
+		template<class R> static int call2(const void *f, const int *a){return CValue<R>::from(((R (*)(int,int))f)(a[0], a[-1]));}
+		template<class R> static int call3(const void *f, const int *a){return CValue<R>::from(((R (*)(int,int,int))f)(a[0], a[-1], a[-2]));}
+		template<class R> static int call4(const void *f, const int *a){return CValue<R>::from(((R (*)(int,int,int,int))f)(a[0], a[-1], a[-2], a[-3]));}
+		template<class R> static int call5(const void *f, const int *a){return CValue<R>::from(((R (*)(int,int,int,int,int))f)(a[0], a[-1], a[-2], a[-3], a[-4]));}
+		template<class R> static int call6(const void *f, const int *a){return CValue<R>::from(((R (*)(int,int,int,int,int,int))f)(a[0], a[-1], a[-2], a[-3], a[-4], a[-5]));}
+		template<class R> static int call7(const void *f, const int *a){return CValue<R>::from(((R (*)(int,int,int,int,int,int,int))f)(a[0], a[-1], a[-2], a[-3], a[-4], a[-5], a[-6]));}
+		template<class R> static int call8(const void *f, const int *a){return CValue<R>::from(((R (*)(int,int,int,int,int,int,int,int))f)(a[0], a[-1], a[-2], a[-3], a[-4], a[-5], a[-6], a[-7]));}
+		template<class R> static int call9(const void *f, const int *a){return CValue<R>::from(((R (*)(int,int,int,int,int,int,int,int,int))f)(a[0], a[-1], a[-2], a[-3], a[-4], a[-5], a[-6], a[-7], a[-8]));}
+		template<class R> static int call10(const void *f, const int *a){return CValue<R>::from(((R (*)(int,int,int,int,int,int,int,int,int,int))f)(a[0], a[-1], a[-2], a[-3], a[-4], a[-5], a[-6], a[-7], a[-8], a[-9]));}
+		template<class R> static int call11(const void *f, const int *a){return CValue<R>::from(((R (*)(int,int,int,int,int,int,int,int,int,int,int))f)(a[0], a[-1], a[-2], a[-3], a[-4], a[-5], a[-6], a[-7], a[-8], a[-9], a[-10]));}
+		template<class R> static int call12(const void *f, const int *a){return CValue<R>::from(((R (*)(int,int,int,int,int,int,int,int,int,int,int,int))f)(a[0], a[-1], a[-2], a[-3], a[-4], a[-5], a[-6], a[-7], a[-8], a[-9], a[-10], a[-11]));}
+		template<class R> static int call13(const void *f, const int *a){return CValue<R>::from(((R (*)(int,int,int,int,int,int,int,int,int,int,int,int,int))f)(a[0], a[-1], a[-2], a[-3], a[-4], a[-5], a[-6], a[-7], a[-8], a[-9], a[-10], a[-11], a[-12]));}
+		template<class R> static int call14(const void *f, const int *a){return CValue<R>::from(((R (*)(int,int,int,int,int,int,int,int,int,int,int,int,int,int))f)(a[0], a[-1], a[-2], a[-3], a[-4], a[-5], a[-6], a[-7], a[-8], a[-9], a[-10], a[-11], a[-12], a[-13]));}
+		template<class R> static int call15(const void *f, const int *a){return CValue<R>::from(((R (*)(int,int,int,int,int,int,int,int,int,int,int,int,int,int,int))f)(a[0], a[-1], a[-2], a[-3], a[-4], a[-5], a[-6], a[-7], a[-8], a[-9], a[-10], a[-11], a[-12], a[-13], a[-14]));}
+		template<class R> static int call16(const void *f, const int *a){return CValue<R>::from(((R (*)(int,int,int,int,int,int,int,int,int,int,int,int,int,int,int,int))f)(a[0], a[-1], a[-2], a[-3], a[-4], a[-5], a[-6], a[-7], a[-8], a[-9], a[-10], a[-11], a[-12], a[-13], a[-14], a[-15]));}
+		static Thunk get(int n, bool r)
+		{
+			static const Thunk thunk[2][MaxArgs + 1] = {
+				{call0<int>, call1<int>, call2<int>, call3<int>, call4<int>, call5<int>, call6<int>, call7<int>, call8<int>, call9<int>, call10<int>, call11<int>, call12<int>, call13<int>, call14<int>, call15<int>, call16<int>},
+				{call0<float>, call1<float>, call2<float>, call3<float>, call4<float>, call5<float>, call6<float>, call7<float>, call8<float>, call9<float>, call10<float>, call11<float>, call12<float>, call13<float>, call14<float>, call15<float>, call16<float>},
+			};
+			return n >= 0 && n <= MaxArgs ? thunk[r][n] : NULL;
+		}
+	#ifdef NES_X64
+		// 整数はレジスタ6個、floatはxmm8個に順に入れて、溢れた分は並び順にスタックに乗せる
+		// 一番多い形で呼べば、呼ばれた方は自分の分しか読まない
+		typedef long long Q;
+		template<class R> static int mixed(const void *f, const int *a, int n, int floats)
+		{
+			Q i[6] = {0}, s[MaxArgs] = {0};
+			float x[8] = {0};
+			int ni = 0, nx = 0, ns = 0;
+			for (int k = 0; k < n; k++)
+			{
+				if (floats >> k & 1 && nx < 8)
+					x[nx++] = CValue<float>::to(a[-k]);
+				else if (!(floats >> k & 1) && ni < 6)
+					i[ni++] = a[-k];
+				else
+					s[ns++] = (unsigned int)a[-k];	// 下位4byteだけ読まれる
+			}
+			typedef R (*F)(Q, Q, Q, Q, Q, Q, float, float, float, float, float, float, float, float,
+							Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q);
+			return CValue<R>::from(((F)f)(i[0], i[1], i[2], i[3], i[4], i[5], x[0], x[1], x[2], x[3], x[4], x[5], x[6], x[7],
+							s[0], s[1], s[2], s[3], s[4], s[5], s[6], s[7], s[8], s[9], s[10], s[11], s[12], s[13], s[14], s[15]));
+		}
+	#endif
+	};
+
+	// Cの関数の型(int (int, int)とか)がスクリプトの関数の型と合うか
+	template<class F> struct Signature
+	{
+		static bool is(VType t){return false;}
+	};
+	template<class R> struct Signature<R ()>{static bool is(VType t){return t->getASize() == 0 && CType<R>::is(t->get());}};
+	template<class R, class A1> struct Signature<R (A1)>{static bool is(VType t){return t->getASize() == 1 && CType<R>::is(t->get()) && CType<A1>::is(t->getA(0));}};
+	template<class R, class A1, class A2> struct Signature<R (A1, A2)>{static bool is(VType t){return t->getASize() == 2 && CType<R>::is(t->get()) && CType<A1>::is(t->getA(0)) && CType<A2>::is(t->getA(1));}};
+	template<class R, class A1, class A2, class A3> struct Signature<R (A1, A2, A3)>{static bool is(VType t){return t->getASize() == 3 && CType<R>::is(t->get()) && CType<A1>::is(t->getA(0)) && CType<A2>::is(t->getA(1)) && CType<A3>::is(t->getA(2));}};
+	template<class R, class A1, class A2, class A3, class A4> struct Signature<R (A1, A2, A3, A4)>{static bool is(VType t){return t->getASize() == 4 && CType<R>::is(t->get()) && CType<A1>::is(t->getA(0)) && CType<A2>::is(t->getA(1)) && CType<A3>::is(t->getA(2)) && CType<A4>::is(t->getA(3));}};
+	template<class R, class A1, class A2, class A3, class A4, class A5> struct Signature<R (A1, A2, A3, A4, A5)>{static bool is(VType t){return t->getASize() == 5 && CType<R>::is(t->get()) && CType<A1>::is(t->getA(0)) && CType<A2>::is(t->getA(1)) && CType<A3>::is(t->getA(2)) && CType<A4>::is(t->getA(3)) && CType<A5>::is(t->getA(4));}};
+	template<class R, class A1, class A2, class A3, class A4, class A5, class A6> struct Signature<R (A1, A2, A3, A4, A5, A6)>{static bool is(VType t){return t->getASize() == 6 && CType<R>::is(t->get()) && CType<A1>::is(t->getA(0)) && CType<A2>::is(t->getA(1)) && CType<A3>::is(t->getA(2)) && CType<A4>::is(t->getA(3)) && CType<A5>::is(t->getA(4)) && CType<A6>::is(t->getA(5));}};
+	// 引数の型を推論させない様に挟む
+	template<class T> struct Id{typedef T type;};
+
+	// 名前で引いておいた関数、FはCの関数の型で int (int, int) の様に書く
+	template<class F> struct Handle;
+	// 引いておいた関数を呼ぶ、引数は6個まで
+	// 中間言語で実行する時はTのinvoke(関数, 引数, 引数の数)
+	template<class T> struct Caller
+	{
+		template<class R> R call(const Handle<R ()> &h)
+		{
+			return h.entry ? h.entry() : CValue<R>::to(static_cast<T*>(this)->invoke(h.func, NULL, 0));
+		}
+		template<class R, class A1> R call(const Handle<R (A1)> &h, typename Id<A1>::type a1)
+		{
+			const int a[] = {CValue<A1>::from(a1)};
+			return h.entry ? h.entry(a1) : CValue<R>::to(static_cast<T*>(this)->invoke(h.func, a, 1));
+		}
+		template<class R, class A1, class A2> R call(const Handle<R (A1, A2)> &h, typename Id<A1>::type a1, typename Id<A2>::type a2)
+		{
+			const int a[] = {CValue<A1>::from(a1), CValue<A2>::from(a2)};
+			return h.entry ? h.entry(a1, a2) : CValue<R>::to(static_cast<T*>(this)->invoke(h.func, a, 2));
+		}
+		template<class R, class A1, class A2, class A3> R call(const Handle<R (A1, A2, A3)> &h, typename Id<A1>::type a1, typename Id<A2>::type a2, typename Id<A3>::type a3)
+		{
+			const int a[] = {CValue<A1>::from(a1), CValue<A2>::from(a2), CValue<A3>::from(a3)};
+			return h.entry ? h.entry(a1, a2, a3) : CValue<R>::to(static_cast<T*>(this)->invoke(h.func, a, 3));
+		}
+		template<class R, class A1, class A2, class A3, class A4> R call(const Handle<R (A1, A2, A3, A4)> &h, typename Id<A1>::type a1, typename Id<A2>::type a2, typename Id<A3>::type a3, typename Id<A4>::type a4)
+		{
+			const int a[] = {CValue<A1>::from(a1), CValue<A2>::from(a2), CValue<A3>::from(a3), CValue<A4>::from(a4)};
+			return h.entry ? h.entry(a1, a2, a3, a4) : CValue<R>::to(static_cast<T*>(this)->invoke(h.func, a, 4));
+		}
+		template<class R, class A1, class A2, class A3, class A4, class A5> R call(const Handle<R (A1, A2, A3, A4, A5)> &h, typename Id<A1>::type a1, typename Id<A2>::type a2, typename Id<A3>::type a3, typename Id<A4>::type a4, typename Id<A5>::type a5)
+		{
+			const int a[] = {CValue<A1>::from(a1), CValue<A2>::from(a2), CValue<A3>::from(a3), CValue<A4>::from(a4), CValue<A5>::from(a5)};
+			return h.entry ? h.entry(a1, a2, a3, a4, a5) : CValue<R>::to(static_cast<T*>(this)->invoke(h.func, a, 5));
+		}
+		template<class R, class A1, class A2, class A3, class A4, class A5, class A6> R call(const Handle<R (A1, A2, A3, A4, A5, A6)> &h, typename Id<A1>::type a1, typename Id<A2>::type a2, typename Id<A3>::type a3, typename Id<A4>::type a4, typename Id<A5>::type a5, typename Id<A6>::type a6)
+		{
+			const int a[] = {CValue<A1>::from(a1), CValue<A2>::from(a2), CValue<A3>::from(a3), CValue<A4>::from(a4), CValue<A5>::from(a5), CValue<A6>::from(a6)};
+			return h.entry ? h.entry(a1, a2, a3, a4, a5, a6) : CValue<R>::to(static_cast<T*>(this)->invoke(h.func, a, 6));
+		}
 	};
 
-	class Environment
+	class Environment : public Caller<Environment>
 	{
+		friend class ExecutionContext;
 	public:
 		typedef std::map<string, VarInfo> var_table;
 		typedef vector<shptr<opcode> > Code;
 		class Function
 		{
 		public:
-			Function(const string &s, VType r) : name(s), ret(r)
+			Function(const string &s, VType r, int h) : name(s), handle(h), ret(r)
 			{
 				tag = 0;
 				localstack = 0;
@@ -366,8 +637,15 @@ namespace IL
 				local.push_back(var_table());
 				labels = 0;
 				maxstack = 0;
+				size = 0;
+				return_il = 0;
+				resolved = false;
+			}
+			void pushcode(opcode *c)
+			{
+				c->index = code.size();
+				code.push_back(c);
 			}
-			void pushcode(opcode *c)			{code.push_back(c);}
 			int getCurrentStack();
 			ValueInfo getVariable(const string &name)
 			{
@@ -397,9 +675,8 @@ namespace IL
 			{
 				local.back()[name].name = name;
 				local.back()[name].type = type;
-				int size = type->getSize();
 				local.back()[name].address = argstack;
-				argstack += size;
+				argstack += 4;	// 引数はどの型でも4byteずつ積まれる
 				argtype.push_back(type);
 			}
 			int getTemp()
@@ -416,57 +693,83 @@ namespace IL
 					maxstack = tempstack;
 				tempstack = 0;
 			}
-			int getLabel()			{return labels++;}
-			void addLabel(int l)	{label[l] = Label_(codesize(), code.size());}
-			int Label(int l)		{return label[l].native;}
-			int LabelIL(int l)		{return label[l].il;}
-			int codesize()
+			int getLabel()			{label.push_back(0);return labels++;}
+			void addLabel(int l)	{label[l] = code.size();}
+			int LabelIL(int l)		{return label[l];}
+			int codesize()			{return size;}
+			void resolve(Environment *env)
+			{
+				if (env->usingOptimize())
+				{
+					tailcall(env);
+					expand(env);
+				}
+				for (Code::iterator it = code.begin(); it != code.end(); ++it)
+					(*it)->resolve(env);
+				if (env->usingOptimize())
+				{
+					optimize(env);
+					color();
+				}
+				lower(env);
+				resolved = true;
+			}
+			void lower(Environment *env)
 			{
-				int size = 1+2+6;
+				// 中間言語の位置→バイトコードの位置
+				vector<int> at;
+				bytecode.clear();
+				target.clear();
 				for (Code::iterator it = code.begin(); it != code.end(); ++it)
-					size += (*it)->getSize();
-				return size;
-				// 現状だとpushする度にsizeにも加算する方法の方がよいが
+				{
+					at.push_back(bytecode.size());
+					(*it)->lower(env);
+				}
+				at.push_back(bytecode.size());
+				bytecode.push_back(BC::end);	// 最後まで行ったら戻る
+				for (vector<int>::iterator it = target.begin(); it != target.end(); ++it)
+					bytecode[*it] = at[bytecode[*it]];
 			}
+			int slot(int s)			{return s < 0 ? localstack + maxstack + s : -s;}
+			void emit(int i)		{bytecode.push_back(i);}
+			void emitTarget(int il)	{target.push_back(bytecode.size());bytecode.push_back(il);}
+			const int *Bytecode()	{return &bytecode[0];}
 			void pregen(Environment *env)
 			{
+				env->EnterFunction(name);
+				allocate(env);
+				assemble(env);
+				env->LeaveFunction();
 				address = env->NCodes(codesize());
 			}
 			void gen(Environment *env)
 			{
 				env->EnterFunction(name);
-				x86::push_ebp(env->Codes());
-				x86::mov_ebp_esp(env->Codes());
-				x86::add_esp_int(env->Codes(), -(localstack+maxstack));
-				for (Code::iterator it = code.begin(); it != code.end(); ++it)
-				{
-					(*it)->gen(env);
-				}
+				assemble(env);
 				env->LeaveFunction();
 				env->writeNcode(address);
 			}
-			void setReturn()	{return_address = codesize();}
-			int getReturn()		{return return_address;}
-			int getCodePos(opcode *c)
+			void genEnter(Environment *env)
 			{
-				int size = 1+2+6;
-				for (Code::iterator it = code.begin(); it != code.end(); ++it)
-				{
-					if (it->get() == c)
-						return size;
-					size += (*it)->getSize();
-				}
-				return 0;
+				cpu::enter(env->Codes(), localstack+maxstack+4*(int)saved.size());
+				for (int i = 0; i < (int)saved.size(); i++)
+					cpu::mov_stack_reg(env->Codes(), -(localstack+maxstack+4*(i+1)), saved[i]);
+				env->genFuel();
 			}
-			int getILPos(opcode *c)
+			void genLeave(Environment *env)
 			{
-				for (Code::iterator it = code.begin(); it != code.end(); ++it)
-				{
-					if (it->get() == c)
-						return it - code.begin();
-				}
-				return 0;
+				for (int i = 0; i < (int)saved.size(); i++)
+					cpu::mov_reg_stack(env->Codes(), saved[i], -(localstack+maxstack+4*(i+1)));
+				cpu::leave(env->Codes(), localstack+maxstack+4*(int)saved.size());
+			}
+			void setReturn()	{return_il = code.size();}
+			int getReturn()		{return labels;}	// 戻る所は最後のラベルの次の番号にしておく
+			int Reg(int stack)
+			{
+				std::map<int, int>::iterator it = reg.find(stack);
+				return it == reg.end() ? -1 : it->second;
 			}
+			int getILPos(opcode *c)		{return c->index;}
 
 			enum Run
 			{
@@ -475,15 +778,8 @@ namespace IL
 				Return,
 				Call,
 			};
-			Run run(Environment *env, int start)
-			{
-				return env->runCode(code, start);
-			}
-			void call(Environment *env)
-			{
-				env->EnterFunction(name);
-				env->r.enter(localstack+maxstack);
-			}
+			Run run(ExecutionContext *cx, int start);
+			bool call(ExecutionContext *cx);
 			VType getFuncPtr()
 			{
 				FuncPtr *f = new FuncPtr(ret);
@@ -494,9 +790,23 @@ namespace IL
 			}
 			VType getReturnType(){return ret;}
 			int getAddress(){return address;}
+			int getArgs(){return (int)argtype.size();}
+			// floatの引数をビットで(1番目が最下位)、x64ではCとの出入り口でxmmに移す
+			int getFloats()
+			{
+				int f = 0;
+				for (int i = 0; i < (int)argtype.size() && i < 32; i++)
+					if (argtype[i]->isP(ValueType::Float))
+						f |= 1 << i;
+				return f;
+			}
+			bool returnsFloat(){return ret && ret->isP(ValueType::Float);}
+			int getHandle(){return handle;}
+			int getFrameSize(){return localstack + maxstack;}	// ローカル変数と一時変数の大きさ
 		private:
 			int tag;
 			string name;
+			int handle;		// 中間言語実行で関数を値として持つ時の番号
 			Code code;
 			vector<var_table> local;
 			int localstack;
@@ -505,18 +815,392 @@ namespace IL
 			int argstack;
 			VType ret;
 			vector<VType> argtype;
+			int size;
 			int labels;
 			int address;
-			int return_address;
-			struct Label_
+			int return_il;
+			bool resolved;			// 中間言語が出来上がったか(自分を呼んでる途中はまだ)
+			vector<int> label;		// ラベル→中間言語の位置
+			Assembler::Long longs;	// 長くしたジャンプ
+			vector<int> bytecode;
+			vector<int> target;
+
+			// 一時変数をレジスタに割り当てる
+			// 一時変数の場所は文ごとに使い回されるので、場所単位で関数全体を通して割り当てる
+			struct Interval
 			{
-				Label_(){}
-				Label_(int n, int i){native = n;il = i;}
-				int native;
-				int il;
+				int stack;
+				int first;
+				int last;
+				bool edx;	// 間でedxを壊されないか
+				bool def;	// 最初に触るのが書き込みか
+				static bool less(const Interval &a, const Interval &b){return a.first < b.first;}
 			};
-			std::map<int, Label_> label;
-			// これ必ずgetLabelで順番に発行するならvectorでよくない？
+			std::map<int, int> reg;		// 一時変数の場所→レジスタ
+			vector<int> saved;			// 関数の頭で退避するレジスタ
+			void allocate(Environment *env)
+			{
+				reg.clear();
+				saved.clear();
+				if (!env->usingRegister())
+					return;
+
+				std::map<int, Interval> range;
+				std::map<int, bool> memory;
+				for (int i = 0; i < (int)code.size(); i++)
+				{
+					Operands o;
+					code[i]->operands(o);
+					for (Operands::iterator it = o.begin(); it != o.end(); ++it)
+					{
+						int s = *it->slot;
+						if (s >= -localstack)
+							continue;	// 引数とローカル変数はそのまま
+						if (it->flags & Operand::Memory)
+							memory[s] = true;
+						if (!range.count(s))
+						{
+							Interval &r = range[s];
+							r.stack = s;
+							r.first = i;
+							r.edx = true;
+							r.def = true;
+						}
+						if (range[s].first == i && (it->flags & Operand::Read))
+							range[s].def = false;
+						range[s].last = i;
+					}
+				}
+
+				// 後ろに飛ぶジャンプを跨いでるなら、ループ全体で生きてることにする
+				// ループの中に収まってても、先に読んでるなら前の周の値を使ってる
+				bool changed = true;
+				while (changed)
+				{
+					changed = false;
+					for (int i = 0; i < (int)code.size(); i++)
+					{
+						int t = code[i]->branch();
+						if (t < 0 || t > i)
+							continue;
+						for (std::map<int, Interval>::iterator it = range.begin(); it != range.end(); ++it)
+						{
+							Interval &r = it->second;
+							if (r.first <= i && r.last >= t && (r.first > t || r.last < i) &&
+								(r.first < t || r.last > i || !r.def))
+							{
+								r.first = std::min(r.first, t);
+								r.last = std::max(r.last, i);
+								changed = true;
+							}
+						}
+					}
+				}
+
+				vector<Interval> order;
+				for (std::map<int, Interval>::iterator it = range.begin(); it != range.end(); ++it)
+				{
+					Interval &r = it->second;
+					if (memory.count(r.stack))
+						continue;
+					for (int i = r.first + 1; i < r.last && r.edx; i++)
+						if (code[i]->clobber() & (1 << cpu::edx))
+							r.edx = false;
+					order.push_back(r);
+				}
+				std::sort(order.begin(), order.end(), Interval::less);
+
+				// 線形走査、足りなくなったら一番長く生きるものを追い出す
+				const int regs[] = {cpu::ebx, cpu::esi, cpu::edi, cpu::edx};
+				const int nregs = sizeof(regs) / sizeof(*regs);
+				vector<Interval> active;
+				bool used[8] = {false};
+				for (vector<Interval>::iterator cur = order.begin(); cur != order.end(); ++cur)
+				{
+					for (int i = 0; i < (int)active.size(); )
+					{
+						if (active[i].last < cur->first)
+						{
+							active.erase(active.begin() + i);
+							continue;
+						}
+						i++;
+					}
+					int r = -1;
+					for (int i = 0; i < nregs && r < 0; i++)
+					{
+						if (regs[i] == cpu::edx && !cur->edx)
+							continue;
+						if (regs[i] == cpu::edi && env->usingInstance())
+							continue;	// インスタンス用の時はグローバル変数の場所が入ってる
+						bool busy = false;
+						for (int j = 0; j < (int)active.size(); j++)
+							if (reg[active[j].stack] == regs[i])
+								busy = true;
+						if (!busy)
+							r = regs[i];
+					}
+					if (r < 0)
+					{
+						int spill = -1;
+						for (int j = 0; j < (int)active.size(); j++)
+						{
+							if (reg[active[j].stack] == cpu::edx && !cur->edx)
+								continue;
+							if (active[j].last > cur->last && (spill < 0 || active[j].last > active[spill].last))
+								spill = j;
+						}
+						if (spill < 0)
+							continue;
+						r = reg[active[spill].stack];
+						reg.erase(active[spill].stack);
+						active.erase(active.begin() + spill);
+					}
+					reg[cur->stack] = r;
+					active.push_back(*cur);
+				}
+				for (std::map<int, int>::iterator it = reg.begin(); it != reg.end(); ++it)
+					used[it->second] = true;
+				for (int i = 0; i < nregs; i++)
+					if (used[regs[i]] && regs[i] != cpu::edx)
+						saved.push_back(regs[i]);
+			}
+			// 一時変数のコピーを減らす
+			// a = 一時変数 の一時変数は直接aに計算させて、一時変数 = a のコピーは元のaから読む
+			// 書いたのに誰も読まない一時変数への計算は消す(Writeがある命令は他に何もしない)
+			bool isTemp(int s){return s < -localstack;}
+			void expand(Environment *env);
+			void tailcall(Environment *env);
+			void color();
+			void occupy(const Operands &o, std::set<int> &live);
+			bool inlinable();
+			void optimize(Environment *env)
+			{
+				if (code.empty())
+					return;
+
+				// 番地を取ったりバイト単位で触ったりする場所は扱わない
+				// ローカル変数の番地を取ってたら、ポインタ越しに書き換わるかもしれないので元の場所から読む様にはしない
+				int n = code.size();
+				vector<Operands> ops(n);
+				std::set<int> memory;
+				bool aliased = false;
+				for (int i = 0; i < n; i++)
+				{
+					Operands &o = ops[i];
+					code[i]->operands(o);
+					for (Operands::iterator it = o.begin(); it != o.end(); ++it)
+					{
+						if (!(it->flags & Operand::Memory))
+							continue;
+						memory.insert(*it->slot);
+						if (!isTemp(*it->slot))
+							aliased = true;
+					}
+				}
+
+				vector<int> block, first;
+				int blocks = split(block, first);
+
+				// ブロックの中で、コピーした一時変数を読んでる所を元の場所から読む様にする
+				std::map<int, int> copy;
+				for (int i = 0; i < n; i++)
+				{
+					if (first[block[i]] == i)
+						copy.clear();
+					Operands &o = ops[i];
+					for (Operands::iterator it = o.begin(); it != o.end(); ++it)
+						if (it->flags == Operand::Read && copy.count(*it->slot))
+							*it->slot = copy[*it->slot];
+					for (Operands::iterator it = o.begin(); it != o.end(); ++it)
+					{
+						if (!(it->flags & Operand::Write))
+							continue;
+						for (std::map<int, int>::iterator c = copy.begin(); c != copy.end(); )
+						{
+							if (c->first == *it->slot || c->second == *it->slot)
+								copy.erase(c++);
+							else
+								++c;
+						}
+					}
+					if (code[i]->copy())
+					{
+						int to = *o[0].slot, from = *o[1].slot;
+						if (tracked(to, memory) && to != from && !memory.count(from) && (isTemp(from) || !aliased))
+							copy[to] = from;
+					}
+				}
+
+				// 一時変数の生存をブロック単位で求める
+				// 無条件のジャンプやReturnも次に進むことにしておく(多めに生きてることになるだけ)
+				vector<std::set<int> > in(blocks), out(blocks);
+				bool changed = true;
+				while (changed)
+				{
+					changed = false;
+					for (int b = blocks - 1; b >= 0; b--)
+					{
+						std::set<int> live;
+						int last = first[b + 1] - 1;
+						int t = code[last]->branch();
+						if (t >= 0 && block[t] < blocks)
+							live.insert(in[block[t]].begin(), in[block[t]].end());
+						if (b + 1 < blocks)
+							live.insert(in[b + 1].begin(), in[b + 1].end());
+						out[b] = live;
+						for (int i = last; i >= first[b]; i--)
+							transfer(ops[i], live, memory);
+						if (live != in[b])
+						{
+							in[b] = live;
+							changed = true;
+						}
+					}
+				}
+
+				// 後ろから、死んだ一時変数への計算を消して、直後のコピーは計算に書き先を移す
+				vector<bool> dead(n, false);
+				for (int b = 0; b < blocks; b++)
+				{
+					std::set<int> live = out[b];
+					for (int i = first[b + 1] - 1; i >= first[b]; i--)
+					{
+						Operands &o = ops[i];
+						bool write = false, used = false;
+						for (Operands::iterator it = o.begin(); it != o.end(); ++it)
+						{
+							if (!(it->flags & Operand::Write))
+								continue;
+							write = true;
+							if (it->flags != Operand::Write || !tracked(*it->slot, memory) || live.count(*it->slot))
+								used = true;
+						}
+						if (write && !used)
+						{
+							dead[i] = true;
+							continue;
+						}
+						if (code[i]->copy())
+						{
+							int to = *o[0].slot, from = *o[1].slot;
+							if (to == from)
+							{
+								dead[i] = true;
+								continue;
+							}
+							int *w = i > first[b] && tracked(from, memory) && !live.count(from) ? written(ops[i - 1]) : NULL;
+							if (w && *w == from)
+							{
+								*w = to;
+								dead[i] = true;
+								continue;
+							}
+						}
+						transfer(o, live, memory);
+					}
+				}
+
+				// 消した分を詰めて、ラベルの位置を直す
+				vector<int> at(n + 1);
+				Code kept;
+				for (int i = 0; i < n; i++)
+				{
+					at[i] = kept.size();
+					if (dead[i])
+						continue;
+					code[i]->index = kept.size();
+					kept.push_back(code[i]);
+				}
+				at[n] = kept.size();
+				code.swap(kept);
+				for (vector<int>::iterator it = label.begin(); it != label.end(); ++it)
+					*it = at[std::min(*it, n)];
+				return_il = at[std::min(return_il, n)];
+				for (Code::iterator it = code.begin(); it != code.end(); ++it)
+					(*it)->resolve(env);
+			}
+			// ジャンプ先とジャンプの次からブロックを分ける
+			// blockは命令→ブロック、firstはブロックの頭の命令(最後に番兵でcode.size())
+			int split(vector<int> &block, vector<int> &first)
+			{
+				int n = code.size();
+				block.assign(n + 1, 0);
+				first.clear();
+				vector<bool> leader(n + 1, false);
+				leader[0] = true;
+				leader[std::min(return_il, n)] = true;
+				for (int i = 0; i < n; i++)
+				{
+					int t = code[i]->branch();
+					if (t < 0)
+						continue;
+					leader[t] = true;
+					leader[i + 1] = true;
+				}
+				for (int i = 0; i <= n; i++)
+				{
+					if (leader[i] && i < n)
+						first.push_back(i);
+					block[i] = first.size() - 1;
+				}
+				block[n] = first.size();
+				first.push_back(n);
+				return first.size() - 1;
+			}
+			bool tracked(int s, const std::set<int> &memory){return isTemp(s) && !memory.count(s);}
+			// 書いて読む
+			void transfer(const Operands &o, std::set<int> &live, const std::set<int> &memory)
+			{
+				for (Operands::const_iterator it = o.begin(); it != o.end(); ++it)
+					if (it->flags == Operand::Write)
+						live.erase(*it->slot);
+				for (Operands::const_iterator it = o.begin(); it != o.end(); ++it)
+					if ((it->flags & Operand::Read) && tracked(*it->slot, memory))
+						live.insert(*it->slot);
+			}
+			// 書くだけの場所が1つだけならそれ
+			int *written(Operands &o)
+			{
+				int *w = NULL;
+				for (Operands::iterator it = o.begin(); it != o.end(); ++it)
+				{
+					if (!(it->flags & Operand::Write))
+						continue;
+					if (it->flags != Operand::Write || w)
+						return NULL;
+					w = it->slot;
+				}
+				return w;
+			}
+			void assemble(Environment *env)
+			{
+				// ラベルを中間言語の位置の順に並べておいて、その命令を吐く前に置く
+				vector<std::pair<int, int> > at;
+				for (int i = 0; i < labels; i++)
+					at.push_back(std::make_pair(label[i], i));
+				at.push_back(std::make_pair(return_il, labels));
+				std::stable_sort(at.begin(), at.end());
+
+				// 前に飛ぶ短いジャンプが届かなかったら、そこを長くして吐き直す
+				Assembler &a = env->Asm();
+				do
+				{
+					a.begin(labels + 1, &longs);
+					genEnter(env);
+					vector<std::pair<int, int> >::iterator l = at.begin();
+					for (int i = 0; i < (int)code.size(); i++)
+					{
+						for (; l != at.end() && l->first <= i; ++l)
+							a.bind(l->second);
+						code[i]->gen(env);
+					}
+					for (; l != at.end(); ++l)
+						a.bind(l->second);
+				}
+				while (!a.end());
+				size = a.Codes().size();
+			}
 		};
 		Environment()
 		{
@@ -526,7 +1210,23 @@ namespace IL
 			native = new NativeData();
 			native->global.resize(globalsize);
 			errors = 0;
-		}
+			use_bytecode = false;
+			use_register = true;
+			use_instance = false;
+			use_fuel = false;
+			fuel = -1;
+			exit_address = 0;
+			tier_threshold = 0;
+			tier_tried = false;
+			function_value = false;
+			use_optimize = true;
+			inline_size = 16;
+			inline_budget = 128;
+			stack_size = 0x100000;
+		}
+		// 中間言語実行時のスタックの大きさ、実行前に(JITのスタックもこの大きさ)
+		void setStackSize(int size);
+		int getStackSize(){return stack_size;}
 		void err(const string &s)
 		{
 			errors++;
@@ -558,7 +1258,8 @@ namespace IL
 				{
 					vi.atype = ValueInfo::function;
 					vi.type = (*it)->function[name]->getFuncPtr();
-					vi.address = (int)((*it)->function[name].get());
+					vi.address = (int)(size_t)((*it)->function[name].get());
+					vi.object = (*it)->function[name].get();
 					return vi;
 				}
 			}
@@ -570,7 +1271,7 @@ namespace IL
 				// ここで今すぐEnterNameSpace(name);する？
 				// それはちょっとなー
 				// 例によってenvにセットするか…
-				vi.address = (int)(ns_context.back()->ns[name].get());
+				vi.address = (int)(size_t)(ns_context.back()->ns[name].get());
 				last_ns = ns_context.back()->ns[name];
 				return vi;
 			}
@@ -617,6 +1318,18 @@ namespace IL
 			*(int*)Global(address) = val;
 			return vi.address;
 		}
+		int addNative(const string &name, VType type, const void *func, int address)
+		{
+			NativeFunc n;
+			n.address = address;
+			n.func = func;
+			n.args = type->getASize();
+			n.thunk = 0;
+			n.tiered = 0;
+			n.invoke = Invoke::of(type);
+			natives.push_back(n);
+			return addGlobal(name, type, (int)(size_t)func, address);
+		}
 		int addString(const string &s)
 		{
 			if (!string_table.count(s))
@@ -635,55 +1348,255 @@ namespace IL
 
 		void EnterFunction(const string &s, VType r = NULL)
 		{
-			if (!ns_context.back()->function.count(s))ns_context.back()->function[s] = new Function(s, r);
+			if (!ns_context.back()->function.count(s))
+			{
+				Function *f = new Function(s, r, callee.size() + 1);
+				callee.push_back(f);
+				ns_context.back()->function[s] = f;
+			}
 			function_context.push_back(ns_context.back()->function[s]);
 		}
+		// 中間言語実行時の関数の値、Cの関数はその番地、スクリプトの関数は番号
+		// どっちでもない値ならNULL
+		Function *Callee(int v)		{return v >= 1 && v <= (int)callee.size() ? callee[v - 1] : NULL;}
 		void LeaveFunction()							{function_context.pop_back();}
 		void addLocal(const string &name, VType type)	{function_context.back()->addLocal(name, type);}
 		void addArg(const string &name, VType type)		{function_context.back()->addArg(name, type);}
 		void pushcode(IL::opcode *c)					{function_context.back()->pushcode(c);}
-		int getCodePos(opcode *c)						{return function_context.back()->getCodePos(c);}
 		int getILPos(opcode *c)							{return function_context.back()->getILPos(c);}
 		void newState()									{function_context.back()->newState();}
 
 		int getLabel()									{return function_context.back()->getLabel();}
 		void addLabel(int label)						{function_context.back()->addLabel(label);}
-		int Label(int label)							{return function_context.back()->Label(label);}
 		int LabelIL(int label)							{return function_context.back()->LabelIL(label);}
+		void resolve()									{function_context.back()->resolve(this);}
+		void emit(int op)								{function_context.back()->emit(op);}
+		void emit(int op, int a)						{emit(op);emit(a);}
+		void emit(int op, int a, int b)					{emit(op);emit(a);emit(b);}
+		void emit(int op, int a, int b, int c)			{emit(op);emit(a);emit(b);emit(c);}
+		void emitTarget(int il)							{function_context.back()->emitTarget(il);}
+		int slot(int s)									{return function_context.back()->slot(s);}
 		void setReturn()								{function_context.back()->setReturn();}
+		void genLeave()									{function_context.back()->genLeave(this);}
+
+		// スタック上の一時変数はレジスタに割り当てられてるかもしれない
+		int Reg(int stack)								{return function_context.back()->Reg(stack);}
+		void loadReg(int r, int stack)
+		{
+			int a = Reg(stack);
+			if (a < 0)
+				cpu::mov_reg_stack(Codes(), r, stack);
+			else if (a != r)
+				cpu::mov_reg_reg(Codes(), r, a);
+		}
+		void storeReg(int stack, int r)
+		{
+			int a = Reg(stack);
+			if (a < 0)
+				cpu::mov_stack_reg(Codes(), stack, r);
+			else if (a != r)
+				cpu::mov_reg_reg(Codes(), a, r);
+		}
+		void pushStack(int stack)
+		{
+			int a = Reg(stack);
+			if (a < 0)
+				cpu::push_stack(Codes(), stack);
+			else
+				cpu::push_reg(Codes(), a);
+		}
+		void setStack(int stack, int val)
+		{
+			int a = Reg(stack);
+			if (a < 0)
+				cpu::mov_stack_int(Codes(), stack, val);
+			else
+				cpu::mov_reg_int(Codes(), a, val);
+		}
+		void addStack(int stack, int val)
+		{
+			int a = Reg(stack);
+			if (a < 0)
+				cpu::add_stack_int(Codes(), stack, val);
+			else
+				cpu::add_reg_int(Codes(), a, val);
+		}
+		void incStack(int stack)
+		{
+			int a = Reg(stack);
+			if (a < 0)
+				cpu::inc_stack(Codes(), stack);
+			else
+				cpu::inc_reg(Codes(), a);
+		}
+		void decStack(int stack)
+		{
+			int a = Reg(stack);
+			if (a < 0)
+				cpu::dec_stack(Codes(), stack);
+			else
+				cpu::dec_reg(Codes(), a);
+		}
 		int getReturn()									{return function_context.back()->getReturn();}
 		VType getReturnType()							{return function_context.back()->getReturnType();}
+		// グローバル変数の番地、x64はRIP相対なので今の関数の先頭からの距離
+		int Mem(int a)
+		{
+		#ifdef NES_X64
+			return GlobalBase() + a - (CodeBase() + function_context.back()->getAddress());
+		#else
+			return GlobalBase() + a;
+		#endif
+		}
+		// グローバル変数を触る命令、インスタンス用の時はediからの距離
+		void loadGlobal(int a)		{if (use_instance) cpu::mov_eax_base(Codes(), a); else cpu::mov_eax_mem(Codes(), Mem(a));}
+		void storeGlobal(int a)		{if (use_instance) cpu::mov_base_eax(Codes(), a); else cpu::mov_mem_eax(Codes(), Mem(a));}
+		void storeGlobalByte(int a)	{if (use_instance) cpu::mov_base_al(Codes(), a); else cpu::mov_mem_al(Codes(), Mem(a));}
+		void addressGlobal(int a)	{if (use_instance) cpu::lea_eax_base(Codes(), a); else cpu::lea_eax_mem(Codes(), Mem(a));}
+		void incGlobal(int a)		{if (use_instance) cpu::inc_base(Codes(), a); else cpu::inc_mem(Codes(), Mem(a));}
+		void incGlobalByte(int a)	{if (use_instance) cpu::inc_byte_base(Codes(), a); else cpu::inc_byte_mem(Codes(), Mem(a));}
+		void decGlobal(int a)		{if (use_instance) cpu::dec_base(Codes(), a); else cpu::dec_mem(Codes(), Mem(a));}
+		void decGlobalByte(int a)	{if (use_instance) cpu::dec_byte_base(Codes(), a); else cpu::dec_byte_mem(Codes(), Mem(a));}
+		void addGlobal(int a, int val)	{if (use_instance) cpu::add_base_int(Codes(), a, val); else cpu::add_mem_int(Codes(), Mem(a), val);}
+		// 燃料を1つ減らして、切れたら入口まで戻る
+		void genFuel()
+		{
+			if (!use_fuel)
+				return;
+			decGlobal(fuel);
+			cpu::jcc(Codes(), cpu::S, exit_address - function_context.back()->getAddress() - ((int)Codes().size() + 6));
+		}
+		// 入口と出口から触るグローバル変数、x64はコードの先頭からの距離
+		int ThunkMem(int a)
+		{
+			if (use_instance)
+				return a;
+		#ifdef NES_X64
+			return GlobalBase() + a - CodeBase();
+		#else
+			return GlobalBase() + a;
+		#endif
+		}
+		// 呼ぶ関数の頭、今の関数の先頭からの距離
+		int Entry(Function *f)
+		{
+			return f->getAddress() - function_context.back()->getAddress();
+		}
 		struct NativeData
 		{
 			typedef unsigned char byte;
+			NativeData() : exec(NULL), instance(false), stack_size(0), fuel(-1){}
+			~NativeData()
+			{
+				if (exec)
+					CodeMemory::get().free(exec);
+			}
 			int global_base;
 			int code_base;
 			vector<byte> code;
-			vector<byte> global;
+			Bytes global;
+			// 実行するコードはこっち、codeは書き出し用に残しておく
+			byte *exec;
+		#ifdef NES_X64
+			// JITが使うグローバル変数とスタック
+			// Cの関数ポインタが出口の番地に置き換わるので、環境の方のグローバル変数とは別に持つ
+			Bytes data;
+		#endif
 			std::map<string, int> global_address;
 			std::map<string, int> function_address;
+			// useInstance()して作った時、関数の入口はf(global, stack, 引数...)になる
+			// entryは関数のハンドル-1ごとの入口、stack_sizeはx64で乗り換えるスタックの大きさ
+			bool instance;
+			vector<int> entry;
+			int stack_size;
+			// 燃料を置いたグローバル変数、useFuel()してなければ-1
+			// 切れたら入口が0を返すので、exhausted()で見る(インスタンスはInstanceの方)
+			int fuel;
+			void setFuel(int f)	{if (fuel >= 0) *(int*)&image()[fuel] = f;}
+			int getFuel()		{return fuel >= 0 ? *(int*)&image()[fuel] : 0;}
+			bool exhausted()	{return getFuel() < 0;}
+			// 初期化が終わった時のグローバル変数、インスタンスはこれをコピーして作る
+			// インスタンス用でなければJITしたコードが今使ってるグローバル変数
+			Bytes &image()
+			{
+			#ifdef NES_X64
+				return data;
+			#else
+				return global;
+			#endif
+			}
+			// JITしたコードのグローバル変数を写す/戻す
+			Snapshot snapshot()					{return takeSnapshot(image(), global.size());}
+			bool restore(const Snapshot &s)		{return restoreSnapshot(image(), s);}
 			int *get(const string &name)
 			{
 				if (function_address.count(name))
 				{
+					if (exec)
+						return (int*)(exec + function_address[name]);
 					return (int*)&code[function_address[name]];
 				}
 				else if (global_address.count(name))
 				{
+				#ifdef NES_X64
+					return (int*)&data[global_address[name]];
+				#else
 					return (int*)&global[global_address[name]];
+				#endif
 				}
 				return NULL;
 			}
 		};
 		typedef shptr<NativeData> Native;
+		// code_baseを指定した時はその番地で動くコードを作るだけ(exeに書き出す時とか)
+		// 指定しなければ実行出来るメモリに置く
 		Native gen(int code_base = 0, int global_base = 0)
 		{
+			// 先に一度組み立てて大きさを決めてから番地を取る
+			native->instance = use_instance;
+			native->fuel = use_fuel ? fuel : -1;
+			native->entry.assign(callee.size(), 0);
+			native->stack_size = stack_size;
+			pregen_ns(global);
+		#ifdef NES_X64
+			// コードの後ろにCとの出入り口を置く
+			vector<NativeData::byte> thunk(native->code.size());
+			gen_thunk(thunk, 0);
+			native->exec = CodeMemory::get().alloc(thunk.size());
+			if (!native->exec)
+			{
+				err("can't allocate executable memory");
+				return NULL;
+			}
+			native->code_base = (int)(size_t)native->exec;
+			// インスタンス用の時はスタックを呼ぶ側が渡すので、グローバル変数だけ
+			int datasize = (globalsize + 15) / 16 * 16;
+			native->data.assign(use_instance ? datasize : datasize + stack_size, 0);
+			if (globalsize)
+				std::memcpy(&native->data[0], &native->global[0], globalsize);
+			native->global_base = (int)(size_t)&native->data[0];
+			gen_ns(global);
+			gen_thunk(native->code, native->global_base + native->data.size());
+			for (vector<NativeFunc>::iterator it = natives.begin(); it != natives.end(); ++it)
+				*(int*)&native->data[it->address] = native->code_base + it->thunk;
+		#else
+			// インスタンス用か燃料を数える時はコードの後ろに入口を置く
+			int size = native->code.size();
+			if (use_instance || use_fuel)
+			{
+				vector<NativeData::byte> thunk(size);
+				gen_thunk(thunk, 0);
+				size = thunk.size();
+			}
 			if (!code_base)
 			{
-				native->code.reserve(getCodeSize());
-				native->code.resize(1);
-				native->code_base = (int)&native->code[0];
-				native->code.resize(0);
+				native->exec = CodeMemory::get().alloc(size);
+				if (!native->exec)
+				{
+					err("can't allocate executable memory");
+					return NULL;
+				}
+				native->code_base = (int)(size_t)native->exec;
 			}
 			else
 			{
@@ -694,27 +1607,42 @@ namespace IL
 				if (globalsize)
 				{
 					native->global.reserve(globalsize);
-					native->global_base = (int)&native->global[0];
+					native->global_base = (int)(size_t)&native->global[0];
 				}
 			}
 			else
 			{
 				native->global_base = global_base;
 			}
-			pregen_ns(global);
 			gen_ns(global);
+			if (use_instance || use_fuel)
+				gen_thunk(native->code, 0);
+		#endif
 			if (errors)
 			{
 				std::printf("IL: %d errors occurred\n", errors);
 				return NULL;
 			}
+			if (native->exec && !CodeMemory::get().write(native->exec, &native->code[0], native->code.size()))
+			{
+				err("can't write executable memory");
+				return NULL;
+			}
 			return native;
 		}
-		int getCodeSize()		{return codesize(global);}
+		// 大きさを測るだけなので、取った場所はgen()で取り直す
+		int getCodeSize()
+		{
+			pregen_ns(global);
+			int size = native->code.size();
+			native->code.clear();
+			return size;
+		}
 		int GlobalBase(){return native->global_base;}
 		int CodeBase(){return native->code_base;}
-		vector<NativeData::byte> tempcode;
-		vector<NativeData::byte> &Codes(){return tempcode;}
+		Assembler assembler;
+		Assembler &Asm(){return assembler;}
+		vector<NativeData::byte> &Codes(){return assembler.Codes();}
 		int NCodes(int size)
 		{
 			int address = native->code.size();
@@ -723,136 +1651,155 @@ namespace IL
 		}
 		void writeNcode(int address)
 		{
-			memcpy(&native->code[address], &tempcode[0], tempcode.size());
-			tempcode.resize(0);
-		}
-		int run(int argc = 0, char **argv = 0)
-		{
-			r.stack.reserve(0x1000);
-			r.stack.resize(0x100);
-			runFunction("main");
-			return r.ret;
+			memcpy(&native->code[address], &Codes()[0], Codes().size());
+			Codes().resize(0);
 		}
+		// 既定の実行状態で実行する、別のスレッドから同時に実行するならExecutionContextを作る
+		int run(int argc = 0, char **argv = 0);
 		int call(const string &name, int a1 = 0, int a2 = 0, int a3 = 0, int a4 = 0, int a5 = 0, int a6 = 0, int a7 = 0, int a8 = 0,
-									int a9 = 0, int a10 = 0, int a11 = 0, int a12 = 0, int a13 = 0, int a14 = 0, int a15 = 0, int a16 = 0)
-		{
-			r.stack.reserve(0x1000);
-			r.stack.resize(0x100);
-			*(int*)&r.stack[0x100-4* 1] = a1;
-			*(int*)&r.stack[0x100-4* 2] = a2;
-			*(int*)&r.stack[0x100-4* 3] = a3;
-			*(int*)&r.stack[0x100-4* 4] = a4;
-			*(int*)&r.stack[0x100-4* 5] = a5;
-			*(int*)&r.stack[0x100-4* 6] = a6;
-			*(int*)&r.stack[0x100-4* 7] = a7;
-			*(int*)&r.stack[0x100-4* 8] = a8;
-			*(int*)&r.stack[0x100-4* 9] = a9;
-			*(int*)&r.stack[0x100-4*10] = a10;
-			*(int*)&r.stack[0x100-4*11] = a11;
-			*(int*)&r.stack[0x100-4*12] = a12;
-			*(int*)&r.stack[0x100-4*13] = a13;
-			*(int*)&r.stack[0x100-4*14] = a14;
-			*(int*)&r.stack[0x100-4*15] = a15;
-			*(int*)&r.stack[0x100-4*16] = a16;
-			runFunction(name);
-			return r.ret;
+									int a9 = 0, int a10 = 0, int a11 = 0, int a12 = 0, int a13 = 0, int a14 = 0, int a15 = 0, int a16 = 0);
+		using Caller<Environment>::call;
+		int invoke(Function *f, const int *a, int n);
+		ExecutionContext &Context();
+		// 関数を引く、無いか型が合わない時は空
+		// JITしたnativeを渡すとそっちのコードを呼ぶ
+		// 型を作って比べるので、スレッドから呼ぶ前に引いておく
+		template<class F> Handle<F> lookup(const string &name, Native n = Native())
+		{
+			Handle<F> h;
+			Funcs::iterator it = global->function.find(name);
+			if (it == global->function.end() || !Signature<F>::is(it->second->getFuncPtr()))
+				return h;
+		#ifndef NES_X64
+			// 32bitのCはfloatをst0で受けるけど、JITしたコードはeaxで返すので直接は呼べない
+			if (n && n->exec && !n->instance && it->second->returnsFloat())
+				return h;
+		#endif
+			h.func = it->second;
+			if (n && n->exec && !n->instance)	// インスタンス用の入口は形が違うのでInstanceから呼ぶ
+				h.entry = (F*)n->get(name);
+			return h;
+		}
+		// 関数のフレームの大きさ、無ければ-1
+		int getFrameSize(const string &name)
+		{
+			Funcs::iterator it = global->function.find(name);
+			return it == global->function.end() ? -1 : it->second->getFrameSize();
 		}
 		int *getGlobal(const string &name){return (int*)&native->global[global->global[name].address];}
-		Function::Run status;
-		Function::Run runCode(Code &c, int start)
-		{
-			for (Code::iterator it = c.begin() + start; it != c.end(); ++it)
+		// 中間言語で実行する時のグローバル変数を写す/戻す、JITしたコードのはNativeDataの方で
+		Snapshot snapshot()				{return takeSnapshot(native->global, native->global.size());}
+		bool restore(const Snapshot &s)	{return restoreSnapshot(native->global, s);}
+		// 関数型で宣言したグローバル変数にCの関数を置く、gen()の前に
+		// var printint : (int):void; なら setNative("printint", (const void*)printint)
+		bool setNative(const string &name, const void *func)
+		{
+			if (!global->global.count(name) || !global->global[name].type->isP(ValueType::Function))
+				return false;
+			Invoke invoke = Invoke::of(global->global[name].type);
+			if (!invoke)
+				return false;
+			VarInfo &v = global->global[name];
+			for (vector<NativeFunc>::iterator it = natives.begin(); it != natives.end(); ++it)
 			{
-				int j = (*it)->run(this);
-				if (j)
-					it += j;
-				if (status == Function::Return)
+				if (it->address == v.address)
 				{
+					natives.erase(it);
 					break;
 				}
-				if (status == Function::Call)
-				{
-					pushLine(++it - c.begin());
-					status = Function::Start;
-					return Function::Call;
-				}
 			}
-			status = Function::Start;
-			LeaveFunction();
-			r.leave();
-			return Function::Return;
-		}
-		void runInit(const string &name)
-		{
-			r.stack.reserve(0x1000);
-			r.stack.resize(0x100);
-			runFunction(name);
-			//*Global(ns_context.back()->global[name].address) = r.ret;
-			//初期化用関数の最後にset_globalがあるのでいらない、というか、こうするならするで、set_returnが必要
-		}
-		void runFunction(const string &name)
-		{
-			ns_context.back()->function[name]->call(this);
-			runContext();
+			NativeFunc n;
+			n.address = v.address;
+			n.func = func;
+			n.args = v.type->getASize();
+			n.thunk = 0;
+			n.tiered = 0;
+			n.invoke = invoke;
+			natives.push_back(n);
+			*Global(v.address) = (int)(size_t)func;
+			return true;
 		}
-		void runContext()
-		{
-			int l = 0;
-			pushLine(-1);
-			while (l != -1)
+		// グローバル変数の初期化を実行する、溢れて最後まで行けなかったらfalse
+		bool runInit(const string &name);
+		// 実行をバイトコードの方でやる
+		void useBytecode(bool b = true){use_bytecode = b;}
+		bool usingBytecode(){return use_bytecode;}
+		// JITで一時変数をレジスタに置く、gen()の前に
+		void useRegister(bool b = true){use_register = b;}
+		bool usingRegister(){return use_register;}
+		// JITでグローバル変数をediからの距離で触る、gen()の前に
+		// 1回作ったコードを、グローバル変数だけ別々に持つInstanceで実行する
+		void useInstance(bool b = true){use_instance = b;}
+		bool usingInstance(){return use_instance;}
+		// JITしたコードでも燃料を数える(後ろに飛ぶ所と関数の頭で1つ減らす)、gen()の前に
+		// 燃料はグローバル変数の後ろに置くので、NativeDataかInstanceのsetFuel()で入れる
+		void useFuel(bool b = true)
+		{
+			if (b && fuel < 0)
 			{
-				Function::Run r = function_context.back()->run(this, l);
-				if (r == Function::Return)
-				{
-					l = popLine();
-				}
-				else if (r == Function::Call)
+				fuel = globalsize + 4;
+				globalsize += 8;
+				native->global.resize(globalsize);
+				*Global(fuel) = 0x7FFFFFFF;
+			}
+			use_fuel = b;
+		}
+		bool usingFuel(){return use_fuel;}
+		// 段を上げる、中間言語で始めて、呼んだ回数と後ろに飛んだ回数がthresholdを超えた関数は次からJITした方で呼ぶ
+		// JITは最初に超えた時に全部の関数をまとめて一度だけ、グローバル変数は中間言語と同じ場所を使う
+		// 関数を値として作るスクリプトは値が中間言語とJITで違うので上げない、0なら上げない
+		// 上げる時にEnvironmentを書き換えるので、別のスレッドから同時に実行するなら使わない
+		// JITしたコードは別に持つので、先にgen()したNativeはそのまま使える
+		void useTiered(int threshold = 1000){tier_threshold = threshold;}
+		int tieredThreshold(){return tier_threshold;}
+		void addFunctionValue(){function_value = true;}
+		// 段を上げる時のコード、作れなかったら空
+		Native tiered()
+		{
+			if (tier_tried)
+				return tier;
+			tier_tried = true;
+			if (function_value)
+				return NULL;
+			// gen()はnativeに作るので、その間だけ別のに差し替える
+			Native keep = native;
+			native = new NativeData();
+			native->global = keep->global;
+			native->global_address = keep->global_address;
+			bool instance = use_instance;
+			use_instance = true;
+			tier = gen();
+			use_instance = instance;
+			native = keep;
+		#ifdef NES_X64
+			// 中間言語の方のグローバル変数で動かすので、Cの関数はJITから呼ぶ出口に置き換える
+			if (tier)
+			{
+				for (vector<NativeFunc>::iterator it = natives.begin(); it != natives.end(); ++it)
 				{
-					l = 0;
+					it->tiered = tier->code_base + it->thunk;
+					*Global(it->address) = it->tiered;
 				}
 			}
-		}
-		vector<int> linestack;
-		void pushLine(int l){linestack.push_back(l);}
-		int popLine(){int l = linestack.back();linestack.pop_back();return l;}
-		struct
-		{
-			int ret;
-			vector<NativeData::byte> stack;
-			vector<int> local_base;
-			vector<int> arg_base;
-			void enter(int size)
-			{
-				int s = stack.size() + 4;
-				arg_base.push_back(s);
-				stack.resize(s + size);
-				local_base.push_back(s + size);
-			}
-			void leave()
-			{
-				stack.resize(arg_base.back() - 4);
-				arg_base.pop_back();
-				local_base.pop_back();
-			}
-			int *Stack(int s)
-			{
-				if (s < 0)
-					return (int*)&stack[local_base.back() + s];
-				else
-					return (int*)&stack[arg_base.back() - s];
-			}
-			int &StackTop(int s = 0){return *(int*)&stack[stack.size() - s*4];}
-			void Push(int i)		{stack.resize(stack.size() + 4);StackTop(1) = i;}
-			void Pop(int i)			{stack.resize(stack.size() - i);}
-		} r;
-		int *Global(int a)		{return (int*)&native->global[a];}
-	private:
-		int errors;
-		typedef std::map<string, shptr<Function> > Funcs;
-		int globalsize;
-		std::map<string, int> string_table;
-
-		struct NameSpace
+		#endif
+			return tier;
+		}
+		// 中間言語のコピー伝播と要らない一時変数の削除と一時変数の場所の使い回し、関数を作る前に
+		void useOptimize(bool b = true){use_optimize = b;}
+		bool usingOptimize(){return use_optimize;}
+		// 中間言語がsize個以下の葉関数を呼び出し元に展開する、1つの関数に展開するのは合計budget個まで
+		// useOptimize()してない時はしない
+		void useInline(int budget, int size = 16){inline_budget = budget;inline_size = size;}
+		typedef std::pair<string, string> Inlined;	// 展開した先と展開した関数
+		const vector<Inlined> &getInlined(){return inlined;}
+		int *Global(int a)		{return (int*)&native->global[a];}
+	private:
+		int errors;
+		typedef std::map<string, shptr<Function> > Funcs;
+		int globalsize;
+		std::map<string, int> string_table;
+
+		struct NameSpace
 		{
 			var_table global;
 			std::map<string, VType> types;
@@ -878,13 +1825,14 @@ namespace IL
 				{
 					vi.atype = ValueInfo::function;
 					vi.type = function[name]->getFuncPtr();
-					vi.address = (int)(function[name].get());
+					vi.address = (int)(size_t)(function[name].get());
+					vi.object = function[name].get();
 					return vi;
 				}
 				else if (ns.count(name))
 				{
 					vi.atype = ValueInfo::NameSpace;
-					vi.address = (int)(ns[name].get());
+					vi.address = (int)(size_t)(ns[name].get());
 					env->last_ns = ns[name];
 					return vi;
 				}
@@ -938,13 +1886,693 @@ namespace IL
 				gen_ns(it->second);
 			}
 		}
+		// Cから呼ぶ入口は関数ごと、Cの関数を呼ぶ出口はCの関数ごと
+		// stackはスクリプト用のスタックの底
+		// x86は入口も出口も要らないけど、インスタンス用か燃料を数える時は入口を置く
+		// 燃料が切れた時に飛ぶ所は関数の後ろすぐ
+		void gen_thunk(vector<NativeData::byte> &c, int stack)
+		{
+			if (use_fuel)
+			{
+				exit_address = c.size();
+				cpu::exit_thunk(c, ThunkMem(fuel - 4), use_instance);
+			}
+			gen_entry(c, global, stack);
+		#ifdef NES_X64
+			for (vector<NativeFunc>::iterator it = natives.begin(); it != natives.end(); ++it)
+			{
+				it->thunk = c.size();
+				cpu::native_thunk(c, it->func, it->args, it->invoke.floats, it->invoke.ret);
+			}
+		#endif
+		}
+		void gen_entry(vector<NativeData::byte> &c, shptr<NameSpace> ns, int stack)
+		{
+			for (Funcs::iterator it = ns->function.begin(); it != ns->function.end(); ++it)
+			{
+				Function *f = it->second.get();
+				int exit = use_fuel ? ThunkMem(fuel - 4) : 0;
+				native->function_address[it->first] = c.size();
+				if (use_instance)
+					native->entry[f->getHandle() - 1] = c.size();
+			#ifdef NES_X64
+				if (use_instance)
+					cpu::instance_thunk(c, f->getAddress(), f->getArgs(), f->getFloats(), f->returnsFloat(), exit, use_fuel);
+				else
+					cpu::entry_thunk(c, f->getAddress(), f->getArgs(), f->getFloats(), f->returnsFloat(), stack, exit, use_fuel);
+			#else
+				cpu::entry_thunk(c, f->getAddress(), f->getArgs(), use_instance, exit, use_fuel);
+			#endif
+			}
+			for (std::map<string, shptr<NameSpace> >::iterator it = ns->ns.begin(); it != ns->ns.end(); ++it)
+			{
+				gen_entry(c, it->second, stack);
+			}
+		}
 
 		vector<shptr<Function> > function_context;
 
+		// Cの関数、グローバル変数に関数ポインタとして置かれる
+		struct NativeFunc
+		{
+			int address;
+			const void *func;
+			int args;
+			int thunk;
+			int tiered;		// 段を上げた後にグローバル変数に置いてある出口の番地
+			Invoke invoke;	// 中間言語実行から呼ぶ時の型
+		};
+		vector<NativeFunc> natives;
+		vector<Function*> callee;
+
 		Native native;
+		bool use_bytecode;
+		bool use_register;
+		bool use_instance;
+		bool use_fuel;
+		int fuel;			// 燃料を置いたグローバル変数、その前に燃料が切れた時に戻る所
+		int exit_address;	// 燃料が切れた時に飛ぶ所(コードの先頭からの位置)
+		int tier_threshold;
+		bool tier_tried;
+		bool function_value;	// 関数を値にする所がある
+		Native tier;
+		bool use_optimize;
+		int inline_size;
+		int inline_budget;
+		vector<Inlined> inlined;
+		int stack_size;
+		shptr<ExecutionContext> context;	// run()とcall()で使う
 	};
 	typedef Environment::Function Function;
 
+	template<class F> struct Handle
+	{
+		Handle() : func(NULL), entry(NULL){}
+		operator bool() const{return func != NULL;}
+		bool operator!() const{return !func;}
+		Function *func;
+		F *entry;	// JITしたコードの入口、NULLなら中間言語で実行
+	};
+
+	// 実行中の状態(スタックと呼び出しの途中)、スレッドごとに1つ作る
+	// コンパイルし終わったEnvironmentは実行で書き換わらないので、別々のExecutionContextからなら同時に呼んでいい
+	// グローバル変数はCと同じく全部のスレッドで共有
+	class ExecutionContext : public Caller<ExecutionContext>
+	{
+	public:
+		typedef Environment::Code Code;
+		typedef Environment::NativeData::byte byte;
+		ExecutionContext(Environment *e) : env(e)
+		{
+			status = Function::Start;
+			fault = NULL;
+			fuel = -1;
+			exhausted = false;
+			r.capacity = e->getStackSize();
+			r.ret = 0;
+		}
+		// 中間言語実行時のスタックの大きさ、実行前に
+		void setStackSize(int size)	{r.capacity = size;}
+		int run()
+		{
+			r.reset();
+			runFunction("main");
+			return r.ret;
+		}
+		int call(const string &name, int a1 = 0, int a2 = 0, int a3 = 0, int a4 = 0, int a5 = 0, int a6 = 0, int a7 = 0, int a8 = 0,
+									int a9 = 0, int a10 = 0, int a11 = 0, int a12 = 0, int a13 = 0, int a14 = 0, int a15 = 0, int a16 = 0)
+		{
+			// 呼ぶ関数の引数の分だけ置く
+			Environment::Funcs::iterator it = env->global->function.find(name);
+			if (it == env->global->function.end())
+				return 0;
+			const int a[Invoke::MaxArgs] = {a1, a2, a3, a4, a5, a6, a7, a8, a9, a10, a11, a12, a13, a14, a15, a16};
+			return invoke(it->second, a, std::min(it->second->getArgs(), (int)Invoke::MaxArgs));
+		}
+		using Caller<ExecutionContext>::call;
+		// 引数をn個置いて中間言語で実行する
+		int invoke(Function *f, const int *a, int n)
+		{
+			r.reset();
+			for (int i = 0; i < n; i++)
+				r.StackTop(i + 1) = a[i];
+			runFunction(f);
+			return r.ret;
+		}
+		int *Global(int a)	{return env->Global(a);}
+		Function *Callee(int v)	{return env->Callee(v);}
+		// Cの関数ならスタックに積んである引数で呼んで、戻り値をr.retに置く
+		// Cの関数でなければfalse
+		bool callNative(int v)
+		{
+			for (vector<Environment::NativeFunc>::iterator it = env->natives.begin(); it != env->natives.end(); ++it)
+			{
+				// 段を上げた後はJITから呼ぶ出口の番地になってる
+				if ((int)(size_t)it->func == v || (it->tiered && it->tiered == v))
+				{
+					r.ret = it->invoke(it->func, &r.StackTop(1));
+					return true;
+				}
+			}
+			return false;
+		}
+		void EnterFunction(Function *f)	{frames.push_back(f);}
+		void LeaveFunction()			{frames.pop_back();}
+		Function::Run status;
+		const char *fault;	// 実行を止めた理由
+		// 燃料、後ろに飛ぶ所と関数に入る所で1つ減らして、切れたら止めてfalseを返す
+		// 負なら数えない、exhaustedは切れて止まった時にtrue
+		void setFuel(int f)	{fuel = f;}
+		int getFuel()		{return fuel;}
+		bool exhausted;
+		// 後ろに飛ぶ所、段を上げる方の回数も数える
+		bool backEdge()
+		{
+			if (!heat.empty() && heat[frames.back()->getHandle() - 1] >= 0)
+				heat[frames.back()->getHandle() - 1]++;
+			return burn();
+		}
+		// 段を上げた関数ならJITした方をスタックに積んである引数で呼んで、戻り値をr.retに置く
+		// まだ中間言語で実行する関数ならfalse
+		bool callTiered(Function *f);
+		bool burn()
+		{
+			if (fuel < 0 || fuel-- > 0)
+				return true;
+			fuel = 0;
+			fault = "out of fuel";
+			exhausted = true;
+			return false;
+		}
+		Function::Run runCode(Code &c, int start)
+		{
+			for (Code::iterator it = c.begin() + start; it != c.end(); ++it)
+			{
+				int j = (*it)->run(this);
+				if (j)
+				{
+					// 後ろに飛ぶ所で燃料を減らす
+					if (j < 0 && !backEdge())
+						return Function::End;
+					it += j;
+				}
+				if (status == Function::Return)
+				{
+					break;
+				}
+				if (status == Function::End)
+				{
+					// スタックが溢れた
+					return Function::End;
+				}
+				if (status == Function::Call)
+				{
+					pushLine(++it - c.begin());
+					status = Function::Start;
+					return Function::Call;
+				}
+			}
+			status = Function::Start;
+			LeaveFunction();
+			r.leave();
+			return Function::Return;
+		}
+		bool runFunction(const string &name)
+		{
+			Environment::Funcs::iterator it = env->global->function.find(name);
+			if (it == env->global->function.end())
+			{
+				std::printf("IL error: %s not found\n", name.c_str());
+				return false;
+			}
+			return runFunction(it->second);
+		}
+		// 溢れたり止まったりして最後まで行けなかったらfalse
+		bool runFunction(Function *f)
+		{
+			int fc = frames.size();
+			int lc = linestack.size();
+			fault = NULL;
+			exhausted = false;
+			if (callTiered(f))
+				return true;
+			if (f->call(this))
+			{
+				if (env->usingBytecode())
+					runBytecode();
+				else
+					runContext();
+			}
+			if (r.overflow)
+				fault = "stack overflow";
+			if (fault)
+			{
+				// 途中の関数は全部捨てる
+				// 実行時のエラーなのでerrorsには数えない(数えるとgen()出来なくなる)
+				// 燃料切れは呼んだ側が決めた止め方なので言わない
+				if (!exhausted)
+					std::printf("IL error: %s\n", fault);
+				frames.resize(fc);
+				linestack.resize(lc);
+				status = Function::Start;
+				r.reset();
+				r.ret = 0;
+				return false;
+			}
+			return true;
+		}
+		void runContext()
+		{
+			int l = 0;
+			pushLine(-1);
+			while (l != -1)
+			{
+				Function::Run r = frames.back()->run(this, l);
+				if (r == Function::Return)
+				{
+					l = popLine();
+				}
+				else if (r == Function::Call)
+				{
+					l = 0;
+				}
+				else
+				{
+					break;
+				}
+			}
+		}
+		void runBytecode()
+		{
+			const int *code = frames.back()->Bytecode();
+			const int *pc = code;
+			byte *g = (byte*)env->Global(0);
+			byte *fp = &r.stack[r.ab];
+			pushLine(-1);
+#define S(i) ((int*)(fp + (i)))
+#define G(i) ((int*)(g + (i)))
+#define M(i) ((int*)(size_t)*S(i))
+			for (;;)
+			{
+				switch (*pc)
+				{
+				case BC::getFunction:	*S(pc[1]) = pc[2];										pc += 3;break;
+				case BC::getGlobal:		*S(pc[1]) = *G(pc[2]);									pc += 3;break;
+				case BC::getMemory:		*S(pc[1]) = *M(pc[2]);									pc += 3;break;
+				case BC::getGlobalPtr:	*S(pc[1]) = (int)(size_t)G(pc[2]);							pc += 3;break;
+				case BC::getLocalPtr:	*S(pc[1]) = (int)(size_t)S(pc[2]);							pc += 3;break;
+				case BC::getInt:		*S(pc[1]) = pc[2];										pc += 3;break;
+				case BC::getChar:		*(char*)S(pc[1]) = (char)pc[2];							pc += 3;break;
+				case BC::getFloat:		*S(pc[1]) = pc[2];										pc += 3;break;
+
+				case BC::incL:			++*S(pc[1]);											pc += 2;break;
+				case BC::incG:			++*G(pc[1]);											pc += 2;break;
+				case BC::incM:			++*M(pc[1]);											pc += 2;break;
+				case BC::cincL:			++*(char*)S(pc[1]);										pc += 2;break;
+				case BC::cincG:			++*(char*)G(pc[1]);										pc += 2;break;
+				case BC::cincM:			++*(char*)M(pc[1]);										pc += 2;break;
+				case BC::pincL:			*S(pc[1]) += pc[2];										pc += 3;break;
+				case BC::pincG:			*G(pc[1]) += pc[2];										pc += 3;break;
+				case BC::pincM:			*M(pc[1]) += pc[2];										pc += 3;break;
+				case BC::decL:			--*S(pc[1]);											pc += 2;break;
+				case BC::decG:			--*G(pc[1]);											pc += 2;break;
+				case BC::decM:			--*M(pc[1]);											pc += 2;break;
+				case BC::cdecL:			--*(char*)S(pc[1]);										pc += 2;break;
+				case BC::cdecG:			--*(char*)G(pc[1]);										pc += 2;break;
+				case BC::cdecM:			--*(char*)M(pc[1]);										pc += 2;break;
+				case BC::pdecL:			*S(pc[1]) -= pc[2];										pc += 3;break;
+				case BC::pdecG:			*G(pc[1]) -= pc[2];										pc += 3;break;
+				case BC::pdecM:			*M(pc[1]) -= pc[2];										pc += 3;break;
+
+				case BC::minus:			*S(pc[1]) = -*S(pc[2]);									pc += 3;break;
+				case BC::fminus:		*(float*)S(pc[1]) = -*(float*)S(pc[2]);					pc += 3;break;
+				case BC::Not:			*S(pc[1]) = !*(char*)S(pc[2]);							pc += 3;break;
+				case BC::Compl:			*(dword*)S(pc[1]) = ~*(dword*)S(pc[2]);					pc += 3;break;
+
+#define NES_BC_TERNARY(op, T, o) case BC::op: *(T*)S(pc[1]) = *(T*)S(pc[2]) o *(T*)S(pc[3]); pc += 4;break;
+				NES_BC_TERNARY(iadd, int, +)
+				NES_BC_TERNARY(fadd, float, +)
+				NES_BC_TERNARY(isub, int, -)
+				NES_BC_TERNARY(fsub, float, -)
+				NES_BC_TERNARY(imul, int, *)
+				NES_BC_TERNARY(fmul, float, *)
+				NES_BC_TERNARY(idiv, int, /)
+				NES_BC_TERNARY(fdiv, float, /)
+				NES_BC_TERNARY(imod, int, %)
+				NES_BC_TERNARY(ishl, int, <<)
+				NES_BC_TERNARY(ishr, int, >>)
+				NES_BC_TERNARY(ushr, dword, >>)
+				NES_BC_TERNARY(iand, dword, &)
+				NES_BC_TERNARY(ior, dword, |)
+				NES_BC_TERNARY(ixor, dword, ^)
+				NES_BC_TERNARY(ilt, int, <)
+				NES_BC_TERNARY(ult, dword, <)
+				NES_BC_TERNARY(clt, char, <)
+				NES_BC_TERNARY(ile, int, <=)
+				NES_BC_TERNARY(ule, dword, <=)
+				NES_BC_TERNARY(cle, char, <=)
+				NES_BC_TERNARY(igt, int, >)
+				NES_BC_TERNARY(ugt, dword, >)
+				NES_BC_TERNARY(cgt, char, >)
+				NES_BC_TERNARY(ige, int, >=)
+				NES_BC_TERNARY(uge, dword, >=)
+				NES_BC_TERNARY(cge, char, >=)
+				NES_BC_TERNARY(ieq, int, ==)
+				NES_BC_TERNARY(ceq, char, ==)
+				NES_BC_TERNARY(ine, int, !=)
+				NES_BC_TERNARY(cne, char, !=)
+#undef NES_BC_TERNARY
+
+				case BC::assign:		*S(pc[1]) = *S(pc[2]);									pc += 3;break;
+				case BC::cassign:		*(char*)S(pc[1]) = *(char*)S(pc[2]);					pc += 3;break;
+				case BC::set_global:	*G(pc[1]) = *S(pc[2]);									pc += 3;break;
+				case BC::cset_global:	*(char*)G(pc[1]) = *(char*)S(pc[2]);					pc += 3;break;
+				case BC::set_memory:	*M(pc[1]) = *S(pc[2]);									pc += 3;break;
+				case BC::cset_memory:	*(char*)M(pc[1]) = *(char*)S(pc[2]);					pc += 3;break;
+
+				case BC::set_return:	r.ret = *S(pc[1]);										pc += 2;break;
+				case BC::push:			if (!r.Push(*S(pc[1]))) return;	pc += 2;break;
+				case BC::pop_arg:		r.Pop(pc[1]);											pc += 2;break;
+				case BC::get_return:	*S(pc[1]) = r.ret;										pc += 2;break;
+				case BC::call:
+					{
+						Function *f = NULL;
+						if (callNative(*S(pc[2])))
+							pc += 3;
+						else if ((f = env->Callee(*S(pc[2]))) && callTiered(f))
+							pc += 3;
+						else
+						{
+							// 戻り先を積んで呼ばれた関数の頭から
+							pushLine(pc + 3 - code);
+							if (!f)
+							{
+								fault = "call unknown function";
+								return;
+							}
+							if (!f->call(this))
+								return;
+							code = frames.back()->Bytecode();
+							pc = code;
+							fp = &r.stack[r.ab];
+						}
+					}
+					break;
+				case BC::call_direct:
+					{
+						// 呼ぶ関数は決まってるので、値を見ないでそのまま入る
+						Function *f = env->Callee(pc[1]);
+						if (callTiered(f))
+						{
+							pc += 2;
+							break;
+						}
+						pushLine(pc + 2 - code);
+						if (!f->call(this))
+							return;
+						code = frames.back()->Bytecode();
+						pc = code;
+						fp = &r.stack[r.ab];
+					}
+					break;
+
+				case BC::jump_true:		pc = *(char*)S(pc[1]) ? code + pc[2] : pc + 3;			break;
+				case BC::jump_false:	pc = *(char*)S(pc[1]) ? pc + 3 : code + pc[2];			break;
+				case BC::jump:			pc = code + pc[1];										break;
+				case BC::loop:			if (!backEdge()) return;	pc = code + pc[1];			break;
+				case BC::fuel:			if (!backEdge()) return;	pc += 1;					break;
+
+#define NES_BC_JUMP(op, T, o) case BC::op: pc = *(T*)S(pc[1]) o *(T*)S(pc[2]) ? code + pc[3] : pc + 4;break;
+				NES_BC_JUMP(jilt, int, <)
+				NES_BC_JUMP(jult, dword, <)
+				NES_BC_JUMP(jclt, char, <)
+				NES_BC_JUMP(jile, int, <=)
+				NES_BC_JUMP(jule, dword, <=)
+				NES_BC_JUMP(jcle, char, <=)
+				NES_BC_JUMP(jigt, int, >)
+				NES_BC_JUMP(jugt, dword, >)
+				NES_BC_JUMP(jcgt, char, >)
+				NES_BC_JUMP(jige, int, >=)
+				NES_BC_JUMP(juge, dword, >=)
+				NES_BC_JUMP(jcge, char, >=)
+				NES_BC_JUMP(jieq, int, ==)
+				NES_BC_JUMP(jceq, char, ==)
+				NES_BC_JUMP(jine, int, !=)
+				NES_BC_JUMP(jcne, char, !=)
+#undef NES_BC_JUMP
+
+				case BC::Return:
+				case BC::end:
+					{
+						LeaveFunction();
+						r.leave();
+						int l = popLine();
+						if (l == -1)
+							return;
+						code = frames.back()->Bytecode();
+						pc = code + l;
+						fp = &r.stack[r.ab];
+					}
+					break;
+				}
+			}
+#undef S
+#undef G
+#undef M
+		}
+		vector<int> linestack;
+		void pushLine(int l){linestack.push_back(l);}
+		int popLine(){int l = linestack.back();linestack.pop_back();return l;}
+		struct
+		{
+			int ret;
+			// 最初に確保したら伸ばさない、なのでgetLocalPtrで取ったアドレスはずっと有効
+			Bytes stack;
+			int capacity;
+			int sp;			// 使ってる一番上
+			int ab;			// 今の関数の引数の基点
+			int lb;			// 今の関数のローカル変数の基点
+			bool overflow;
+			vector<int> local_base;
+			vector<int> arg_base;
+			void reset()
+			{
+				if ((int)stack.size() != capacity)
+					stack.assign(capacity, 0);
+				sp = 0x100;
+				ab = lb = 0;
+				overflow = false;
+				local_base.clear();
+				arg_base.clear();
+			}
+			bool enter(int size)
+			{
+				int s = sp + 4;
+				if (s + size > capacity)
+				{
+					overflow = true;
+					return false;
+				}
+				std::memset(&stack[s], 0, size);
+				arg_base.push_back(ab = s);
+				local_base.push_back(lb = s + size);
+				sp = lb;
+				return true;
+			}
+			void leave()
+			{
+				sp = ab - 4;
+				arg_base.pop_back();
+				local_base.pop_back();
+				ab = arg_base.empty() ? 0 : arg_base.back();
+				lb = local_base.empty() ? 0 : local_base.back();
+			}
+			int *Stack(int s)
+			{
+				if (s < 0)
+					return (int*)&stack[lb + s];
+				else
+					return (int*)&stack[ab - s];
+			}
+			// 置いてある値を番地として読む、スクリプトの番地は64bitでも下位2GBにあるので32bitで足りる
+			int *Memory(int s){return (int*)(size_t)*Stack(s);}
+			int &StackTop(int s = 0){return *(int*)&stack[sp - s*4];}
+			bool Push(int i)
+			{
+				if (sp + 4 > capacity)
+				{
+					overflow = true;
+					return false;
+				}
+				sp += 4;
+				StackTop(1) = i;
+				return true;
+			}
+			void Pop(int i)			{sp -= i;}
+		} r;
+	private:
+		Environment *env;
+		vector<Function*> frames;	// 呼び出し中の関数
+		int fuel;
+		vector<int> heat;	// 段を上げる方で関数ごとに数えた回数、上げたら-1
+	};
+
+	inline Environment::Function::Run Environment::Function::run(ExecutionContext *cx, int start)
+	{
+		return cx->runCode(code, start);
+	}
+	inline bool Environment::Function::call(ExecutionContext *cx)
+	{
+		if (!cx->burn())
+			return false;
+		cx->EnterFunction(this);
+		return cx->r.enter(localstack+maxstack);
+	}
+	inline ExecutionContext &Environment::Context()
+	{
+		if (!context)
+			context = new ExecutionContext(this);
+		return *context;
+	}
+	inline void Environment::setStackSize(int size)
+	{
+		stack_size = size;
+		if (context)
+			context->setStackSize(size);
+	}
+	inline int Environment::run(int argc, char **argv)
+	{
+		return Context().run();
+	}
+	inline int Environment::call(const string &name, int a1, int a2, int a3, int a4, int a5, int a6, int a7, int a8,
+									int a9, int a10, int a11, int a12, int a13, int a14, int a15, int a16)
+	{
+		return Context().call(name, a1, a2, a3, a4, a5, a6, a7, a8, a9, a10, a11, a12, a13, a14, a15, a16);
+	}
+	inline int Environment::invoke(Function *f, const int *a, int n)
+	{
+		return Context().invoke(f, a, n);
+	}
+	inline bool Environment::runInit(const string &name)
+	{
+		Funcs::iterator it = ns_context.back()->function.find(name);
+		if (it == ns_context.back()->function.end())
+			return false;
+		ExecutionContext &cx = Context();
+		cx.r.reset();
+		return cx.runFunction(it->second);
+		//*Global(ns_context.back()->global[name].address) = r.ret;
+		//初期化用関数の最後にset_globalがあるのでいらない、というか、こうするならするで、set_returnが必要
+	}
+
+#ifdef NES_X64
+	// インスタンスを実行するスタック、スレッドごとに下位2GBに取ってスレッドが終わったら返す
+	class ThreadStack
+	{
+	public:
+		static int top(int size)
+		{
+			pthread_once(&once(), create);
+			Bytes *s = (Bytes*)pthread_getspecific(key());
+			if (!s || (int)s->size() < size)
+			{
+				delete s;
+				s = new Bytes(size);
+				pthread_setspecific(key(), s);
+			}
+			return (int)(size_t)(&(*s)[0] + s->size());
+		}
+	private:
+		static pthread_key_t &key(){static pthread_key_t k;return k;}
+		static pthread_once_t &once(){static pthread_once_t o = PTHREAD_ONCE_INIT;return o;}
+		static void create(){pthread_key_create(&key(), release);}
+		static void release(void *p){delete (Bytes*)p;}
+	};
+#endif
+
+	// useInstance()して作った入口を呼ぶ、入口はf(global, stack, 引数...)なので前に2つ足してCの関数と同じく呼ぶ
+	// 呼べなかったらfalse
+	inline bool enterInstance(Environment::Native native, Function *f, int global, const int *a, int n, int &ret)
+	{
+		if (!native->instance || !native->exec || n + 2 > Invoke::MaxArgs)
+			return false;
+		int args[Invoke::MaxArgs];
+		int *top = &args[n + 1];	// 上から下に読まれる
+		top[0] = global;
+	#ifdef NES_X64
+		top[-1] = ThreadStack::top(native->stack_size);
+	#else
+		top[-1] = 0;
+	#endif
+		for (int i = 0; i < n; i++)
+			top[-2 - i] = a[i];
+		// floatを返す入口もeaxに残してあるのでintで受ける
+		ret = Invoke(n + 2, f->getFloats() << 2)(native->exec + native->entry[f->getHandle() - 1], top);
+		return true;
+	}
+	inline bool ExecutionContext::callTiered(Function *f)
+	{
+		// 燃料を入れてる時は中間言語の方で数える
+		int threshold = env->tieredThreshold();
+		if (threshold <= 0 || fuel >= 0)
+			return false;
+		if (heat.size() != env->callee.size())
+			heat.resize(env->callee.size(), 0);
+		int &h = heat[f->getHandle() - 1];
+		if (h >= 0)
+		{
+			if (++h < threshold)
+				return false;
+			h = -1;
+		}
+		Environment::Native n = env->tiered();
+		if (!n || f->getArgs() > Invoke::MaxArgs)
+			return false;
+		int a[Invoke::MaxArgs];
+		for (int i = 0; i < f->getArgs(); i++)
+			a[i] = r.StackTop(i + 1);
+		return enterInstance(n, f, (int)(size_t)env->Global(0), a, f->getArgs(), r.ret);
+	}
+
+	// useInstance()してgen()したコードを実行する単位、持つのは初期化が終わった時のグローバル変数のコピーだけ
+	// コードは同じNativeを使うので、インスタンスを増やしてもグローバル変数の分しか増えない
+	// 別々のインスタンスなら別のスレッドから同時に呼んでいい(Nativeを持つので作るのはスレッドを作る前に)
+	class Instance : public Caller<Instance>
+	{
+	public:
+		typedef Environment::Native Native;
+		Instance(Native n) : native(n), global(n->image()){}
+		// グローバル変数の場所、無ければNULL
+		int *get(const string &name)
+		{
+			std::map<string, int>::iterator it = native->global_address.find(name);
+			return it == native->global_address.end() ? NULL : (int*)&global[it->second];
+		}
+		int *Global(int a)	{return (int*)&global[a];}
+		int size()			{return global.size();}
+		// 初期化が終わった時に戻す、リクエストごとに状態を捨てる時とか
+		void reset()
+		{
+			if (!global.empty())
+				std::memcpy(&global[0], &native->image()[0], global.size());
+		}
+		Snapshot snapshot()					{return takeSnapshot(global, global.size());}
+		bool restore(const Snapshot &s)		{return restoreSnapshot(global, s);}
+		// 燃料、useFuel()して作った時だけ
+		void setFuel(int f)	{if (native->fuel >= 0) *Global(native->fuel) = f;}
+		int getFuel()		{return native->fuel >= 0 ? *Global(native->fuel) : 0;}
+		bool exhausted()	{return getFuel() < 0;}
+		int invoke(Function *f, const int *a, int n)
+		{
+			int r = 0;
+			enterInstance(native, f, global.empty() ? 0 : (int)(size_t)&global[0], a, n, r);
+			return r;
+		}
+	private:
+		Native native;
+		Bytes global;
+	};
+
 	struct binary : opcode
 	{
 		binary(int t, int a) : to(t), address(a){}
@@ -959,14 +2587,24 @@ namespace IL
 			to = t;
 			func = f;
 		}
-		int getSize(){return 10;}
+		opcode *clone(){return new getFunction(*this);}
+		Function *getFunc(){return func;}
+		void resolve(Environment *env){env->addFunctionValue();}
 		void gen(Environment *env)
 		{
-			x86::mov_stack_int(env->Codes(), to, env->CodeBase() + func->getAddress());
+			env->setStack(to, env->CodeBase() + func->getAddress());
+		}
+		void lower(Environment *env)
+		{
+			env->emit(BC::getFunction, env->slot(to), func->getHandle());
 		}
-		int run(Environment *env)
+		void operands(Operands &o)
 		{
-			*env->r.Stack(to) = (int)func;
+			o.push_back(Operand(&to, Operand::Write));
+		}
+		int run(ExecutionContext *cx)
+		{
+			*cx->r.Stack(to) = func->getHandle();
 			return 0;
 		}
 	private:
@@ -976,61 +2614,95 @@ namespace IL
 	struct getGlobal : binary
 	{
 		getGlobal(int t, int a) : binary(t, a){}
-		int getSize(){return 11;}
+		opcode *clone(){return new getGlobal(*this);}
 		void gen(Environment *env)
 		{
-			x86::mov_eax_mem(env->Codes(), env->GlobalBase() + address);
-			x86::mov_stack_eax(env->Codes(), to);
+			env->loadGlobal(address);
+			env->storeReg(to, cpu::eax);
+		}
+		void lower(Environment *env)
+		{
+			env->emit(BC::getGlobal, env->slot(to), address);
+		}
+		void operands(Operands &o)
+		{
+			o.push_back(Operand(&to, Operand::Write));
 		}
-		int run(Environment *env)
+		int run(ExecutionContext *cx)
 		{
-			*env->r.Stack(to) = *env->Global(address);
+			*cx->r.Stack(to) = *cx->Global(address);
 			return 0;
 		}
 	};
 	struct getMemory : binary
 	{
 		getMemory(int t, int a) : binary(t, a){}
-		int getSize(){return 14;}
+		opcode *clone(){return new getMemory(*this);}
 		void gen(Environment *env)
 		{
-			x86::mov_ecx_stack(env->Codes(), address);
-			x86::mov_eax_ecx(env->Codes());
-			x86::mov_stack_eax(env->Codes(), to);
+			env->loadReg(cpu::ecx, address);
+			cpu::mov_eax_ecx(env->Codes());
+			env->storeReg(to, cpu::eax);
+		}
+		void lower(Environment *env)
+		{
+			env->emit(BC::getMemory, env->slot(to), env->slot(address));
 		}
-		int run(Environment *env)
+		void operands(Operands &o)
 		{
-			*env->r.Stack(to) = *(int*)(*env->r.Stack(address));
+			o.push_back(Operand(&to, Operand::Write));
+			o.push_back(Operand(&address, Operand::Read));
+		}
+		int run(ExecutionContext *cx)
+		{
+			*cx->r.Stack(to) = *cx->r.Memory(address);
 			return 0;
 		}
 	};
 	struct getGlobalPtr : binary
 	{
 		getGlobalPtr(int t, int a) : binary(t, a){}
-		int getSize(){return 12;}
+		opcode *clone(){return new getGlobalPtr(*this);}
 		void gen(Environment *env)
 		{
-			x86::lea_eax_mem(env->Codes(), env->GlobalBase() + address);
-			x86::mov_stack_eax(env->Codes(), to);
+			env->addressGlobal(address);
+			env->storeReg(to, cpu::eax);
 		}
-		int run(Environment *env)
+		void lower(Environment *env)
 		{
-			*env->r.Stack(to) = (int)env->Global(address);
+			env->emit(BC::getGlobalPtr, env->slot(to), address);
+		}
+		void operands(Operands &o)
+		{
+			o.push_back(Operand(&to, Operand::Write));
+		}
+		int run(ExecutionContext *cx)
+		{
+			*cx->r.Stack(to) = (int)(size_t)cx->Global(address);
 			return 0;
 		}
 	};
 	struct getLocalPtr : binary
 	{
 		getLocalPtr(int t, int a) : binary(t, a){}
-		int getSize(){return 12;}
+		opcode *clone(){return new getLocalPtr(*this);}
 		void gen(Environment *env)
 		{
-			x86::lea_eax_stack(env->Codes(), address);
-			x86::mov_stack_eax(env->Codes(), to);
+			cpu::lea_eax_stack(env->Codes(), address);
+			env->storeReg(to, cpu::eax);
+		}
+		void lower(Environment *env)
+		{
+			env->emit(BC::getLocalPtr, env->slot(to), env->slot(address));
 		}
-		int run(Environment *env)
+		void operands(Operands &o)
 		{
-			*env->r.Stack(to) = (int)env->r.Stack(address);
+			o.push_back(Operand(&to, Operand::Write));
+			o.push_back(Operand(&address, Operand::Memory));
+		}
+		int run(ExecutionContext *cx)
+		{
+			*cx->r.Stack(to) = (int)(size_t)cx->r.Stack(address);
 			return 0;
 		}
 	};
@@ -1038,14 +2710,22 @@ namespace IL
 	struct getInt : opcode
 	{
 		getInt(int t, int i) : to(t), x(i){}
-		int getSize(){return 10;}
+		opcode *clone(){return new getInt(*this);}
 		void gen(Environment *env)
 		{
-			x86::mov_stack_int(env->Codes(), to, x);
+			env->setStack(to, x);
+		}
+		void lower(Environment *env)
+		{
+			env->emit(BC::getInt, env->slot(to), x);
+		}
+		void operands(Operands &o)
+		{
+			o.push_back(Operand(&to, Operand::Write));
 		}
-		int run(Environment *env)
+		int run(ExecutionContext *cx)
 		{
-			*env->r.Stack(to) = x;
+			*cx->r.Stack(to) = x;
 			return 0;
 		}
 	private:
@@ -1055,14 +2735,22 @@ namespace IL
 	struct getChar : opcode
 	{
 		getChar(int t, char c) : to(t), x(c){}
-		int getSize(){return 7;}
+		opcode *clone(){return new getChar(*this);}
 		void gen(Environment *env)
 		{
-			x86::mov_stack_char(env->Codes(), to, x);
+			cpu::mov_stack_char(env->Codes(), to, x);
+		}
+		void lower(Environment *env)
+		{
+			env->emit(BC::getChar, env->slot(to), x);
+		}
+		void operands(Operands &o)
+		{
+			o.push_back(Operand(&to, Operand::Write | Operand::Memory | Operand::Byte));
 		}
-		int run(Environment *env)
+		int run(ExecutionContext *cx)
 		{
-			*(char*)env->r.Stack(to) = x;
+			*(char*)cx->r.Stack(to) = x;
 			return 0;
 		}
 	private:
@@ -1072,14 +2760,22 @@ namespace IL
 	struct getFloat : opcode
 	{
 		getFloat(int t, float f) : to(t), x(f){}
-		int getSize(){return 10;}
+		opcode *clone(){return new getFloat(*this);}
 		void gen(Environment *env)
 		{
-			x86::mov_stack_int(env->Codes(), to, *(int*)&x);
+			env->setStack(to, *(int*)&x);
 		}
-		int run(Environment *env)
+		void lower(Environment *env)
 		{
-			*(float*)env->r.Stack(to) = x;
+			env->emit(BC::getFloat, env->slot(to), CValue<float>::from(x));
+		}
+		void operands(Operands &o)
+		{
+			o.push_back(Operand(&to, Operand::Write));
+		}
+		int run(ExecutionContext *cx)
+		{
+			*(float*)cx->r.Stack(to) = x;
 			return 0;
 		}
 	private:
@@ -1096,100 +2792,148 @@ namespace IL
 	struct incL : unary
 	{
 		incL(int t) : unary(t){}
-		int getSize(){return 6;}
+		opcode *clone(){return new incL(*this);}
 		void gen(Environment *env)
 		{
-			x86::inc_stack(env->Codes(), to);
+			env->incStack(to);
+		}
+		void lower(Environment *env)
+		{
+			env->emit(BC::incL, env->slot(to));
 		}
-		int run(Environment *env)
+		void operands(Operands &o)
 		{
-			++*env->r.Stack(to);
+			o.push_back(Operand(&to, Operand::Read | Operand::Write));
+		}
+		int run(ExecutionContext *cx)
+		{
+			++*cx->r.Stack(to);
 			return 0;
 		}
 	};
 	struct incG : unary
 	{
 		incG(int t) : unary(t){}
-		int getSize(){return 6;}
+		opcode *clone(){return new incG(*this);}
 		void gen(Environment *env)
 		{
-			x86::inc_mem(env->Codes(), env->GlobalBase() + to);
+			env->incGlobal(to);
 		}
-		int run(Environment *env)
+		void lower(Environment *env)
 		{
-			++*env->Global(to);
+			env->emit(BC::incG, to);
+		}
+		int run(ExecutionContext *cx)
+		{
+			++*cx->Global(to);
 			return 0;
 		}
 	};
 	struct incM : unary
 	{
 		incM(int t) : unary(t){}
-		int getSize(){return 8;}
+		opcode *clone(){return new incM(*this);}
 		void gen(Environment *env)
 		{
-			x86::mov_ecx_stack(env->Codes(), to);
-			x86::inc_ecx(env->Codes());
+			env->loadReg(cpu::ecx, to);
+			cpu::inc_ecx(env->Codes());
 		}
-		int run(Environment *env)
+		void lower(Environment *env)
 		{
-			++*(int*)(*env->r.Stack(to));
+			env->emit(BC::incM, env->slot(to));
+		}
+		void operands(Operands &o)
+		{
+			o.push_back(Operand(&to, Operand::Read));
+		}
+		int run(ExecutionContext *cx)
+		{
+			++*cx->r.Memory(to);
 			return 0;
 		}
 	};
 	struct cincL : unary
 	{
 		cincL(int t) : unary(t){}
-		int getSize(){return 6;}
+		opcode *clone(){return new cincL(*this);}
 		void gen(Environment *env)
 		{
-			x86::inc_byte_stack(env->Codes(), to);
+			cpu::inc_byte_stack(env->Codes(), to);
+		}
+		void lower(Environment *env)
+		{
+			env->emit(BC::cincL, env->slot(to));
 		}
-		int run(Environment *env)
+		void operands(Operands &o)
 		{
-			++*(char*)env->r.Stack(to);
+			o.push_back(Operand(&to, Operand::Read | Operand::Write | Operand::Memory | Operand::Byte));
+		}
+		int run(ExecutionContext *cx)
+		{
+			++*(char*)cx->r.Stack(to);
 			return 0;
 		}
 	};
 	struct cincG : unary
 	{
 		cincG(int t) : unary(t){}
-		int getSize(){return 6;}
+		opcode *clone(){return new cincG(*this);}
 		void gen(Environment *env)
 		{
-			x86::inc_byte_mem(env->Codes(), env->GlobalBase() + to);
+			env->incGlobalByte(to);
 		}
-		int run(Environment *env)
+		void lower(Environment *env)
 		{
-			++*(char*)env->Global(to);
+			env->emit(BC::cincG, to);
+		}
+		int run(ExecutionContext *cx)
+		{
+			++*(char*)cx->Global(to);
 			return 0;
 		}
 	};
 	struct cincM : unary
 	{
 		cincM(int t) : unary(t){}
-		int getSize(){return 8;}
+		opcode *clone(){return new cincM(*this);}
 		void gen(Environment *env)
 		{
-			x86::mov_ecx_stack(env->Codes(), to);
-			x86::inc_byte_ecx(env->Codes());
+			env->loadReg(cpu::ecx, to);
+			cpu::inc_byte_ecx(env->Codes());
+		}
+		void lower(Environment *env)
+		{
+			env->emit(BC::cincM, env->slot(to));
+		}
+		void operands(Operands &o)
+		{
+			o.push_back(Operand(&to, Operand::Read));
 		}
-		int run(Environment *env)
+		int run(ExecutionContext *cx)
 		{
-			++*(char*)(*env->r.Stack(to));
+			++*(char*)cx->r.Memory(to);
 			return 0;
 		}
 	};
 	struct pincL : opcode
 	{
 		pincL(int t, int s){to = t;size = s;}
-		int getSize(){return 10;}
+		opcode *clone(){return new pincL(*this);}
 		void gen(Environment *env)
 		{
-			x86::add_stack_int(env->Codes(), to, size);
+			env->addStack(to, size);
 		}
-		int run(Environment *env)
+		void lower(Environment *env)
 		{
-			*env->r.Stack(to) += size;
+			env->emit(BC::pincL, env->slot(to), size);
+		}
+		void operands(Operands &o)
+		{
+			o.push_back(Operand(&to, Operand::Read | Operand::Write));
+		}
+		int run(ExecutionContext *cx)
+		{
+			*cx->r.Stack(to) += size;
 			return 0;
 		}
 	private:
@@ -1199,14 +2943,18 @@ namespace IL
 	struct pincG : opcode
 	{
 		pincG(int t, int s){to = t;size = s;}
-		int getSize(){return 10;}
+		opcode *clone(){return new pincG(*this);}
 		void gen(Environment *env)
 		{
-			x86::add_mem_int(env->Codes(), env->GlobalBase() + to, size);
+			env->addGlobal(to, size);
+		}
+		void lower(Environment *env)
+		{
+			env->emit(BC::pincG, to, size);
 		}
-		int run(Environment *env)
+		int run(ExecutionContext *cx)
 		{
-			*env->Global(to) += size;
+			*cx->Global(to) += size;
 			return 0;
 		}
 	private:
@@ -1216,15 +2964,23 @@ namespace IL
 	struct pincM : opcode
 	{
 		pincM(int t, int s){to = t;size = s;}
-		int getSize(){return 12;}
+		opcode *clone(){return new pincM(*this);}
 		void gen(Environment *env)
 		{
-			x86::mov_ecx_stack(env->Codes(), to);
-			x86::add_ecx_int(env->Codes(), size);
+			env->loadReg(cpu::ecx, to);
+			cpu::add_ecx_int(env->Codes(), size);
+		}
+		void lower(Environment *env)
+		{
+			env->emit(BC::pincM, env->slot(to), size);
 		}
-		int run(Environment *env)
+		void operands(Operands &o)
 		{
-			*(int*)(*env->r.Stack(to)) += size;
+			o.push_back(Operand(&to, Operand::Read));
+		}
+		int run(ExecutionContext *cx)
+		{
+			*cx->r.Memory(to) += size;
 			return 0;
 		}
 	private:
@@ -1235,103 +2991,151 @@ namespace IL
 	struct decL : unary
 	{
 		decL(int t) : unary(t){}
-		int getSize(){return 6;}
+		opcode *clone(){return new decL(*this);}
 		void gen(Environment *env)
 		{
-			x86::dec_stack(env->Codes(), to);
+			env->decStack(to);
+		}
+		void lower(Environment *env)
+		{
+			env->emit(BC::decL, env->slot(to));
+		}
+		void operands(Operands &o)
+		{
+			o.push_back(Operand(&to, Operand::Read | Operand::Write));
 		}
-		int run(Environment *env)
+		int run(ExecutionContext *cx)
 		{
-			--*env->r.Stack(to);
+			--*cx->r.Stack(to);
 			return 0;
 		}
 	};
 	struct decG : unary
 	{
 		decG(int t) : unary(t){}
-		int getSize(){return 6;}
+		opcode *clone(){return new decG(*this);}
 		void gen(Environment *env)
 		{
-			x86::dec_mem(env->Codes(), env->GlobalBase() + to);
+			env->decGlobal(to);
+		}
+		void lower(Environment *env)
+		{
+			env->emit(BC::decG, to);
 		}
-		int run(Environment *env)
+		int run(ExecutionContext *cx)
 		{
-			--*env->Global(to);
+			--*cx->Global(to);
 			return 0;
 		}
 	};
 	struct decM : unary
 	{
 		decM(int t) : unary(t){}
-		int getSize(){return 8;}
+		opcode *clone(){return new decM(*this);}
 		void gen(Environment *env)
 		{
-			x86::mov_ecx_stack(env->Codes(), to);
-			x86::dec_ecx(env->Codes());
+			env->loadReg(cpu::ecx, to);
+			cpu::dec_ecx(env->Codes());
+		}
+		void lower(Environment *env)
+		{
+			env->emit(BC::decM, env->slot(to));
 		}
-		int run(Environment *env)
+		void operands(Operands &o)
 		{
-			--*(int*)(*env->r.Stack(to));
+			o.push_back(Operand(&to, Operand::Read));
+		}
+		int run(ExecutionContext *cx)
+		{
+			--*cx->r.Memory(to);
 			return 0;
 		}
 	};
 	struct cdecL : unary
 	{
 		cdecL(int t) : unary(t){}
-		int getSize(){return 6;}
+		opcode *clone(){return new cdecL(*this);}
 		void gen(Environment *env)
 		{
-			x86::dec_byte_stack(env->Codes(), to);
+			cpu::dec_byte_stack(env->Codes(), to);
+		}
+		void lower(Environment *env)
+		{
+			env->emit(BC::cdecL, env->slot(to));
+		}
+		void operands(Operands &o)
+		{
+			o.push_back(Operand(&to, Operand::Read | Operand::Write | Operand::Memory | Operand::Byte));
 		}
-		int run(Environment *env)
+		int run(ExecutionContext *cx)
 		{
-			--*(char*)env->r.Stack(to);
+			--*(char*)cx->r.Stack(to);
 			return 0;
 		}
 	};
 	struct cdecG : unary
 	{
 		cdecG(int t) : unary(t){}
-		int getSize(){return 6;}
+		opcode *clone(){return new cdecG(*this);}
 		void gen(Environment *env)
 		{
-			x86::dec_byte_mem(env->Codes(), env->GlobalBase() + to);
+			env->decGlobalByte(to);
 		}
-		int run(Environment *env)
+		void lower(Environment *env)
 		{
-			--*(char*)env->Global(to);
+			env->emit(BC::cdecG, to);
+		}
+		int run(ExecutionContext *cx)
+		{
+			--*(char*)cx->Global(to);
 			return 0;
 		}
 	};
 	struct cdecM : unary
 	{
 		cdecM(int t) : unary(t){}
-		int getSize(){return 8;}
+		opcode *clone(){return new cdecM(*this);}
 		void gen(Environment *env)
 		{
-			x86::mov_ecx_stack(env->Codes(), to);
-			x86::dec_byte_ecx(env->Codes());
+			env->loadReg(cpu::ecx, to);
+			cpu::dec_byte_ecx(env->Codes());
 		}
-		int run(Environment *env)
+		void lower(Environment *env)
 		{
-			--*(char*)(*env->r.Stack(to));
+			env->emit(BC::cdecM, env->slot(to));
+		}
+		void operands(Operands &o)
+		{
+			o.push_back(Operand(&to, Operand::Read));
+		}
+		int run(ExecutionContext *cx)
+		{
+			--*(char*)cx->r.Memory(to);
 			return 0;
 		}
 	};
 	struct pdecL : opcode
 	{
 		pdecL(int t, int s){to = t;size = s;}
-		int getSize(){return 10;}
+		opcode *clone(){return new pdecL(*this);}
 		void gen(Environment *env)
 		{
-			x86::add_stack_int(env->Codes(), to, -size);
+			env->addStack(to, -size);
 			// これ中間言語自体を用意する必要がなくね？
 			// pincL等に最初からマイナスで渡せば済む話
 			// まず別の命令名にすべきな気がするが
 		}
-		int run(Environment *env)
+		void lower(Environment *env)
+		{
+			env->emit(BC::pdecL, env->slot(to), size);
+		}
+		void operands(Operands &o)
+		{
+			o.push_back(Operand(&to, Operand::Read | Operand::Write));
+		}
+		int run(ExecutionContext *cx)
 		{
-			*env->r.Stack(to) -= size;
+			*cx->r.Stack(to) -= size;
 			return 0;
 		}
 	private:
@@ -1341,14 +3145,18 @@ namespace IL
 	struct pdecG : opcode
 	{
 		pdecG(int t, int s){to = t;size = s;}
-		int getSize(){return 10;}
+		opcode *clone(){return new pdecG(*this);}
 		void gen(Environment *env)
 		{
-			x86::add_mem_int(env->Codes(), env->GlobalBase() + to, -size);
+			env->addGlobal(to, -size);
 		}
-		int run(Environment *env)
+		void lower(Environment *env)
 		{
-			*env->Global(to) -= size;
+			env->emit(BC::pdecG, to, size);
+		}
+		int run(ExecutionContext *cx)
+		{
+			*cx->Global(to) -= size;
 			return 0;
 		}
 	private:
@@ -1358,15 +3166,23 @@ namespace IL
 	struct pdecM : opcode
 	{
 		pdecM(int t, int s){to = t;size = s;}
-		int getSize(){return 12;}
+		opcode *clone(){return new pdecM(*this);}
 		void gen(Environment *env)
 		{
-			x86::mov_ecx_stack(env->Codes(), to);
-			x86::add_ecx_int(env->Codes(), -size);
+			env->loadReg(cpu::ecx, to);
+			cpu::add_ecx_int(env->Codes(), -size);
+		}
+		void lower(Environment *env)
+		{
+			env->emit(BC::pdecM, env->slot(to), size);
+		}
+		void operands(Operands &o)
+		{
+			o.push_back(Operand(&to, Operand::Read));
 		}
-		int run(Environment *env)
+		int run(ExecutionContext *cx)
 		{
-			*(int*)(*env->r.Stack(to)) -= size;
+			*cx->r.Memory(to) -= size;
 			return 0;
 		}
 	private:
@@ -1377,61 +3193,97 @@ namespace IL
 	struct minus : binary
 	{
 		minus(int t, int a) : binary(t, a){}
-		int getSize(){return 14;}
+		opcode *clone(){return new minus(*this);}
 		void gen(Environment *env)
 		{
-			x86::mov_eax_stack(env->Codes(), address);
-			x86::neg_eax(env->Codes());
-			x86::mov_stack_eax(env->Codes(), to);
+			env->loadReg(cpu::eax, address);
+			cpu::neg_eax(env->Codes());
+			env->storeReg(to, cpu::eax);
+		}
+		void lower(Environment *env)
+		{
+			env->emit(BC::minus, env->slot(to), env->slot(address));
 		}
-		int run(Environment *env)
+		void operands(Operands &o)
 		{
-			*env->r.Stack(to) = -*env->r.Stack(address);
+			o.push_back(Operand(&to, Operand::Write));
+			o.push_back(Operand(&address, Operand::Read));
+		}
+		int run(ExecutionContext *cx)
+		{
+			*cx->r.Stack(to) = -*cx->r.Stack(address);
 			return 0;
 		}
 	};
 	struct fminus : binary
 	{
 		fminus(int t, int a) : binary(t, a){}
-		int getSize(){return 0;}
+		opcode *clone(){return new fminus(*this);}
 		void gen(Environment *env)
 		{
 		}
-		int run(Environment *env)
+		void lower(Environment *env)
 		{
-			*(float*)env->r.Stack(to) = -*(float*)env->r.Stack(address);
+			env->emit(BC::fminus, env->slot(to), env->slot(address));
+		}
+		void operands(Operands &o)
+		{
+			o.push_back(Operand(&to, Operand::Write | Operand::Memory));
+			o.push_back(Operand(&address, Operand::Read | Operand::Memory));
+		}
+		int run(ExecutionContext *cx)
+		{
+			*(float*)cx->r.Stack(to) = -*(float*)cx->r.Stack(address);
 			return 0;
 		}
 	};
 	struct Not : binary
 	{
 		Not(int t, int a) : binary(t, a){}
-		int getSize(){return 15;}
+		opcode *clone(){return new Not(*this);}
 		void gen(Environment *env)
 		{
-			x86::mov_eax_stack(env->Codes(), address);
-			x86::xor_eax_1(env->Codes());
-			x86::mov_stack_eax(env->Codes(), to);
+			env->loadReg(cpu::eax, address);
+			cpu::xor_eax_1(env->Codes());
+			env->storeReg(to, cpu::eax);
+		}
+		void lower(Environment *env)
+		{
+			env->emit(BC::Not, env->slot(to), env->slot(address));
 		}
-		int run(Environment *env)
+		void operands(Operands &o)
 		{
-			*env->r.Stack(to) = !*env->r.Stack(address);
+			o.push_back(Operand(&to, Operand::Write));
+			o.push_back(Operand(&address, Operand::Read));
+		}
+		int run(ExecutionContext *cx)
+		{
+			*cx->r.Stack(to) = !*(char*)cx->r.Stack(address);	// boolは1byte、JITもalしか見てない
 			return 0;
 		}
 	};
 	struct Compl : binary
 	{
 		Compl(int t, int a) : binary(t, a){}
-		int getSize(){return 14;}
+		opcode *clone(){return new Compl(*this);}
 		void gen(Environment *env)
 		{
-			x86::mov_eax_stack(env->Codes(), address);
-			x86::not_eax(env->Codes());
-			x86::mov_stack_eax(env->Codes(), to);
+			env->loadReg(cpu::eax, address);
+			cpu::not_eax(env->Codes());
+			env->storeReg(to, cpu::eax);
+		}
+		void lower(Environment *env)
+		{
+			env->emit(BC::Compl, env->slot(to), env->slot(address));
+		}
+		void operands(Operands &o)
+		{
+			o.push_back(Operand(&to, Operand::Write));
+			o.push_back(Operand(&address, Operand::Read));
 		}
-		int run(Environment *env)
+		int run(ExecutionContext *cx)
 		{
-			*(dword*)env->r.Stack(to) = ~*(dword*)env->r.Stack(address);
+			*(dword*)cx->r.Stack(to) = ~*(dword*)cx->r.Stack(address);
 			return 0;
 		}
 	};
@@ -1444,15 +3296,20 @@ namespace IL
 			left = l;
 			right = r;
 		}
-		int getSize(){return 18;}
 		void gen(Environment *env)
 		{
-			x86::mov_eax_stack(env->Codes(), left);
-			x86::mov_ecx_stack(env->Codes(), right);
+			env->loadReg(cpu::eax, left);
+			env->loadReg(cpu::ecx, right);
 			gen_calc(env);
-			x86::mov_stack_eax(env->Codes(), to);
+			env->storeReg(to, cpu::eax);
 		}
 		virtual void gen_calc(Environment *env){}
+		void operands(Operands &o)
+		{
+			o.push_back(Operand(&to, Operand::Write));
+			o.push_back(Operand(&left, Operand::Read));
+			o.push_back(Operand(&right, Operand::Read));
+		}
 	protected:
 		int to;
 		int left;
@@ -1461,527 +3318,694 @@ namespace IL
 	struct iadd : ternary
 	{
 		iadd(int t, int l, int r) : ternary(t, l, r){}
-		int getSize(){return 20;}
+		opcode *clone(){return new iadd(*this);}
 		void gen_calc(Environment *env)
 		{
-			x86::add_eax_ecx(env->Codes());
+			cpu::add_eax_ecx(env->Codes());
+		}
+		void lower(Environment *env)
+		{
+			env->emit(BC::iadd, env->slot(to), env->slot(left), env->slot(right));
 		}
-		int run(Environment *env)
+		int run(ExecutionContext *cx)
 		{
-			*env->r.Stack(to) = *env->r.Stack(left) + *env->r.Stack(right);
+			*cx->r.Stack(to) = *cx->r.Stack(left) + *cx->r.Stack(right);
 			return 0;
 		}
 	};
 	struct fadd : ternary
 	{
 		fadd(int t, int l, int r) : ternary(t, l, r){}
-		int getSize(){return 18;}
+		opcode *clone(){return new fadd(*this);}
 		void gen(Environment *env)
 		{
-			x86::fld_stack(env->Codes(), left);
-			x86::fadd_stack(env->Codes(), right);
-			x86::fstp_stack(env->Codes(), to);
+			cpu::fld_stack(env->Codes(), left);
+			cpu::fadd_stack(env->Codes(), right);
+			cpu::fstp_stack(env->Codes(), to);
 		}
-		int run(Environment *env)
+		void lower(Environment *env)
 		{
-			*(float*)env->r.Stack(to) = *(float*)env->r.Stack(left) + *(float*)env->r.Stack(right);
+			env->emit(BC::fadd, env->slot(to), env->slot(left), env->slot(right));
+		}
+		void operands(Operands &o)
+		{
+			o.push_back(Operand(&to, Operand::Write | Operand::Memory));
+			o.push_back(Operand(&left, Operand::Read | Operand::Memory));
+			o.push_back(Operand(&right, Operand::Read | Operand::Memory));
+		}
+		int run(ExecutionContext *cx)
+		{
+			*(float*)cx->r.Stack(to) = *(float*)cx->r.Stack(left) + *(float*)cx->r.Stack(right);
 			return 0;
 		}
 	};
 	struct isub : ternary
 	{
 		isub(int t, int l, int r) : ternary(t, l, r){}
-		int getSize(){return 20;}
+		opcode *clone(){return new isub(*this);}
 		void gen_calc(Environment *env)
 		{
-			x86::sub_eax_ecx(env->Codes());
+			cpu::sub_eax_ecx(env->Codes());
 		}
-		int run(Environment *env)
+		void lower(Environment *env)
 		{
-			*env->r.Stack(to) = *env->r.Stack(left) - *env->r.Stack(right);
+			env->emit(BC::isub, env->slot(to), env->slot(left), env->slot(right));
+		}
+		int run(ExecutionContext *cx)
+		{
+			*cx->r.Stack(to) = *cx->r.Stack(left) - *cx->r.Stack(right);
 			return 0;
 		}
 	};
 	struct fsub : ternary
 	{
 		fsub(int t, int l, int r) : ternary(t, l, r){}
-		int getSize(){return 18;}
+		opcode *clone(){return new fsub(*this);}
 		void gen(Environment *env)
 		{
-			x86::fld_stack(env->Codes(), left);
-			x86::fsub_stack(env->Codes(), right);
-			x86::fstp_stack(env->Codes(), to);
+			cpu::fld_stack(env->Codes(), left);
+			cpu::fsub_stack(env->Codes(), right);
+			cpu::fstp_stack(env->Codes(), to);
+		}
+		void lower(Environment *env)
+		{
+			env->emit(BC::fsub, env->slot(to), env->slot(left), env->slot(right));
 		}
-		int run(Environment *env)
+		void operands(Operands &o)
 		{
-			*(float*)env->r.Stack(to) = *(float*)env->r.Stack(left) - *(float*)env->r.Stack(right);
+			o.push_back(Operand(&to, Operand::Write | Operand::Memory));
+			o.push_back(Operand(&left, Operand::Read | Operand::Memory));
+			o.push_back(Operand(&right, Operand::Read | Operand::Memory));
+		}
+		int run(ExecutionContext *cx)
+		{
+			*(float*)cx->r.Stack(to) = *(float*)cx->r.Stack(left) - *(float*)cx->r.Stack(right);
 			return 0;
 		}
 	};
 	struct imul : ternary
 	{
 		imul(int t, int l, int r) : ternary(t, l, r){}
-		int getSize(){return 20;}
+		opcode *clone(){return new imul(*this);}
 		void gen_calc(Environment *env)
 		{
-			x86::mul_ecx(env->Codes());
+			cpu::mul_ecx(env->Codes());
+		}
+		void lower(Environment *env)
+		{
+			env->emit(BC::imul, env->slot(to), env->slot(left), env->slot(right));
 		}
-		int run(Environment *env)
+		int clobber(){return 1 << cpu::edx;}
+		int run(ExecutionContext *cx)
 		{
-			*env->r.Stack(to) = *env->r.Stack(left) * *env->r.Stack(right);
+			*cx->r.Stack(to) = *cx->r.Stack(left) * *cx->r.Stack(right);
 			return 0;
 		}
 	};
 	struct fmul : ternary
 	{
 		fmul(int t, int l, int r) : ternary(t, l, r){}
-		int getSize(){return 18;}
+		opcode *clone(){return new fmul(*this);}
 		void gen(Environment *env)
 		{
-			x86::fld_stack(env->Codes(), left);
-			x86::fmul_stack(env->Codes(), right);
-			x86::fstp_stack(env->Codes(), to);
+			cpu::fld_stack(env->Codes(), left);
+			cpu::fmul_stack(env->Codes(), right);
+			cpu::fstp_stack(env->Codes(), to);
+		}
+		void lower(Environment *env)
+		{
+			env->emit(BC::fmul, env->slot(to), env->slot(left), env->slot(right));
+		}
+		void operands(Operands &o)
+		{
+			o.push_back(Operand(&to, Operand::Write | Operand::Memory));
+			o.push_back(Operand(&left, Operand::Read | Operand::Memory));
+			o.push_back(Operand(&right, Operand::Read | Operand::Memory));
 		}
-		int run(Environment *env)
+		int run(ExecutionContext *cx)
 		{
-			*(float*)env->r.Stack(to) = *(float*)env->r.Stack(left) * *(float*)env->r.Stack(right);
+			*(float*)cx->r.Stack(to) = *(float*)cx->r.Stack(left) * *(float*)cx->r.Stack(right);
 			return 0;
 		}
 	};
 	struct idiv : ternary
 	{
 		idiv(int t, int l, int r) : ternary(t, l, r){}
-		int getSize(){return 22;}
+		opcode *clone(){return new idiv(*this);}
 		void gen_calc(Environment *env)
 		{
-			x86::xor_edx_edx(env->Codes());
-			x86::div_ecx(env->Codes());
+			cpu::xor_edx_edx(env->Codes());
+			cpu::div_ecx(env->Codes());
 		}
-		int run(Environment *env)
+		void lower(Environment *env)
 		{
-			*env->r.Stack(to) = *env->r.Stack(left) / *env->r.Stack(right);
+			env->emit(BC::idiv, env->slot(to), env->slot(left), env->slot(right));
+		}
+		int clobber(){return 1 << cpu::edx;}
+		int run(ExecutionContext *cx)
+		{
+			*cx->r.Stack(to) = *cx->r.Stack(left) / *cx->r.Stack(right);
 			return 0;
 		}
 	};
 	struct fdiv : ternary
 	{
 		fdiv(int t, int l, int r) : ternary(t, l, r){}
-		int getSize(){return 18;}
+		opcode *clone(){return new fdiv(*this);}
 		void gen(Environment *env)
 		{
-			x86::fld_stack(env->Codes(), left);
-			x86::fdiv_stack(env->Codes(), right);
-			x86::fstp_stack(env->Codes(), to);
+			cpu::fld_stack(env->Codes(), left);
+			cpu::fdiv_stack(env->Codes(), right);
+			cpu::fstp_stack(env->Codes(), to);
+		}
+		void lower(Environment *env)
+		{
+			env->emit(BC::fdiv, env->slot(to), env->slot(left), env->slot(right));
 		}
-		int run(Environment *env)
+		void operands(Operands &o)
 		{
-			*(float*)env->r.Stack(to) = *(float*)env->r.Stack(left) / *(float*)env->r.Stack(right);
+			o.push_back(Operand(&to, Operand::Write | Operand::Memory));
+			o.push_back(Operand(&left, Operand::Read | Operand::Memory));
+			o.push_back(Operand(&right, Operand::Read | Operand::Memory));
+		}
+		int run(ExecutionContext *cx)
+		{
+			*(float*)cx->r.Stack(to) = *(float*)cx->r.Stack(left) / *(float*)cx->r.Stack(right);
 			return 0;
 		}
 	};
 	struct imod : ternary
 	{
 		imod(int t, int l, int r) : ternary(t, l, r){}
-		int getSize(){return 22;}
+		opcode *clone(){return new imod(*this);}
 		void gen(Environment *env)
 		{
-			x86::mov_eax_stack(env->Codes(), left);
-			x86::mov_ecx_stack(env->Codes(), right);
-			x86::xor_edx_edx(env->Codes());
-			x86::div_ecx(env->Codes());
-			x86::mov_stack_edx(env->Codes(), to);
+			env->loadReg(cpu::eax, left);
+			env->loadReg(cpu::ecx, right);
+			cpu::xor_edx_edx(env->Codes());
+			cpu::div_ecx(env->Codes());
+			env->storeReg(to, cpu::edx);
+		}
+		void lower(Environment *env)
+		{
+			env->emit(BC::imod, env->slot(to), env->slot(left), env->slot(right));
 		}
-		int run(Environment *env)
+		int clobber(){return 1 << cpu::edx;}
+		int run(ExecutionContext *cx)
 		{
-			*env->r.Stack(to) = *env->r.Stack(left) % *env->r.Stack(right);
+			*cx->r.Stack(to) = *cx->r.Stack(left) % *cx->r.Stack(right);
 			return 0;
 		}
 	};
 	struct ishl : ternary
 	{
 		ishl(int t, int l, int r) : ternary(t, l, r){}
-		int getSize(){return 20;}
+		opcode *clone(){return new ishl(*this);}
 		void gen_calc(Environment *env)
 		{
-			x86::shl_eax_ecx(env->Codes());
+			cpu::shl_eax_ecx(env->Codes());
 		}
-		int run(Environment *env)
+		void lower(Environment *env)
 		{
-			*env->r.Stack(to) = *env->r.Stack(left) << *env->r.Stack(right);
+			env->emit(BC::ishl, env->slot(to), env->slot(left), env->slot(right));
+		}
+		int run(ExecutionContext *cx)
+		{
+			*cx->r.Stack(to) = *cx->r.Stack(left) << *cx->r.Stack(right);
 			return 0;
 		}
 	};
 	struct ishr : ternary
 	{
 		ishr(int t, int l, int r) : ternary(t, l, r){}
-		int getSize(){return 20;}
+		opcode *clone(){return new ishr(*this);}
 		void gen_calc(Environment *env)
 		{
-			x86::sar_eax_ecx(env->Codes());
+			cpu::sar_eax_ecx(env->Codes());
+		}
+		void lower(Environment *env)
+		{
+			env->emit(BC::ishr, env->slot(to), env->slot(left), env->slot(right));
 		}
-		int run(Environment *env)
+		int run(ExecutionContext *cx)
 		{
-			*env->r.Stack(to) = *env->r.Stack(left) >> *env->r.Stack(right);
+			*cx->r.Stack(to) = *cx->r.Stack(left) >> *cx->r.Stack(right);
 			return 0;
 		}
 	};
 	struct ushr : ternary
 	{
 		ushr(int t, int l, int r) : ternary(t, l, r){}
-		int getSize(){return 20;}
+		opcode *clone(){return new ushr(*this);}
 		void gen_calc(Environment *env)
 		{
-			x86::shr_eax_ecx(env->Codes());
+			cpu::shr_eax_ecx(env->Codes());
 		}
-		int run(Environment *env)
+		void lower(Environment *env)
 		{
-			*(dword*)env->r.Stack(to) = *(dword*)env->r.Stack(left) >> *(dword*)env->r.Stack(right);
+			env->emit(BC::ushr, env->slot(to), env->slot(left), env->slot(right));
+		}
+		int run(ExecutionContext *cx)
+		{
+			*(dword*)cx->r.Stack(to) = *(dword*)cx->r.Stack(left) >> *(dword*)cx->r.Stack(right);
 			return 0;
 		}
 	};
 	struct iand : ternary
 	{
 		iand(int t, int l, int r) : ternary(t, l, r){}
-		int getSize(){return 20;}
+		opcode *clone(){return new iand(*this);}
 		void gen_calc(Environment *env)
 		{
-			x86::and_eax_ecx(env->Codes());
+			cpu::and_eax_ecx(env->Codes());
+		}
+		void lower(Environment *env)
+		{
+			env->emit(BC::iand, env->slot(to), env->slot(left), env->slot(right));
 		}
-		int run(Environment *env)
+		int run(ExecutionContext *cx)
 		{
-			*(dword*)env->r.Stack(to) = *(dword*)env->r.Stack(left) & *(dword*)env->r.Stack(right);
+			*(dword*)cx->r.Stack(to) = *(dword*)cx->r.Stack(left) & *(dword*)cx->r.Stack(right);
 			return 0;
 		}
 	};
 	struct ior : ternary
 	{
 		ior(int t, int l, int r) : ternary(t, l, r){}
-		int getSize(){return 20;}
+		opcode *clone(){return new ior(*this);}
 		void gen_calc(Environment *env)
 		{
-			x86::or_eax_ecx(env->Codes());
+			cpu::or_eax_ecx(env->Codes());
 		}
-		int run(Environment *env)
+		void lower(Environment *env)
 		{
-			*(dword*)env->r.Stack(to) = *(dword*)env->r.Stack(left) | *(dword*)env->r.Stack(right);
+			env->emit(BC::ior, env->slot(to), env->slot(left), env->slot(right));
+		}
+		int run(ExecutionContext *cx)
+		{
+			*(dword*)cx->r.Stack(to) = *(dword*)cx->r.Stack(left) | *(dword*)cx->r.Stack(right);
 			return 0;
 		}
 	};
 	struct ixor : ternary
 	{
 		ixor(int t, int l, int r) : ternary(t, l, r){}
-		int getSize(){return 20;}
+		opcode *clone(){return new ixor(*this);}
 		void gen_calc(Environment *env)
 		{
-			x86::xor_eax_ecx(env->Codes());
+			cpu::xor_eax_ecx(env->Codes());
+		}
+		void lower(Environment *env)
+		{
+			env->emit(BC::ixor, env->slot(to), env->slot(left), env->slot(right));
 		}
-		int run(Environment *env)
+		int run(ExecutionContext *cx)
 		{
-			*(dword*)env->r.Stack(to) = *(dword*)env->r.Stack(left) ^ *(dword*)env->r.Stack(right);
+			*(dword*)cx->r.Stack(to) = *(dword*)cx->r.Stack(left) ^ *(dword*)cx->r.Stack(right);
 			return 0;
 		}
 	};
 	struct ilt : ternary
 	{
 		ilt(int t, int l, int r) : ternary(t, l, r){}
-		int getSize(){return 32;}
+		opcode *clone(){return new ilt(*this);}
 		void gen_calc(Environment *env)
 		{
-			x86::xor_edx_edx(env->Codes());
-			x86::cmp_eax_ecx(env->Codes());
-			x86::jl3(env->Codes());
-			x86::xor_edx_1(env->Codes());
-			x86::xor_edx_1(env->Codes());
-			x86::mov_eax_edx(env->Codes());
+			cpu::xor_edx_edx(env->Codes());
+			cpu::cmp_eax_ecx(env->Codes());
+			cpu::jl3(env->Codes());
+			cpu::xor_edx_1(env->Codes());
+			cpu::xor_edx_1(env->Codes());
+			cpu::mov_eax_edx(env->Codes());
 		}
-		int run(Environment *env)
+		void lower(Environment *env)
 		{
-			*env->r.Stack(to) = *env->r.Stack(left) < *env->r.Stack(right);
+			env->emit(BC::ilt, env->slot(to), env->slot(left), env->slot(right));
+		}
+		int clobber(){return 1 << cpu::edx;}
+		int run(ExecutionContext *cx)
+		{
+			*cx->r.Stack(to) = *cx->r.Stack(left) < *cx->r.Stack(right);
 			return 0;
 		}
 	};
 	struct ult : ternary
 	{
 		ult(int t, int l, int r) : ternary(t, l, r){}
-		int getSize(){return 32;}
+		opcode *clone(){return new ult(*this);}
 		void gen_calc(Environment *env)
 		{
-			x86::xor_edx_edx(env->Codes());
-			x86::cmp_eax_ecx(env->Codes());
-			x86::jb3(env->Codes());
-			x86::xor_edx_1(env->Codes());
-			x86::xor_edx_1(env->Codes());
-			x86::mov_eax_edx(env->Codes());
+			cpu::xor_edx_edx(env->Codes());
+			cpu::cmp_eax_ecx(env->Codes());
+			cpu::jb3(env->Codes());
+			cpu::xor_edx_1(env->Codes());
+			cpu::xor_edx_1(env->Codes());
+			cpu::mov_eax_edx(env->Codes());
+		}
+		void lower(Environment *env)
+		{
+			env->emit(BC::ult, env->slot(to), env->slot(left), env->slot(right));
 		}
-		int run(Environment *env)
+		int clobber(){return 1 << cpu::edx;}
+		int run(ExecutionContext *cx)
 		{
-			*(dword*)env->r.Stack(to) = *(dword*)env->r.Stack(left) < *(dword*)env->r.Stack(right);
+			*(dword*)cx->r.Stack(to) = *(dword*)cx->r.Stack(left) < *(dword*)cx->r.Stack(right);
 			return 0;
 		}
 	};
 	struct clt : ternary
 	{
 		clt(int t, int l, int r) : ternary(t, l, r){}
-		int getSize(){return 32;}
+		opcode *clone(){return new clt(*this);}
 		void gen_calc(Environment *env)
 		{
-			x86::xor_edx_edx(env->Codes());
-			x86::cmp_al_cl(env->Codes());
-			x86::jb3(env->Codes());
-			x86::xor_edx_1(env->Codes());
-			x86::xor_edx_1(env->Codes());
-			x86::mov_eax_edx(env->Codes());
+			cpu::xor_edx_edx(env->Codes());
+			cpu::cmp_al_cl(env->Codes());
+			cpu::jb3(env->Codes());
+			cpu::xor_edx_1(env->Codes());
+			cpu::xor_edx_1(env->Codes());
+			cpu::mov_eax_edx(env->Codes());
 		}
-		int run(Environment *env)
+		void lower(Environment *env)
 		{
-			*(char*)env->r.Stack(to) = *(char*)env->r.Stack(left) < *(char*)env->r.Stack(right);
+			env->emit(BC::clt, env->slot(to), env->slot(left), env->slot(right));
+		}
+		int clobber(){return 1 << cpu::edx;}
+		int run(ExecutionContext *cx)
+		{
+			*(char*)cx->r.Stack(to) = *(char*)cx->r.Stack(left) < *(char*)cx->r.Stack(right);
 			return 0;
 		}
 	};
 	struct ile : ternary
 	{
 		ile(int t, int l, int r) : ternary(t, l, r){}
-		int getSize(){return 32;}
+		opcode *clone(){return new ile(*this);}
 		void gen_calc(Environment *env)
 		{
-			x86::xor_edx_edx(env->Codes());
-			x86::cmp_eax_ecx(env->Codes());
-			x86::jle3(env->Codes());
-			x86::xor_edx_1(env->Codes());
-			x86::xor_edx_1(env->Codes());
-			x86::mov_eax_edx(env->Codes());
+			cpu::xor_edx_edx(env->Codes());
+			cpu::cmp_eax_ecx(env->Codes());
+			cpu::jle3(env->Codes());
+			cpu::xor_edx_1(env->Codes());
+			cpu::xor_edx_1(env->Codes());
+			cpu::mov_eax_edx(env->Codes());
+		}
+		void lower(Environment *env)
+		{
+			env->emit(BC::ile, env->slot(to), env->slot(left), env->slot(right));
 		}
-		int run(Environment *env)
+		int clobber(){return 1 << cpu::edx;}
+		int run(ExecutionContext *cx)
 		{
-			*env->r.Stack(to) = *env->r.Stack(left) <= *env->r.Stack(right);
+			*cx->r.Stack(to) = *cx->r.Stack(left) <= *cx->r.Stack(right);
 			return 0;
 		}
 	};
 	struct ule : ternary
 	{
 		ule(int t, int l, int r) : ternary(t, l, r){}
-		int getSize(){return 32;}
+		opcode *clone(){return new ule(*this);}
 		void gen_calc(Environment *env)
 		{
-			x86::xor_edx_edx(env->Codes());
-			x86::cmp_eax_ecx(env->Codes());
-			x86::jbe3(env->Codes());
-			x86::xor_edx_1(env->Codes());
-			x86::xor_edx_1(env->Codes());
-			x86::mov_eax_edx(env->Codes());
+			cpu::xor_edx_edx(env->Codes());
+			cpu::cmp_eax_ecx(env->Codes());
+			cpu::jbe3(env->Codes());
+			cpu::xor_edx_1(env->Codes());
+			cpu::xor_edx_1(env->Codes());
+			cpu::mov_eax_edx(env->Codes());
 		}
-		int run(Environment *env)
+		void lower(Environment *env)
 		{
-			*(dword*)env->r.Stack(to) = *(dword*)env->r.Stack(left) <= *(dword*)env->r.Stack(right);
+			env->emit(BC::ule, env->slot(to), env->slot(left), env->slot(right));
+		}
+		int clobber(){return 1 << cpu::edx;}
+		int run(ExecutionContext *cx)
+		{
+			*(dword*)cx->r.Stack(to) = *(dword*)cx->r.Stack(left) <= *(dword*)cx->r.Stack(right);
 			return 0;
 		}
 	};
 	struct cle : ternary
 	{
 		cle(int t, int l, int r) : ternary(t, l, r){}
-		int getSize(){return 32;}
+		opcode *clone(){return new cle(*this);}
 		void gen_calc(Environment *env)
 		{
-			x86::xor_edx_edx(env->Codes());
-			x86::cmp_al_cl(env->Codes());
-			x86::jbe3(env->Codes());
-			x86::xor_edx_1(env->Codes());
-			x86::xor_edx_1(env->Codes());
-			x86::mov_eax_edx(env->Codes());
+			cpu::xor_edx_edx(env->Codes());
+			cpu::cmp_al_cl(env->Codes());
+			cpu::jbe3(env->Codes());
+			cpu::xor_edx_1(env->Codes());
+			cpu::xor_edx_1(env->Codes());
+			cpu::mov_eax_edx(env->Codes());
+		}
+		void lower(Environment *env)
+		{
+			env->emit(BC::cle, env->slot(to), env->slot(left), env->slot(right));
 		}
-		int run(Environment *env)
+		int clobber(){return 1 << cpu::edx;}
+		int run(ExecutionContext *cx)
 		{
-			*(char*)env->r.Stack(to) = *(char*)env->r.Stack(left) <= *(char*)env->r.Stack(right);
+			*(char*)cx->r.Stack(to) = *(char*)cx->r.Stack(left) <= *(char*)cx->r.Stack(right);
 			return 0;
 		}
 	};
 	struct igt : ternary
 	{
 		igt(int t, int l, int r) : ternary(t, l, r){}
-		int getSize(){return 32;}
+		opcode *clone(){return new igt(*this);}
 		void gen_calc(Environment *env)
 		{
-			x86::xor_edx_edx(env->Codes());
-			x86::cmp_eax_ecx(env->Codes());
-			x86::jg3(env->Codes());
-			x86::xor_edx_1(env->Codes());
-			x86::xor_edx_1(env->Codes());
-			x86::mov_eax_edx(env->Codes());
+			cpu::xor_edx_edx(env->Codes());
+			cpu::cmp_eax_ecx(env->Codes());
+			cpu::jg3(env->Codes());
+			cpu::xor_edx_1(env->Codes());
+			cpu::xor_edx_1(env->Codes());
+			cpu::mov_eax_edx(env->Codes());
 		}
-		int run(Environment *env)
+		void lower(Environment *env)
 		{
-			*env->r.Stack(to) = *env->r.Stack(left) > *env->r.Stack(right);
+			env->emit(BC::igt, env->slot(to), env->slot(left), env->slot(right));
+		}
+		int clobber(){return 1 << cpu::edx;}
+		int run(ExecutionContext *cx)
+		{
+			*cx->r.Stack(to) = *cx->r.Stack(left) > *cx->r.Stack(right);
 			return 0;
 		}
 	};
 	struct ugt : ternary
 	{
 		ugt(int t, int l, int r) : ternary(t, l, r){}
-		int getSize(){return 32;}
+		opcode *clone(){return new ugt(*this);}
 		void gen_calc(Environment *env)
 		{
-			x86::xor_edx_edx(env->Codes());
-			x86::cmp_eax_ecx(env->Codes());
-			x86::ja3(env->Codes());
-			x86::xor_edx_1(env->Codes());
-			x86::xor_edx_1(env->Codes());
-			x86::mov_eax_edx(env->Codes());
+			cpu::xor_edx_edx(env->Codes());
+			cpu::cmp_eax_ecx(env->Codes());
+			cpu::ja3(env->Codes());
+			cpu::xor_edx_1(env->Codes());
+			cpu::xor_edx_1(env->Codes());
+			cpu::mov_eax_edx(env->Codes());
+		}
+		void lower(Environment *env)
+		{
+			env->emit(BC::ugt, env->slot(to), env->slot(left), env->slot(right));
 		}
-		int run(Environment *env)
+		int clobber(){return 1 << cpu::edx;}
+		int run(ExecutionContext *cx)
 		{
-			*(dword*)env->r.Stack(to) = *(dword*)env->r.Stack(left) > *(dword*)env->r.Stack(right);
+			*(dword*)cx->r.Stack(to) = *(dword*)cx->r.Stack(left) > *(dword*)cx->r.Stack(right);
 			return 0;
 		}
 	};
 	struct cgt : ternary
 	{
 		cgt(int t, int l, int r) : ternary(t, l, r){}
-		int getSize(){return 32;}
+		opcode *clone(){return new cgt(*this);}
 		void gen_calc(Environment *env)
 		{
-			x86::xor_edx_edx(env->Codes());
-			x86::cmp_al_cl(env->Codes());
-			x86::ja3(env->Codes());
-			x86::xor_edx_1(env->Codes());
-			x86::xor_edx_1(env->Codes());
-			x86::mov_eax_edx(env->Codes());
+			cpu::xor_edx_edx(env->Codes());
+			cpu::cmp_al_cl(env->Codes());
+			cpu::ja3(env->Codes());
+			cpu::xor_edx_1(env->Codes());
+			cpu::xor_edx_1(env->Codes());
+			cpu::mov_eax_edx(env->Codes());
 		}
-		int run(Environment *env)
+		void lower(Environment *env)
 		{
-			*(char*)env->r.Stack(to) = *(char*)env->r.Stack(left) > *(char*)env->r.Stack(right);
+			env->emit(BC::cgt, env->slot(to), env->slot(left), env->slot(right));
+		}
+		int clobber(){return 1 << cpu::edx;}
+		int run(ExecutionContext *cx)
+		{
+			*(char*)cx->r.Stack(to) = *(char*)cx->r.Stack(left) > *(char*)cx->r.Stack(right);
 			return 0;
 		}
 	};
 	struct ige : ternary
 	{
 		ige(int t, int l, int r) : ternary(t, l, r){}
-		int getSize(){return 32;}
+		opcode *clone(){return new ige(*this);}
 		void gen_calc(Environment *env)
 		{
-			x86::xor_edx_edx(env->Codes());
-			x86::cmp_eax_ecx(env->Codes());
-			x86::jge3(env->Codes());
-			x86::xor_edx_1(env->Codes());
-			x86::xor_edx_1(env->Codes());
-			x86::mov_eax_edx(env->Codes());
+			cpu::xor_edx_edx(env->Codes());
+			cpu::cmp_eax_ecx(env->Codes());
+			cpu::jge3(env->Codes());
+			cpu::xor_edx_1(env->Codes());
+			cpu::xor_edx_1(env->Codes());
+			cpu::mov_eax_edx(env->Codes());
+		}
+		void lower(Environment *env)
+		{
+			env->emit(BC::ige, env->slot(to), env->slot(left), env->slot(right));
 		}
-		int run(Environment *env)
+		int clobber(){return 1 << cpu::edx;}
+		int run(ExecutionContext *cx)
 		{
-			*env->r.Stack(to) = *env->r.Stack(left) >= *env->r.Stack(right);
+			*cx->r.Stack(to) = *cx->r.Stack(left) >= *cx->r.Stack(right);
 			return 0;
 		}
 	};
 	struct uge : ternary
 	{
 		uge(int t, int l, int r) : ternary(t, l, r){}
-		int getSize(){return 32;}
+		opcode *clone(){return new uge(*this);}
 		void gen_calc(Environment *env)
 		{
-			x86::xor_edx_edx(env->Codes());
-			x86::cmp_eax_ecx(env->Codes());
-			x86::jae3(env->Codes());
-			x86::xor_edx_1(env->Codes());
-			x86::xor_edx_1(env->Codes());
-			x86::mov_eax_edx(env->Codes());
+			cpu::xor_edx_edx(env->Codes());
+			cpu::cmp_eax_ecx(env->Codes());
+			cpu::jae3(env->Codes());
+			cpu::xor_edx_1(env->Codes());
+			cpu::xor_edx_1(env->Codes());
+			cpu::mov_eax_edx(env->Codes());
 		}
-		int run(Environment *env)
+		void lower(Environment *env)
 		{
-			*(dword*)env->r.Stack(to) = *(dword*)env->r.Stack(left) >= *(dword*)env->r.Stack(right);
+			env->emit(BC::uge, env->slot(to), env->slot(left), env->slot(right));
+		}
+		int clobber(){return 1 << cpu::edx;}
+		int run(ExecutionContext *cx)
+		{
+			*(dword*)cx->r.Stack(to) = *(dword*)cx->r.Stack(left) >= *(dword*)cx->r.Stack(right);
 			return 0;
 		}
 	};
 	struct cge : ternary
 	{
 		cge(int t, int l, int r) : ternary(t, l, r){}
-		int getSize(){return 32;}
+		opcode *clone(){return new cge(*this);}
 		void gen_calc(Environment *env)
 		{
-			x86::xor_edx_edx(env->Codes());
-			x86::cmp_al_cl(env->Codes());
-			x86::jae3(env->Codes());
-			x86::xor_edx_1(env->Codes());
-			x86::xor_edx_1(env->Codes());
-			x86::mov_eax_edx(env->Codes());
+			cpu::xor_edx_edx(env->Codes());
+			cpu::cmp_al_cl(env->Codes());
+			cpu::jae3(env->Codes());
+			cpu::xor_edx_1(env->Codes());
+			cpu::xor_edx_1(env->Codes());
+			cpu::mov_eax_edx(env->Codes());
+		}
+		void lower(Environment *env)
+		{
+			env->emit(BC::cge, env->slot(to), env->slot(left), env->slot(right));
 		}
-		int run(Environment *env)
+		int clobber(){return 1 << cpu::edx;}
+		int run(ExecutionContext *cx)
 		{
-			*(char*)env->r.Stack(to) = *(char*)env->r.Stack(left) >= *(char*)env->r.Stack(right);
+			*(char*)cx->r.Stack(to) = *(char*)cx->r.Stack(left) >= *(char*)cx->r.Stack(right);
 			return 0;
 		}
 	};
 	struct ieq : ternary
 	{
 		ieq(int t, int l, int r) : ternary(t, l, r){}
-		int getSize(){return 32;}
+		opcode *clone(){return new ieq(*this);}
 		void gen_calc(Environment *env)
 		{
-			x86::xor_edx_edx(env->Codes());
-			x86::cmp_eax_ecx(env->Codes());
-			x86::je3(env->Codes());
-			x86::xor_edx_1(env->Codes());
-			x86::xor_edx_1(env->Codes());
-			x86::mov_eax_edx(env->Codes());
+			cpu::xor_edx_edx(env->Codes());
+			cpu::cmp_eax_ecx(env->Codes());
+			cpu::je3(env->Codes());
+			cpu::xor_edx_1(env->Codes());
+			cpu::xor_edx_1(env->Codes());
+			cpu::mov_eax_edx(env->Codes());
 		}
-		int run(Environment *env)
+		void lower(Environment *env)
 		{
-			*env->r.Stack(to) = *env->r.Stack(left) == *env->r.Stack(right);
+			env->emit(BC::ieq, env->slot(to), env->slot(left), env->slot(right));
+		}
+		int clobber(){return 1 << cpu::edx;}
+		int run(ExecutionContext *cx)
+		{
+			*cx->r.Stack(to) = *cx->r.Stack(left) == *cx->r.Stack(right);
 			return 0;
 		}
 	};
 	struct ceq : ternary
 	{
 		ceq(int t, int l, int r) : ternary(t, l, r){}
-		int getSize(){return 32;}
+		opcode *clone(){return new ceq(*this);}
 		void gen_calc(Environment *env)
 		{
-			x86::xor_edx_edx(env->Codes());
-			x86::cmp_al_cl(env->Codes());
-			x86::je3(env->Codes());
-			x86::xor_edx_1(env->Codes());
-			x86::xor_edx_1(env->Codes());
-			x86::mov_eax_edx(env->Codes());
+			cpu::xor_edx_edx(env->Codes());
+			cpu::cmp_al_cl(env->Codes());
+			cpu::je3(env->Codes());
+			cpu::xor_edx_1(env->Codes());
+			cpu::xor_edx_1(env->Codes());
+			cpu::mov_eax_edx(env->Codes());
+		}
+		void lower(Environment *env)
+		{
+			env->emit(BC::ceq, env->slot(to), env->slot(left), env->slot(right));
 		}
-		int run(Environment *env)
+		int clobber(){return 1 << cpu::edx;}
+		int run(ExecutionContext *cx)
 		{
-			*(char*)env->r.Stack(to) = *(char*)env->r.Stack(left) == *(char*)env->r.Stack(right);
+			*(char*)cx->r.Stack(to) = *(char*)cx->r.Stack(left) == *(char*)cx->r.Stack(right);
 			return 0;
 		}
 	};
 	struct ine : ternary
 	{
 		ine(int t, int l, int r) : ternary(t, l, r){}
-		int getSize(){return 32;}
+		opcode *clone(){return new ine(*this);}
 		void gen_calc(Environment *env)
 		{
-			x86::xor_edx_edx(env->Codes());
-			x86::cmp_eax_ecx(env->Codes());
-			x86::jnz3(env->Codes());
-			x86::xor_edx_1(env->Codes());
-			x86::xor_edx_1(env->Codes());
-			x86::mov_eax_edx(env->Codes());
+			cpu::xor_edx_edx(env->Codes());
+			cpu::cmp_eax_ecx(env->Codes());
+			cpu::jnz3(env->Codes());
+			cpu::xor_edx_1(env->Codes());
+			cpu::xor_edx_1(env->Codes());
+			cpu::mov_eax_edx(env->Codes());
 		}
-		int run(Environment *env)
+		void lower(Environment *env)
 		{
-			*env->r.Stack(to) = *env->r.Stack(left) != *env->r.Stack(right);
+			env->emit(BC::ine, env->slot(to), env->slot(left), env->slot(right));
+		}
+		int clobber(){return 1 << cpu::edx;}
+		int run(ExecutionContext *cx)
+		{
+			*cx->r.Stack(to) = *cx->r.Stack(left) != *cx->r.Stack(right);
 			return 0;
 		}
 	};
 	struct cne : ternary
 	{
 		cne(int t, int l, int r) : ternary(t, l, r){}
-		int getSize(){return 32;}
+		opcode *clone(){return new cne(*this);}
 		void gen_calc(Environment *env)
 		{
-			x86::xor_edx_edx(env->Codes());
-			x86::cmp_al_cl(env->Codes());
-			x86::jnz3(env->Codes());
-			x86::xor_edx_1(env->Codes());
-			x86::xor_edx_1(env->Codes());
-			x86::mov_eax_edx(env->Codes());
+			cpu::xor_edx_edx(env->Codes());
+			cpu::cmp_al_cl(env->Codes());
+			cpu::jnz3(env->Codes());
+			cpu::xor_edx_1(env->Codes());
+			cpu::xor_edx_1(env->Codes());
+			cpu::mov_eax_edx(env->Codes());
+		}
+		void lower(Environment *env)
+		{
+			env->emit(BC::cne, env->slot(to), env->slot(left), env->slot(right));
 		}
-		int run(Environment *env)
+		int clobber(){return 1 << cpu::edx;}
+		int run(ExecutionContext *cx)
 		{
-			*(char*)env->r.Stack(to) = *(char*)env->r.Stack(left) != *(char*)env->r.Stack(right);
+			*(char*)cx->r.Stack(to) = *(char*)cx->r.Stack(left) != *(char*)cx->r.Stack(right);
 			return 0;
 		}
 	};
@@ -1993,15 +4017,25 @@ namespace IL
 			left = l;
 			right = r;
 		}
-		int getSize(){return 12;}
+		opcode *clone(){return new assign(*this);}
 		void gen(Environment *env)
 		{
-			x86::mov_eax_stack(env->Codes(), right);
-			x86::mov_stack_eax(env->Codes(), left);
+			env->loadReg(cpu::eax, right);
+			env->storeReg(left, cpu::eax);
+		}
+		void lower(Environment *env)
+		{
+			env->emit(BC::assign, env->slot(left), env->slot(right));
+		}
+		void operands(Operands &o)
+		{
+			o.push_back(Operand(&left, Operand::Write));
+			o.push_back(Operand(&right, Operand::Read));
 		}
-		int run(Environment *env)
+		bool copy(){return true;}
+		int run(ExecutionContext *cx)
 		{
-			*env->r.Stack(left) = *env->r.Stack(right);
+			*cx->r.Stack(left) = *cx->r.Stack(right);
 			return 0;
 		}
 	protected:
@@ -2011,15 +4045,25 @@ namespace IL
 	struct cassign : assign
 	{
 		cassign(int l, int r) : assign(l, r){}
-		int getSize(){return 12;}
+		opcode *clone(){return new cassign(*this);}
+		bool copy(){return false;}
 		void gen(Environment *env)
 		{
-			x86::mov_al_stack(env->Codes(), right);
-			x86::mov_stack_al(env->Codes(), left);
+			cpu::mov_al_stack(env->Codes(), right);
+			cpu::mov_stack_al(env->Codes(), left);
 		}
-		int run(Environment *env)
+		void lower(Environment *env)
 		{
-			*(char*)env->r.Stack(left) = *(char*)env->r.Stack(right);
+			env->emit(BC::cassign, env->slot(left), env->slot(right));
+		}
+		void operands(Operands &o)
+		{
+			o.push_back(Operand(&left, Operand::Write | Operand::Memory | Operand::Byte));
+			o.push_back(Operand(&right, Operand::Read | Operand::Memory | Operand::Byte));
+		}
+		int run(ExecutionContext *cx)
+		{
+			*(char*)cx->r.Stack(left) = *(char*)cx->r.Stack(right);
 			return 0;
 		}
 	};
@@ -2027,30 +4071,48 @@ namespace IL
 	struct set_global : assign
 	{
 		set_global(int l, int r) : assign(l, r){}
-		int getSize(){return 11;}
+		opcode *clone(){return new set_global(*this);}
+		bool copy(){return false;}
 		void gen(Environment *env)
 		{
-			x86::mov_eax_stack(env->Codes(), right);
-			x86::mov_mem_eax(env->Codes(), env->GlobalBase() + left);
+			env->loadReg(cpu::eax, right);
+			env->storeGlobal(left);
+		}
+		void lower(Environment *env)
+		{
+			env->emit(BC::set_global, left, env->slot(right));
+		}
+		void operands(Operands &o)
+		{
+			o.push_back(Operand(&right, Operand::Read));
 		}
-		int run(Environment *env)
+		int run(ExecutionContext *cx)
 		{
-			*env->Global(left) = *env->r.Stack(right);
+			*cx->Global(left) = *cx->r.Stack(right);
 			return 0;
 		}
 	};
 	struct cset_global : assign
 	{
 		cset_global(int l, int r) : assign(l, r){}
-		int getSize(){return 11;}
+		opcode *clone(){return new cset_global(*this);}
+		bool copy(){return false;}
 		void gen(Environment *env)
 		{
-			x86::mov_al_stack(env->Codes(), right);
-			x86::mov_mem_al(env->Codes(), env->GlobalBase() + left);
+			cpu::mov_al_stack(env->Codes(), right);
+			env->storeGlobalByte(left);
 		}
-		int run(Environment *env)
+		void lower(Environment *env)
 		{
-			*(char*)env->Global(left) = *(char*)env->r.Stack(right);
+			env->emit(BC::cset_global, left, env->slot(right));
+		}
+		void operands(Operands &o)
+		{
+			o.push_back(Operand(&right, Operand::Read | Operand::Memory | Operand::Byte));
+		}
+		int run(ExecutionContext *cx)
+		{
+			*(char*)cx->Global(left) = *(char*)cx->r.Stack(right);
 			return 0;
 		}
 	};
@@ -2058,32 +4120,52 @@ namespace IL
 	struct set_memory : assign
 	{
 		set_memory(int l, int r) : assign(l, r){}
-		int getSize(){return 14;}
+		opcode *clone(){return new set_memory(*this);}
+		bool copy(){return false;}
 		void gen(Environment *env)
 		{
-			x86::mov_eax_stack(env->Codes(), right);
-			x86::mov_ecx_stack(env->Codes(), left);
-			x86::mov_ecx_eax(env->Codes());
+			env->loadReg(cpu::eax, right);
+			env->loadReg(cpu::ecx, left);
+			cpu::mov_ecx_eax(env->Codes());
+		}
+		void lower(Environment *env)
+		{
+			env->emit(BC::set_memory, env->slot(left), env->slot(right));
+		}
+		void operands(Operands &o)
+		{
+			o.push_back(Operand(&left, Operand::Read));
+			o.push_back(Operand(&right, Operand::Read));
 		}
-		int run(Environment *env)
+		int run(ExecutionContext *cx)
 		{
-			*(int*)(*env->r.Stack(left)) = *env->r.Stack(right);
+			*cx->r.Memory(left) = *cx->r.Stack(right);
 			return 0;
 		}
 	};
 	struct cset_memory : assign
 	{
 		cset_memory(int l, int r) : assign(l, r){}
-		int getSize(){return 14;}
+		opcode *clone(){return new cset_memory(*this);}
+		bool copy(){return false;}
 		void gen(Environment *env)
 		{
-			x86::mov_eax_stack(env->Codes(), right);
-			x86::mov_ecx_stack(env->Codes(), left);
-			x86::mov_ecx_al(env->Codes());
+			env->loadReg(cpu::eax, right);
+			env->loadReg(cpu::ecx, left);
+			cpu::mov_ecx_al(env->Codes());
 		}
-		int run(Environment *env)
+		void lower(Environment *env)
 		{
-			*(char*)(*env->r.Stack(left)) = *(char*)env->r.Stack(right);
+			env->emit(BC::cset_memory, env->slot(left), env->slot(right));
+		}
+		void operands(Operands &o)
+		{
+			o.push_back(Operand(&left, Operand::Read));
+			o.push_back(Operand(&right, Operand::Read));
+		}
+		int run(ExecutionContext *cx)
+		{
+			*(char*)cx->r.Memory(left) = *(char*)cx->r.Stack(right);
 			return 0;
 		}
 	};
@@ -2091,14 +4173,22 @@ namespace IL
 	struct set_return : opcode
 	{
 		set_return(int i){r = i;}
-		int getSize(){return 6;}
+		opcode *clone(){return new set_return(*this);}
 		void gen(Environment *env)
 		{
-			x86::mov_eax_stack(env->Codes(), r);
+			env->loadReg(cpu::eax, r);
+		}
+		void lower(Environment *env)
+		{
+			env->emit(BC::set_return, env->slot(r));
+		}
+		void operands(Operands &o)
+		{
+			o.push_back(Operand(&r, Operand::Read));
 		}
-		int run(Environment *env)
+		int run(ExecutionContext *cx)
 		{
-			env->r.ret = *env->r.Stack(r);
+			cx->r.ret = *cx->r.Stack(r);
 			return 0;
 		}
 	private:
@@ -2106,16 +4196,18 @@ namespace IL
 	};
 	struct Return : opcode
 	{
-		int getSize(){return 5;}
+		opcode *clone(){return new Return(*this);}
 		void gen(Environment *env)
 		{
-			int pos = env->getCodePos(this) + getSize();
-			int j = env->getReturn() - pos;
-			x86::jmp(env->Codes(), j);
+			env->Asm().jmp(env->getReturn());
 		}
-		int run(Environment *env)
+		void lower(Environment *env)
 		{
-			env->status = Function::Return;
+			env->emit(BC::Return);
+		}
+		int run(ExecutionContext *cx)
+		{
+			cx->status = Function::Return;
 			return 0;
 		}
 	};
@@ -2123,14 +4215,23 @@ namespace IL
 	struct push : opcode
 	{
 		push(int s) : stack(s){}
-		int getSize(){return 6;}
+		opcode *clone(){return new push(*this);}
 		void gen(Environment *env)
 		{
-			x86::push_stack(env->Codes(), stack);
+			env->pushStack(stack);
+		}
+		void lower(Environment *env)
+		{
+			env->emit(BC::push, env->slot(stack));
 		}
-		int run(Environment *env)
+		void operands(Operands &o)
 		{
-			env->r.Push(*env->r.Stack(stack));
+			o.push_back(Operand(&stack, Operand::Read));
+		}
+		int run(ExecutionContext *cx)
+		{
+			if (!cx->r.Push(*cx->r.Stack(stack)))
+				cx->status = Function::End;
 			return 0;
 		}
 	private:
@@ -2143,30 +4244,31 @@ namespace IL
 			to = t;
 			func = f;
 		}
-		int getSize(){return 8;}
+		opcode *clone(){return new call(*this);}
 		void gen(Environment *env)
 		{
-			x86::mov_eax_stack(env->Codes(), func);
-			x86::call_eax(env->Codes());
+			env->loadReg(cpu::eax, func);
+			cpu::call_eax(env->Codes());
 		}
-		int run(Environment *env)
+		void lower(Environment *env)
 		{
-			int *p = (int*)*(int*)(env->r.Stack(func));
-			if (*p)
-			{
-				typedef int (*fun)(int,int,int,int,int,int,int,int,int,int,int,int,int,int,int,int);
-				fun f = (fun)p;
-				*env->r.Stack(to) = f(env->r.StackTop(1),env->r.StackTop(2),env->r.StackTop(3),env->r.StackTop(4),
-					env->r.StackTop(5),env->r.StackTop(6),env->r.StackTop(7),env->r.StackTop(8),
-					env->r.StackTop(9),env->r.StackTop(10),env->r.StackTop(11),env->r.StackTop(12),
-					env->r.StackTop(13),env->r.StackTop(14),env->r.StackTop(15),env->r.StackTop(16)
-				);
-			}
-			else
+			env->emit(BC::call, env->slot(to), env->slot(func));
+		}
+		void operands(Operands &o)
+		{
+			o.push_back(Operand(&func, Operand::Read));
+		}
+		int clobber(){return 1 << cpu::edx;}
+		int run(ExecutionContext *cx)
+		{
+			if (!cx->callNative(*cx->r.Stack(func)))
 			{
-				Function *f = (Function*)p;
-				f->call(env);
-				env->status = Environment::Function::Call;
+				Function *f = cx->Callee(*cx->r.Stack(func));
+				if (!f)
+					cx->fault = "call unknown function";
+				else if (cx->callTiered(f))
+					return 0;
+				cx->status = f && f->call(cx) ? Function::Call : Function::End;
 			}
 			return 0;
 		}
@@ -2174,17 +4276,47 @@ namespace IL
 		int func;
 		int to;
 	};
+	// 名前で呼んでる関数、呼ぶ値を作らずに直接呼ぶ
+	// 関数ポインタを通して呼ぶ時はcallの方
+	struct call_direct : opcode
+	{
+		call_direct(Function *f) : func(f){}
+		opcode *clone(){return new call_direct(*this);}
+		Function *getFunc(){return func;}
+		void gen(Environment *env)
+		{
+			cpu::call_rel(env->Codes(), env->Entry(func));
+		}
+		void lower(Environment *env)
+		{
+			env->emit(BC::call_direct, func->getHandle());
+		}
+		int clobber(){return 1 << cpu::edx;}
+		int run(ExecutionContext *cx)
+		{
+			if (!cx->callTiered(func))
+				cx->status = func->call(cx) ? Function::Call : Function::End;
+			return 0;
+		}
+	private:
+		Function *func;
+	};
 	struct pop_arg : opcode
 	{
 		pop_arg(int a) : argsize(a){}
-		int getSize(){return 6;}
+		opcode *clone(){return new pop_arg(*this);}
+		int argSize(){return argsize;}
 		void gen(Environment *env)
 		{
-			x86::add_esp_int(env->Codes(), argsize);
+			cpu::add_esp_int(env->Codes(), argsize);
+		}
+		void lower(Environment *env)
+		{
+			env->emit(BC::pop_arg, argsize);
 		}
-		int run(Environment *env)
+		int run(ExecutionContext *cx)
 		{
-			env->r.Pop(argsize);
+			cx->r.Pop(argsize);
 			return 0;
 		}
 	private:
@@ -2193,14 +4325,22 @@ namespace IL
 	struct get_return : opcode
 	{
 		get_return(int t) : to(t){}
-		int getSize(){return 6;}
+		opcode *clone(){return new get_return(*this);}
 		void gen(Environment *env)
 		{
-			x86::mov_stack_eax(env->Codes(), to);
+			env->storeReg(to, cpu::eax);
+		}
+		void lower(Environment *env)
+		{
+			env->emit(BC::get_return, env->slot(to));
+		}
+		void operands(Operands &o)
+		{
+			o.push_back(Operand(&to, Operand::Write));
 		}
-		int run(Environment *env)
+		int run(ExecutionContext *cx)
 		{
-			*env->r.Stack(to) = env->r.ret;
+			*cx->r.Stack(to) = cx->r.ret;
 			return 0;
 		}
 	private:
@@ -2208,96 +4348,622 @@ namespace IL
 	};
 	struct jump_true : opcode
 	{
-		jump_true(int s, int l){stack = s;label = l;}
-		int getSize(){return 14;}
+		jump_true(int s, int l){stack = s;label = l;target = 0;}
+		opcode *clone(){return new jump_true(*this);}
 		void gen(Environment *env)
 		{
-			x86::mov_eax_stack(env->Codes(), stack);
-			x86::test_al_al(env->Codes());
-			int l = env->Label(label);
-			int pos = env->getCodePos(this) + getSize();
-			int j = l - pos;
-			x86::jnz(env->Codes(), j);
+			if (backward(target))
+				env->genFuel();
+			env->loadReg(cpu::eax, stack);
+			cpu::test_al_al(env->Codes());
+			env->Asm().jcc(cpu::NE, label);
 		}
-		int run(Environment *env)
+		void resolve(Environment *env)
 		{
-			if (*env->r.Stack(stack))
-			{
-				int l = env->LabelIL(label);
-				int pos = env->getILPos(this) + 1;
-				int j = l - pos;
-				return j;
-			}
+			target = env->LabelIL(label);
+		}
+		int branch(){return target;}
+		int *jumpLabel(){return &label;}
+		void lower(Environment *env)
+		{
+			if (backward(target))
+				env->emit(BC::fuel);
+			env->emit(BC::jump_true, env->slot(stack));
+			env->emitTarget(target);
+		}
+		void operands(Operands &o)
+		{
+			o.push_back(Operand(&stack, Operand::Read));
+		}
+		int run(ExecutionContext *cx)
+		{
+			if (*(char*)cx->r.Stack(stack))	// boolは1byte、JITもalしか見てない
+				return target - (index + 1);
 			return 0;
 		}
 	private:
 		int stack;
 		int label;
+		int target;
 	};
 	struct jump_false : opcode
 	{
-		jump_false(int s, int l){stack = s;label = l;}
-		int getSize(){return 14;}
+		jump_false(int s, int l){stack = s;label = l;target = 0;}
+		opcode *clone(){return new jump_false(*this);}
 		void gen(Environment *env)
 		{
-			x86::mov_eax_stack(env->Codes(), stack);
-			x86::test_al_al(env->Codes());
-			int l = env->Label(label);
-			int pos = env->getCodePos(this) + getSize();
-			int j = l - pos;
-			x86::je(env->Codes(), j);
+			if (backward(target))
+				env->genFuel();
+			env->loadReg(cpu::eax, stack);
+			cpu::test_al_al(env->Codes());
+			env->Asm().jcc(cpu::E, label);
+		}
+		void resolve(Environment *env)
+		{
+			target = env->LabelIL(label);
+		}
+		int branch(){return target;}
+		int *jumpLabel(){return &label;}
+		void lower(Environment *env)
+		{
+			if (backward(target))
+				env->emit(BC::fuel);
+			env->emit(BC::jump_false, env->slot(stack));
+			env->emitTarget(target);
+		}
+		void operands(Operands &o)
+		{
+			o.push_back(Operand(&stack, Operand::Read));
+		}
+		int run(ExecutionContext *cx)
+		{
+			if (!*(char*)cx->r.Stack(stack))
+				return target - (index + 1);
+			return 0;
 		}
-		int run(Environment *env)
+	private:
+		int stack;
+		int label;
+		int target;
+	};
+	// 比較してそのまま分岐、boolを作らずにcmp + jccにする
+	// opは比較のバイトコード(BC::iltとか)、成り立つ時に飛ぶ
+	struct jump_cmp : opcode
+	{
+		jump_cmp(int o, int l, int r, int lb){op = o;left = l;right = r;label = lb;target = 0;}
+		opcode *clone(){return new jump_cmp(*this);}
+		// 成り立たない方の比較
+		static int negate(int op)
 		{
-			if (!*env->r.Stack(stack))
+			switch (op)
 			{
-				int l = env->LabelIL(label);
-				int pos = env->getILPos(this) + 1;
-				int j = l - pos;
-				return j;
+			case BC::ilt:	return BC::ige;
+			case BC::ult:	return BC::uge;
+			case BC::clt:	return BC::cge;
+			case BC::ile:	return BC::igt;
+			case BC::ule:	return BC::ugt;
+			case BC::cle:	return BC::cgt;
+			case BC::igt:	return BC::ile;
+			case BC::ugt:	return BC::ule;
+			case BC::cgt:	return BC::cle;
+			case BC::ige:	return BC::ilt;
+			case BC::uge:	return BC::ult;
+			case BC::cge:	return BC::clt;
+			case BC::ieq:	return BC::ine;
+			case BC::ceq:	return BC::cne;
+			case BC::ine:	return BC::ieq;
+			case BC::cne:	return BC::ceq;
 			}
+			return op;
+		}
+		void gen(Environment *env)
+		{
+			// 比較命令と同じ条件にする(charは符号無しで比べてる)
+			static const int cc[] = {
+				cpu::L, cpu::B, cpu::B, cpu::LE, cpu::BE, cpu::BE, cpu::G, cpu::A, cpu::A,
+				cpu::GE, cpu::AE, cpu::AE, cpu::E, cpu::E, cpu::NE, cpu::NE,
+			};
+			if (backward(target))
+				env->genFuel();
+			env->loadReg(cpu::eax, left);
+			env->loadReg(cpu::ecx, right);
+			if (isChar())
+				cpu::cmp_al_cl(env->Codes());
+			else
+				cpu::cmp_eax_ecx(env->Codes());
+			env->Asm().jcc(cc[op - BC::ilt], label);
+		}
+		void resolve(Environment *env)
+		{
+			target = env->LabelIL(label);
+		}
+		int branch(){return target;}
+		int *jumpLabel(){return &label;}
+		void lower(Environment *env)
+		{
+			if (backward(target))
+				env->emit(BC::fuel);
+			env->emit(BC::jilt + (op - BC::ilt), env->slot(left), env->slot(right));
+			env->emitTarget(target);
+		}
+		void operands(Operands &o)
+		{
+			o.push_back(Operand(&left, Operand::Read));
+			o.push_back(Operand(&right, Operand::Read));
+		}
+		int run(ExecutionContext *cx)
+		{
+			if (test(*cx->r.Stack(left), *cx->r.Stack(right)))
+				return target - (index + 1);
 			return 0;
 		}
 	private:
-		int stack;
+		bool isChar(){return op == BC::clt || op == BC::cle || op == BC::cgt || op == BC::cge || op == BC::ceq || op == BC::cne;}
+		bool test(int a, int b)
+		{
+			switch (op)
+			{
+			case BC::ilt:	return a < b;
+			case BC::ult:	return (dword)a < (dword)b;
+			case BC::clt:	return (char)a < (char)b;
+			case BC::ile:	return a <= b;
+			case BC::ule:	return (dword)a <= (dword)b;
+			case BC::cle:	return (char)a <= (char)b;
+			case BC::igt:	return a > b;
+			case BC::ugt:	return (dword)a > (dword)b;
+			case BC::cgt:	return (char)a > (char)b;
+			case BC::ige:	return a >= b;
+			case BC::uge:	return (dword)a >= (dword)b;
+			case BC::cge:	return (char)a >= (char)b;
+			case BC::ieq:	return a == b;
+			case BC::ceq:	return (char)a == (char)b;
+			case BC::ine:	return a != b;
+			case BC::cne:	return (char)a != (char)b;
+			}
+			return false;
+		}
+		int op;
+		int left;
+		int right;
 		int label;
+		int target;
 	};
 	struct jump : opcode
 	{
-		jump(int l){label = l;}
-		int getSize(){return 5;}
+		jump(int l){label = l;target = 0;}
+		opcode *clone(){return new jump(*this);}
 		void gen(Environment *env)
 		{
-			int l = env->Label(label);
-			int pos = env->getCodePos(this) + getSize();
-			int j = l - pos;
-			x86::jmp(env->Codes(), j);
+			if (backward(target))
+				env->genFuel();
+			env->Asm().jmp(label);
+		}
+		void resolve(Environment *env)
+		{
+			target = env->LabelIL(label);
+		}
+		int branch(){return target;}
+		int *jumpLabel(){return &label;}
+		void lower(Environment *env)
+		{
+			env->emit(backward(target) ? BC::loop : BC::jump);
+			env->emitTarget(target);
 		}
-		int run(Environment *env)
+		int run(ExecutionContext *cx)
 		{
-			int l = env->LabelIL(label);
-			int pos = env->getILPos(this) + 1;
-			int j = l - pos;
-			return j;
+			return target - (index + 1);
 		}
 	private:
 		int label;
+		int target;
 	};
 	struct end : opcode
 	{
-		int getSize(){return 4;}
+		opcode *clone(){return new end(*this);}
 		void gen(Environment *env)
 		{
-			x86::mov_esp_ebp(env->Codes());
-			x86::pop_ebp(env->Codes());
-			x86::retn(env->Codes());
+			env->genLeave();
+		}
+		void lower(Environment *env)
+		{
+			env->emit(BC::end);
 		}
-		int run(Environment *env)
+		int run(ExecutionContext *cx)
 		{
-			env->status = Function::Return;
+			cx->status = Function::Return;
 			return 0;
 		}
 	};
+
+	// 関数の展開
+	// 呼んでる先が小さい葉関数なら、積んでた引数を一時変数への代入にして中身をそのまま埋め込む
+	// 展開した関数のローカル変数と引数は呼ぶ側の枠の下に呼び出しごとに置く
+	inline void Environment::Function::expand(Environment *env)
+	{
+		if (env->inline_size <= 0 || env->inline_budget <= 0)
+			return;
+		newState();
+		int budget = env->inline_budget;
+		int n = code.size();
+		int old = labels;
+		vector<int> at(n + 1);
+		vector<int> pushed;	// 積んだ引数の展開後の位置
+		Code out;
+		for (int i = 0; i < n; i++)
+		{
+			at[i] = out.size();
+			if (dynamic_cast<push*>(code[i].get()))
+				pushed.push_back(out.size());
+			call_direct *c = dynamic_cast<call_direct*>(code[i].get());
+			pop_arg *p = c && i + 2 < n ? dynamic_cast<pop_arg*>(code[i + 1].get()) : NULL;
+			get_return *g = p ? dynamic_cast<get_return*>(code[i + 2].get()) : NULL;
+			if (!g)
+			{
+				out.push_back(code[i]);
+				continue;
+			}
+			int args = std::min(p->argSize() / 4, (int)pushed.size());
+			Function *f = c->getFunc();
+			if (f == this || !f->resolved || f->getArgs() != args ||
+				(int)f->code.size() > env->inline_size || (int)f->code.size() > budget || !f->inlinable())
+			{
+				pushed.resize(pushed.size() - args);
+				out.push_back(code[i]);
+				continue;
+			}
+			budget -= f->code.size();
+
+			int base = (localstack + maxstack + 3) / 4 * 4;
+			int frame = (f->localstack + f->maxstack + 3) / 4 * 4;
+			maxstack = base + frame + 4 * args - localstack;
+			std::map<int, int> slot;	// 展開する関数の場所→呼ぶ側の場所
+			for (int a = 0; a < args; a++)
+			{
+				int arg = -(base + frame + 4 * (a + 1));
+				slot[8 + 4 * a] = arg;
+				// 最後に積んだのが最初の引数
+				int pos = pushed[pushed.size() - 1 - a];
+				Operands o;
+				out[pos]->operands(o);
+				out[pos] = new assign(arg, *o[0].slot);
+			}
+			pushed.resize(pushed.size() - args);
+			// 展開した関数のローカル変数も呼ぶたびに0から(中間言語実行で関数に入る時と同じ)
+			// 先に書いてから読んでるなら、後で要らない代入として消える
+			for (int k = 4; k <= (f->localstack + 3) / 4 * 4; k += 4)
+				out.push_back(new getInt(-(base + k), 0));
+			Operands ret;
+			g->operands(ret);
+			int to = *ret[0].slot;
+
+			// 展開する関数のラベルは呼ぶ側で取り直す、最後のは戻る所
+			vector<int> lb(f->labels + 1);
+			for (int l = 0; l <= f->labels; l++)
+				lb[l] = getLabel();
+			vector<int> fat(f->code.size() + 1);
+			for (int j = 0; j < (int)f->code.size(); j++)
+			{
+				fat[j] = out.size();
+				opcode *op = f->code[j].get();
+				if (dynamic_cast<end*>(op))
+					continue;
+				if (dynamic_cast<IL::Return*>(op))
+				{
+					if (j + 1 != f->return_il)
+						out.push_back(new jump(lb[f->labels]));
+					continue;
+				}
+				// 戻り値は呼んだ側のget_returnの場所に直接置く
+				opcode *e = dynamic_cast<set_return*>(op) ? new assign(to, 0) : op->clone();
+				Operands o;
+				op->operands(o);
+				Operands eo;
+				e->operands(eo);
+				for (int k = 0; k < (int)o.size(); k++)
+				{
+					int v = *o[k].slot;
+					*eo[eo.size() - o.size() + k].slot = v < 0 ? v - base : slot[v];
+				}
+				if (int *l = e->jumpLabel())
+					*l = lb[*l];
+				out.push_back(e);
+			}
+			fat[f->code.size()] = out.size();
+			for (int l = 0; l < f->labels; l++)
+				label[lb[l]] = fat[f->label[l]];
+			label[lb[f->labels]] = fat[f->return_il];
+			env->inlined.push_back(Inlined(name, f->name));
+
+			// pop_argとget_returnはいらない
+			at[++i] = out.size();
+			at[++i] = out.size();
+		}
+		at[n] = out.size();
+		if ((int)out.size() == n && labels == old)
+			return;
+		code.swap(out);
+		for (int l = 0; l < old; l++)
+			label[l] = at[label[l]];
+		return_il = at[return_il];
+		for (int i = 0; i < (int)code.size(); i++)
+			code[i]->index = i;
+	}
+	// 末尾の自分呼び出し
+	// return f(...)で自分を呼んでるなら、引数を自分の引数の場所に書き直して頭に飛ぶ
+	// 引数の式が今の引数を読むかもしれないので、積んでたのは一旦一時変数に取っておいてから書く
+	// ローカル変数の番地を取ってる関数は、前の呼び出しの場所を指されてるかもしれないのでやらない
+	inline void Environment::Function::tailcall(Environment *env)
+	{
+		for (Code::iterator it = code.begin(); it != code.end(); ++it)
+		{
+			Operands o;
+			(*it)->operands(o);
+			for (Operands::iterator o_it = o.begin(); o_it != o.end(); ++o_it)
+				if ((o_it->flags & Operand::Memory) && !isTemp(*o_it->slot))
+					return;
+		}
+
+		int n = code.size();
+		// ラベルが指してる所は消さない
+		vector<bool> labeled(n + 1);
+		for (int l = 0; l < labels; l++)
+			labeled[label[l]] = true;
+		labeled[return_il] = true;
+
+		vector<int> at(n + 1);
+		vector<int> pushed;	// 積んだ引数の書き直した後の位置
+		Code out;
+		int start = -1;
+		int base = 0;
+		for (int i = 0; i < n; i++)
+		{
+			at[i] = out.size();
+			if (dynamic_cast<push*>(code[i].get()))
+				pushed.push_back(out.size());
+			call_direct *c = dynamic_cast<call_direct*>(code[i].get());
+			pop_arg *p = c && i + 3 < n ? dynamic_cast<pop_arg*>(code[i + 1].get()) : NULL;
+			get_return *g = p ? dynamic_cast<get_return*>(code[i + 2].get()) : NULL;
+			if (!g)
+			{
+				out.push_back(code[i]);
+				continue;
+			}
+			int args = std::min(p->argSize() / 4, (int)pushed.size());
+			Operands ret;
+			g->operands(ret);
+			// 後ろが戻り値をそのまま返してるか、何も返さない関数で戻るだけ
+			int tail = 0;
+			if (set_return *s = dynamic_cast<set_return*>(code[i + 3].get()))
+			{
+				Operands o;
+				s->operands(o);
+				if (*o[0].slot == *ret[0].slot && i + 4 < n && dynamic_cast<IL::Return*>(code[i + 4].get()))
+					tail = 2;
+			}
+			else if (this->ret->isP(ValueType::Void))
+			{
+				if (dynamic_cast<IL::Return*>(code[i + 3].get()))
+					tail = 1;
+				else if (dynamic_cast<end*>(code[i + 3].get()))
+					tail = -1;
+			}
+			if (!tail || c->getFunc() != this || getArgs() != args)
+			{
+				pushed.resize(pushed.size() - args);
+				out.push_back(code[i]);
+				continue;
+			}
+			if (start < 0)
+			{
+				start = getLabel();
+				label[start] = 0;
+				base = (localstack + maxstack + 3) / 4 * 4;
+				maxstack = base + 4 * args - localstack;
+			}
+			for (int a = 0; a < args; a++)
+			{
+				// 最後に積んだのが最初の引数
+				int pos = pushed[pushed.size() - 1 - a];
+				Operands o;
+				out[pos]->operands(o);
+				out[pos] = new assign(-(base + 4 * (a + 1)), *o[0].slot);
+			}
+			pushed.resize(pushed.size() - args);
+			for (int a = 0; a < args; a++)
+				out.push_back(new assign(8 + 4 * a, -(base + 4 * (a + 1))));
+			// ローカル変数は呼び直した時と同じく0から
+			for (int k = 4; k <= (localstack + 3) / 4 * 4; k += 4)
+				out.push_back(new getInt(-k, 0));
+			out.push_back(new jump(start));
+
+			// pop_argとget_returnはいらない、戻る所もどこからも飛んで来ないなら消す
+			at[++i] = out.size();
+			at[++i] = out.size();
+			for (int k = 0; k < tail && !labeled[i + 1]; k++)
+				at[++i] = out.size();
+		}
+		at[n] = out.size();
+		if (start < 0)
+			return;
+		code.swap(out);
+		for (int l = 0; l < labels; l++)
+			label[l] = at[label[l]];
+		return_il = at[return_il];
+		for (int i = 0; i < (int)code.size(); i++)
+			code[i]->index = i;
+	}
+	// 一時変数の場所の割り当て直し
+	// 文ごとに取ってた場所を、生きてる間が重ならない一時変数同士で使い回してフレームを小さくする
+	// 1byteしか書かない一時変数(charとbool)は4byteずつではなく1byteずつ詰める
+	// 番地を取られてる一時変数はどこから触られるか分からないので、他とは重ねない
+	inline void Environment::Function::color()
+	{
+		int n = code.size();
+		int top = (localstack + 3) / 4 * 4;	// 一時変数はここから下に置き直す
+		vector<Operands> ops(n);
+		std::map<int, int> width;	// 一時変数→大きさ、1byteで書くだけなら1
+		std::set<int> pinned;
+		vector<int> order;			// 出てくる順
+		for (int i = 0; i < n; i++)
+		{
+			code[i]->operands(ops[i]);
+			for (Operands::iterator it = ops[i].begin(); it != ops[i].end(); ++it)
+			{
+				int s = *it->slot;
+				if (!isTemp(s))
+					continue;
+				if (!width.count(s))
+				{
+					width[s] = 0;
+					order.push_back(s);
+				}
+				if (!(it->flags & (Operand::Read | Operand::Write)))
+					pinned.insert(s);
+				if (it->flags & Operand::Write)
+					width[s] = (it->flags & Operand::Byte) && width[s] < 4 ? 1 : 4;
+			}
+		}
+		if (order.empty())
+			return;
+		for (std::map<int, int>::iterator it = width.begin(); it != width.end(); ++it)
+			if (!it->second || pinned.count(it->first))
+				it->second = 4;
+
+		// ブロック単位で生きてる一時変数を求める
+		vector<int> block, first;
+		int blocks = split(block, first);
+		vector<std::set<int> > in(blocks), out(blocks);
+		bool changed = true;
+		while (changed)
+		{
+			changed = false;
+			for (int b = blocks - 1; b >= 0; b--)
+			{
+				std::set<int> live;
+				int last = first[b + 1] - 1;
+				int t = code[last]->branch();
+				if (t >= 0 && block[t] < blocks)
+					live.insert(in[block[t]].begin(), in[block[t]].end());
+				if (b + 1 < blocks)
+					live.insert(in[b + 1].begin(), in[b + 1].end());
+				out[b] = live;
+				for (int i = last; i >= first[b]; i--)
+					occupy(ops[i], live);
+				if (live != in[b])
+				{
+					in[b] = live;
+					changed = true;
+				}
+			}
+		}
+
+		// 書く所で生きてる一時変数と、同じ命令で読む一時変数とは重ねられない
+		std::map<int, std::set<int> > conflict;
+		for (int b = 0; b < blocks; b++)
+		{
+			std::set<int> live = out[b];
+			for (int i = first[b + 1] - 1; i >= first[b]; i--)
+			{
+				std::set<int> busy = live;
+				for (Operands::iterator it = ops[i].begin(); it != ops[i].end(); ++it)
+					if ((it->flags & Operand::Read) && isTemp(*it->slot))
+						busy.insert(*it->slot);
+				for (Operands::iterator it = ops[i].begin(); it != ops[i].end(); ++it)
+				{
+					int w = *it->slot;
+					if (!(it->flags & Operand::Write) || !isTemp(w))
+						continue;
+					for (std::set<int>::iterator l = busy.begin(); l != busy.end(); ++l)
+					{
+						if (*l == w)
+							continue;
+						conflict[w].insert(*l);
+						conflict[*l].insert(w);
+					}
+				}
+				occupy(ops[i], live);
+			}
+			// 書かずに読んでるものは関数の頭から一緒に生きてる
+			if (b == 0)
+				for (std::set<int>::iterator l = live.begin(); l != live.end(); ++l)
+					conflict[*l].insert(live.begin(), live.end());
+		}
+		for (std::set<int>::iterator p = pinned.begin(); p != pinned.end(); ++p)
+		{
+			for (vector<int>::iterator t = order.begin(); t != order.end(); ++t)
+			{
+				conflict[*p].insert(*t);
+				conflict[*t].insert(*p);
+			}
+		}
+
+		// 出てくる順に、重なる相手が使ってない一番上に置く
+		std::map<int, int> at;	// 一時変数→topからのバイト位置
+		int size = 0;
+		for (vector<int>::iterator t = order.begin(); t != order.end(); ++t)
+		{
+			int w = width[*t];
+			std::set<int> &c = conflict[*t];
+			int o = 0;
+			bool moved = true;
+			while (moved)
+			{
+				moved = false;
+				for (std::set<int>::iterator it = c.begin(); it != c.end(); ++it)
+				{
+					if (*it == *t || !at.count(*it))
+						continue;
+					int a = at[*it], e = a + width[*it];
+					if (o < e && a < o + w)
+					{
+						o = (e + w - 1) / w * w;
+						moved = true;
+					}
+				}
+			}
+			at[*t] = o;
+			size = std::max(size, o + w);
+		}
+		int frame = top + (size + 3) / 4 * 4;
+		if (frame >= localstack + maxstack)
+			return;
+
+		for (int i = 0; i < n; i++)
+		{
+			for (Operands::iterator it = ops[i].begin(); it != ops[i].end(); ++it)
+			{
+				std::map<int, int>::iterator a = at.find(*it->slot);
+				if (a != at.end())
+					*it->slot = -(top + a->second + width[a->first]);
+			}
+		}
+		maxstack = frame - localstack;
+	}
+	// 書いた一時変数は前では死んでて、読んだ一時変数は前で生きてる
+	inline void Environment::Function::occupy(const Operands &o, std::set<int> &live)
+	{
+		for (Operands::const_iterator it = o.begin(); it != o.end(); ++it)
+			if ((it->flags & Operand::Write) && isTemp(*it->slot))
+				live.erase(*it->slot);
+		for (Operands::const_iterator it = o.begin(); it != o.end(); ++it)
+			if ((it->flags & Operand::Read) && isTemp(*it->slot))
+				live.insert(*it->slot);
+	}
+	// 他を呼ばなくて、番地を取ったりバイト単位で触ったりしてない
+	inline bool Environment::Function::inlinable()
+	{
+		for (Code::iterator it = code.begin(); it != code.end(); ++it)
+		{
+			if (dynamic_cast<IL::call*>(it->get()) || dynamic_cast<call_direct*>(it->get()))
+				return false;
+			Operands o;
+			(*it)->operands(o);
+			for (Operands::iterator o_it = o.begin(); o_it != o.end(); ++o_it)
+				if (o_it->flags & Operand::Memory)
+					return false;
+		}
+		return true;
+	}
 }
 
 }
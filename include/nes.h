@@ -7,9 +7,13 @@ namespace NES
 {
 	typedef shptr<IL::Environment> Environment;
 	typedef IL::Environment::Native Native;
+	typedef IL::ExecutionContext ExecutionContext;	// スレッドごとの実行状態
+	typedef IL::Instance Instance;	// グローバル変数だけ別々に持つ実行単位
 	struct nes
 	{
-		static Environment compile_IL(const std::string &s)
+		// optimizeをfalseにすると中間言語を組み立てたままにする
+		// inline_budgetは1つの関数に展開していい中間言語の数、0なら展開しない
+		static Environment compile_IL(const std::string &s, bool optimize = true, int inline_budget = 128)
 		{
 			Tokenizer t(s);
 			Parser p(&t);
@@ -17,14 +21,14 @@ namespace NES
 			if (!ns)
 				return NULL;
 			AST::Environment env(ns);
-			Environment ienv = env.gen();
+			Environment ienv = env.gen(optimize, inline_budget);
 			if (!ienv)
 				return NULL;
 			return ienv;
 		};
-		static Native compile(const std::string &s)
+		static Native compile(const std::string &s, bool optimize = true, int inline_budget = 128)
 		{
-			Environment ienv = compile_IL(s);
+			Environment ienv = compile_IL(s, optimize, inline_budget);
 			if (!ienv)
 				return NULL;
 			IL::Environment::Native na = ienv->gen();
@@ -3,246 +3,357 @@
 
 #include <string>
 #include <algorithm>
+#include <vector>
+#include <map>
 #include <cstdio>
+#include <cstdlib>
 
 #include "ast.h"
 
 namespace NES{
 
+struct Token
+{
+	enum Kind
+	{
+		End,
+		Unknown,
+		Identifier,
+		Int,
+		Float,
+		Char,
+		String,
+
+		// keyword
+		Def,
+		Var,
+		If,
+		Else,
+		While,
+		Return,
+		Continue,
+		Break,
+		Namespace,
+		Typedef,
+		Struct,
+		Union,
+		Enum,
+
+		// operator
+		LParen,		// (
+		RParen,		// )
+		LBrace,		// {
+		RBrace,		// }
+		LBracket,	// [
+		RBracket,	// ]
+		Comma,		// ,
+		Semicolon,	// ;
+		Colon,		// :
+		Dot,		// .
+		Question,	// ?
+		Inc,		// ++
+		Dec,		// --
+		Plus,		// +
+		Minus,		// -
+		Star,		// *
+		Slash,		// /
+		Percent,	// %
+		SHL,		// <<
+		SHR,		// >>
+		Amp,		// &
+		Caret,		// ^
+		Pipe,		// |
+		Tilde,		// ~
+		Not,		// !
+		LT,			// <
+		LE,			// <=
+		GT,			// >
+		GE,			// >=
+		EQ,			// ==
+		NE,			// !=
+		AndAnd,		// &&
+		OrOr,		// ||
+		Assign,		// =
+		AddAssign,	// +=
+		SubAssign,	// -=
+		MulAssign,	// *=
+		DivAssign,	// /=
+		ModAssign,	// %=
+		SHLAssign,	// <<=
+		SHRAssign,	// >>=
+		ANDAssign,	// &=
+		XORAssign,	// ^=
+		ORAssign,	// |=
+	};
+	Kind kind;
+	int line;
+	int column;
+	int id;		// Identifier, String : 名前表の番号
+	int i;		// Int, Char
+	float f;	// Float
+};
+
+// 最初に全部字句解析してTokenの列にしておく
+// パーサは先頭のTokenを見て分岐するだけ
 class Tokenizer
 {
 public:
 	typedef std::string string;
+	typedef string::size_type size_type;
 	Tokenizer(const string &s) : str(s)
 	{
+		static const char *keywords[] = {"def", "var", "if", "else", "while", "return", "continue", "break",
+										"namespace", "typedef", "struct", "union", "enum"};
+		for (int i = 0; i < (int)(sizeof(keywords)/sizeof(*keywords)); ++i)
+			intern(keywords[i]);
+		pos = 0;
 		line = 1;
+		line_head = 0;
+		Lex();
+		str = string();
+		cur = 0;
 	}
-	bool isEnd()
-	{
-		skipSpace();
-		return str.length() == 0;
-	}
-	void skipToLineEnd()
+	const Token &peek()				{return tokens[cur];}
+	const Token &next()
 	{
-		string::size_type pos = str.find_first_of("\n");
-		if (pos == string::npos)
-			str.resize(0);
-		else
-		{
-			substr(pos);
-			if (str.length())
-			{
-				line++;
-				substr(1);
-			}
-		}
+		const Token &tk = tokens[cur];
+		if (tk.kind != Token::End)
+			cur++;
+		return tk;
 	}
-	bool Keyword(const string &s)
+	bool is(Token::Kind k)			{return tokens[cur].kind == k;}
+	bool accept(Token::Kind k)
 	{
-		skipSpace();
-		bool r = std::equal(s.begin(), s.end(), str.begin());
-		if (r)
-		{
-			char c = str[s.length()];
-			if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c == '_') || (c >= '0' && c <= '9'))
-				return false;
-			str = str.substr(s.length());
-		}
-		return r;
-	}
-	bool Operator(const string &s, const string &e = "")
-	{
-		skipSpace();
-		return check(s, e);
-	}
-	bool isFloat()
-	{
-		skipSpace();
-		if (isEnd())
-			return false;
-		char *e;
-		double d = strtod(str.c_str(), &e);
-		if (str.c_str() == e)
+		if (tokens[cur].kind != k)
 			return false;
-		for (const char *c = str.c_str(); c < e; ++c)
-		{
-			if (*c < '0' || *c > '9')
-				return true;
-		}
-		return false;
+		cur++;
+		return true;
 	}
-	float getFloat()
+	bool isEnd()					{return is(Token::End);}
+	void skipToLineEnd()
 	{
-		skipSpace();
-		char *e;
-		double d = strtod(str.c_str(), &e);
-		str = str.substr(e - str.c_str());
-		return d;
+		int l = peek().line;
+		while (!isEnd() && peek().line == l)
+			cur++;
 	}
-	bool isInt()
+	const string &getName(int id)	{return names[id];}
+	string getIdentifier()			{return is(Token::Identifier) ? names[next().id] : string();}
+	int getLine()					{return peek().line;}
+	int getColumn()					{return peek().column;}
+	int size()						{return (int)tokens.size();}
+private:
+	string str;
+	size_type pos;
+	int line;
+	size_type line_head;
+	std::vector<Token> tokens;
+	size_type cur;
+	std::vector<string> names;
+	std::map<string, int> name_id;
+
+	int intern(const string &s)
 	{
-		skipSpace();
-		if (isEnd())
-			return false;
-		char c = str[0];
-		return ((c >= '0' && c <= '9'));
+		std::map<string, int>::iterator it = name_id.find(s);
+		if (it != name_id.end())
+			return it->second;
+		int id = (int)names.size();
+		names.push_back(s);
+		name_id[s] = id;
+		return id;
 	}
-	int getInt()
+	char at(size_type i)	{return pos + i < str.length() ? str[pos + i] : '\0';}
+	static bool isAlpha(char c)	{return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c == '_');}
+	static bool isDigit(char c)	{return (c >= '0' && c <= '9');}
+	void advance(size_type n)
 	{
-		skipSpace();
-		int n = 0;
-		int pos = 0;
-		char c = str[pos];
-		while ((c >= '0' && c <= '9'))
+		// 改行を数えながら進める
+		size_type e = std::min(pos + n, str.length());
+		for (; pos < e; ++pos)
 		{
-			n = (n * 10) + (c - '0');
-			c = str[++pos];
+			if (str[pos] == '\n')
+			{
+				line++;
+				line_head = pos + 1;
+			}
 		}
-		str = str.substr(pos);
-		return n;
 	}
-	bool isChar()
-	{
-		skipSpace();
-		if (str.length() > 3 && str[0] == '\'' && str[1] == '\\' && str[3] == '\'')
-			return true;
-		if (str.length() > 2 && str[0] == '\'' && str[2] == '\'')
-			return true;
-		return false;
-	}
-	char getChar()
+	void skipSpace()
 	{
-		skipSpace();
-		char c;
-		if (str.length() > 3 && str[0] == '\'' && str[1] == '\\' && str[3] == '\'')
-		{
-			c = str[2];
-			if (c == '0')
-				c = 0;
-			else if (c == 'n')
-				c = '\n';
-			str = str.substr(4);
-		}
-		else if (str.length() > 2 && str[0] == '\'' && str[2] == '\'')
+		size_type len = str.length();
+		while (pos < len)
 		{
-			c = str[1];
-			str = str.substr(3);
+			char c = str[pos];
+			if (c == ' ' || c == '\t' || c == '\r' || c == '\n')
+			{
+				advance(1);
+			}
+			else if (c == '/' && at(1) == '/')
+			{
+				size_type p = str.find('\n', pos);
+				advance(p == string::npos ? len - pos : p + 1 - pos);
+			}
+			else if (c == '/' && at(1) == '*')
+			{
+				size_type p = str.find("*/", pos + 2);
+				if (p == string::npos)
+				{
+					std::printf("token error: comment is not closed\n");
+					advance(len - pos);
+					break;
+				}
+				advance(p + 2 - pos);
+			}
+			else
+			{
+				break;
+			}
 		}
-		return c;
 	}
-	bool isString()
+	void Lex()
 	{
-		skipSpace();
-		if (isEnd())
-			return false;
-		return str[0] == '"';
-	}
-	string getString()
-	{
-		skipSpace();
-		if (str[0] != '"')
+		tokens.reserve(str.length() / 4 + 1);
+		while (true)
 		{
-			return string();
+			skipSpace();
+			Token tk;
+			tk.line = line;
+			tk.column = (int)(pos - line_head) + 1;
+			tk.id = 0;
+			tk.i = 0;
+			tk.f = 0;
+			if (pos >= str.length())
+			{
+				tk.kind = Token::End;
+				tokens.push_back(tk);
+				break;
+			}
+			size_type len = LexOne(tk);
+			advance(len);
+			tokens.push_back(tk);
 		}
-		string::size_type pos = str.find_first_of('"', 1);
-		string s = str.substr(1, pos-1);
-		str = str.substr(pos+1);
-		return s;
-	}
-	bool isIdentifier()
-	{
-		skipSpace();
-		if (isEnd())
-			return false;
-		char c = str[0];
-		return ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c == '_'));
 	}
-	string getIdentifier()
+	// tkを埋めて、読んだ文字数を返す
+	size_type LexOne(Token &tk)
 	{
-		skipSpace();
-		char c = str[0];
-		if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c == '_')))
-		{
-			return string();
-		}
-		string::size_type pos = str.find_first_not_of("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_0123456789");
-		string name;
-		if (pos == string::npos)
+		char c = str[pos];
+		if (isAlpha(c))
 		{
-			name = str;
-			str.resize(0);
+			size_type p = pos + 1;
+			while (p < str.length() && (isAlpha(str[p]) || isDigit(str[p])))
+				++p;
+			tk.id = intern(str.substr(pos, p - pos));
+			tk.kind = tk.id < Token::LParen - Token::Def ? (Token::Kind)(Token::Def + tk.id) : Token::Identifier;
+			return p - pos;
 		}
-		else
+		if (isDigit(c))
 		{
-			name = str.substr(0, pos);
-			str = str.substr(pos);
+			const char *b = str.c_str() + pos;
+			char *e;
+			double d = std::strtod(b, &e);
+			for (const char *p = b; p < e; ++p)
+			{
+				if (!isDigit(*p))
+				{
+					tk.kind = Token::Float;
+					tk.f = d;
+					return e - b;
+				}
+			}
+			size_type p = pos;
+			while (p < str.length() && isDigit(str[p]))
+			{
+				tk.i = (tk.i * 10) + (str[p] - '0');
+				++p;
+			}
+			tk.kind = Token::Int;
+			return p - pos;
 		}
-		return name;
-	}
-	int getLine(){return line;}
-private:
-	string str;
-	int line;
-	bool check(const string &s, const string &e = "")
-	{
-		bool r = std::equal(s.begin(), s.end(), str.begin());
-		if (r)
+		switch (c)
 		{
-			if (e.find_first_of(str[s.length()]) != string::npos)
+		case '\'':
+			tk.kind = Token::Char;
+			if (at(1) == '\\' && at(3) == '\'')
 			{
-				return false;
+				char e = at(2);
+				tk.i = e == '0' ? '\0' : e == 'n' ? '\n' : e;
+				return 4;
 			}
-			str = str.substr(s.length());
-		}
-		return r;
+			if (at(1) && at(2) == '\'')
+			{
+				tk.i = at(1);
+				return 3;
+			}
+			tk.kind = Token::Unknown;
+			return 1;
+		case '"':
+			{
+				size_type p = str.find('"', pos + 1);
+				if (p == string::npos)
+					p = str.length();
+				tk.kind = Token::String;
+				tk.id = intern(str.substr(pos + 1, p - pos - 1));
+				return p + 1 - pos;
+			}
+		case '(': tk.kind = Token::LParen;		return 1;
+		case ')': tk.kind = Token::RParen;		return 1;
+		case '{': tk.kind = Token::LBrace;		return 1;
+		case '}': tk.kind = Token::RBrace;		return 1;
+		case '[': tk.kind = Token::LBracket;	return 1;
+		case ']': tk.kind = Token::RBracket;	return 1;
+		case ',': tk.kind = Token::Comma;		return 1;
+		case ';': tk.kind = Token::Semicolon;	return 1;
+		case ':': tk.kind = Token::Colon;		return 1;
+		case '.': tk.kind = Token::Dot;			return 1;
+		case '?': tk.kind = Token::Question;	return 1;
+		case '~': tk.kind = Token::Tilde;		return 1;
+		case '+': return op(tk, Token::Plus,	'+', Token::Inc,	Token::AddAssign);
+		case '-': return op(tk, Token::Minus,	'-', Token::Dec,	Token::SubAssign);
+		case '&': return op(tk, Token::Amp,		'&', Token::AndAnd,	Token::ANDAssign);
+		case '|': return op(tk, Token::Pipe,	'|', Token::OrOr,	Token::ORAssign);
+		case '*': return op(tk, Token::Star,	0, Token::Unknown,	Token::MulAssign);
+		case '/': return op(tk, Token::Slash,	0, Token::Unknown,	Token::DivAssign);
+		case '%': return op(tk, Token::Percent,	0, Token::Unknown,	Token::ModAssign);
+		case '^': return op(tk, Token::Caret,	0, Token::Unknown,	Token::XORAssign);
+		case '!': return op(tk, Token::Not,		0, Token::Unknown,	Token::NE);
+		case '=': return op(tk, Token::Assign,	0, Token::Unknown,	Token::EQ);
+		case '<':
+			if (at(1) == '<')
+				return op2(tk, Token::SHL, Token::SHLAssign);
+			return op(tk, Token::LT, 0, Token::Unknown, Token::LE);
+		case '>':
+			if (at(1) == '>')
+				return op2(tk, Token::SHR, Token::SHRAssign);
+			return op(tk, Token::GT, 0, Token::Unknown, Token::GE);
+		}
+		tk.kind = Token::Unknown;
+		return 1;
 	}
-	void substr(string::size_type p)
+	// c, cc, c=
+	size_type op(Token &tk, Token::Kind single, char c2, Token::Kind twice, Token::Kind with_eq)
 	{
-		for (string::size_type i = 0; i < p; ++i)
+		if (c2 && at(1) == c2)
 		{
-			if (str[i] == '\n')
-				line++;
+			tk.kind = twice;
+			return 2;
 		}
-		str = str.substr(p);
+		if (at(1) == '=')
+		{
+			tk.kind = with_eq;
+			return 2;
+		}
+		tk.kind = single;
+		return 1;
 	}
-	void skipSpace()
+	// cc, cc=
+	size_type op2(Token &tk, Token::Kind twice, Token::Kind with_eq)
 	{
-		string::size_type p = 0;
-		while ((p = str.find_first_not_of(" \t\r\n")) != string::npos)
+		if (at(2) == '=')
 		{
-			substr(p);
-			if (check("//"))
-			{
-				p = str.find_first_of("\n");
-				if (p == string::npos)
-					break;
-				p = p + 1;
-				substr(p);
-				continue;
-			}
-			else if (check("/*"))
-			{
-				while ((p = str.find_first_of("*")) != string::npos)
-				{
-					if (str[p+1] == '/')
-					{
-						p = p + 2;
-						substr(p);
-						break;
-					}
-				}
-				if (p == string::npos)
-				{
-					std::printf("token error: comment is not closed\n");
-				}
-			}
-			else
-			{
-				break;
-			}
+			tk.kind = with_eq;
+			return 3;
 		}
-		if (p == string::npos)
-			substr(str.length());
+		tk.kind = twice;
+		return 2;
 	}
 };
 class Parser
@@ -252,6 +363,7 @@ public:
 	{
 		t = t_;
 		errors = 0;
+		initBinary();
 	}
 	shptr<AST::NameSpace> Parse()
 	{
@@ -278,38 +390,38 @@ private:
 	int errors;
 	void err(const string &s)
 	{
-		std::printf("parser %d: %s\n", t->getLine(), s.c_str());
+		std::printf("parser %d:%d: %s\n", t->getLine(), t->getColumn(), s.c_str());
 		errors++;
 	}
 	AST::Type ParseTypeName()
 	{
-		if (!t->isIdentifier())
+		if (!t->is(Token::Identifier))
 		{
 			err("no type name");
 			t->skipToLineEnd();
 			return NULL;
 		}
 		string name = t->getIdentifier();
-		if (t->Operator("."))
+		if (t->accept(Token::Dot))
 			return new AST::NameSpaceQualifier(name, ParseTypeName());
 		else
 			return new AST::TypeName(name);
 	}
 	AST::Type ParseType()
 	{
-		if (t->Operator("("/*)*/))
+		if (t->accept(Token::LParen))
 		{
 			// func ptr
 			shptr<std::vector<AST::Type> > arg = new std::vector<AST::Type>();
 
-			if (!t->Operator(/*(*/")"))
+			if (!t->accept(Token::RParen))
 			{
 				do
 				{
 					AST::Type type = ParseType();
 					arg->push_back(type);
-				} while (t->Operator(","));
-				if (!t->Operator(/*(*/")"))
+				} while (t->accept(Token::Comma));
+				if (!t->accept(Token::RParen))
 				{
 					err("func-ptr(arg) is not closed");
 					return NULL;
@@ -319,7 +431,7 @@ private:
 			{
 				// no argument
 			}
-			if (!t->Operator(":"))
+			if (!t->accept(Token::Colon))
 			{
 				err("func-ptr need ':' before return type");
 				return NULL;
@@ -330,11 +442,10 @@ private:
 		AST::Type type = ParseTypeName();
 		while (true)
 		{
-			if (t->Operator("["))
+			if (t->accept(Token::LBracket))
 			{
-				t->isInt();
-				int n = t->getInt();
-				if (!t->Operator("]"))
+				int n = t->is(Token::Int) ? t->next().i : 0;
+				if (!t->accept(Token::RBracket))
 				{
 					err("array[] is not closed");
 					t->skipToLineEnd();
@@ -342,7 +453,7 @@ private:
 				}
 				type = new AST::Array(type, n);
 			}
-			else if (t->Operator("*"))
+			else if (t->accept(Token::Star))
 			{
 				type = new AST::Pointer(type);
 			}
@@ -355,7 +466,7 @@ private:
 	}
 	template<class T/* = AST::VarInfo*/>Var ParseDecVar()
 	{
-		if (!t->isIdentifier())
+		if (!t->is(Token::Identifier))
 		{
 			err("need identifier for variable name");
 			t->skipToLineEnd();
@@ -363,12 +474,12 @@ private:
 		}
 		string name = t->getIdentifier();
 		AST::Type type;
-		if (t->Operator(":"))
+		if (t->accept(Token::Colon))
 		{
 			type = ParseType();
 		}
 		Exp e;
-		if (t->Operator("="))
+		if (t->accept(Token::Assign))
 		{
 			e = ParseExpression();
 		}
@@ -378,7 +489,7 @@ private:
 	{
 		AST::Statements *stm = new AST::Statements();
 		State s = stm;
-		while (!t->Operator(/*{*/"}"))
+		while (!t->accept(Token::RBrace))
 		{
 			if (t->isEnd())
 			{
@@ -392,18 +503,19 @@ private:
 	Args ParseArgumentsList()
 	{
 		Args args = new std::vector<Var>;
-		if (t->Keyword("void"))
+		if (t->is(Token::Identifier) && t->getName(t->peek().id) == "void")
 		{
+			t->next();
 			return args;
 		}
-		if (!t->isIdentifier())
+		if (!t->is(Token::Identifier))
 		{
 			// 引数無し
 			return args;
 		}
 		do
 		{
-			if (t->isIdentifier())
+			if (t->is(Token::Identifier))
 			{
 				Var v = ParseDecVar<AST::Argument>();
 				args->push_back(v);
@@ -413,14 +525,17 @@ private:
 				err("no identifier");
 				break;
 			}
-		} while (t->Operator(","));
+		} while (t->accept(Token::Comma));
 		return args;
 	}
 	void ParseGlobal(AST::NameSpace &ns)
 	{
-		if (t->Keyword("def"))
+		switch (t->peek().kind)
+		{
+		case Token::Def:
 		{
-			if (!t->isIdentifier())
+			t->next();
+			if (!t->is(Token::Identifier))
 			{
 				err("need identifier after 'def' keyword");
 				return;
@@ -428,10 +543,10 @@ private:
 			string name = t->getIdentifier();
 
 			Args args;
-			if (t->Operator("("/*)*/))
+			if (t->accept(Token::LParen))
 			{
 				args = ParseArgumentsList();
-				if (!t->Operator(/*(*/")"))
+				if (!t->accept(Token::RParen))
 				{
 					err("(arguments) is not closed");
 					t->skipToLineEnd();
@@ -443,7 +558,7 @@ private:
 				// 引数省略、引数なし
 			}
 			AST::Type type;
-			if (t->Operator(":"))
+			if (t->accept(Token::Colon))
 			{
 				type = ParseType();
 			}
@@ -455,7 +570,7 @@ private:
 			}
 
 			State s;
-			if (t->Operator("{"/*}*/))
+			if (t->accept(Token::LBrace))
 			{
 				s = ParseBlock();
 			}
@@ -468,10 +583,12 @@ private:
 			{
 				err(name + " is already exists");
 			}
+			break;
 		}
-		else if (t->Keyword("namespace"))
+		case Token::Namespace:
 		{
-			if (!t->isIdentifier())
+			t->next();
+			if (!t->is(Token::Identifier))
 			{
 				err("need identifier after 'namespace' keyword");
 				return;
@@ -479,12 +596,12 @@ private:
 			string name = t->getIdentifier();
 			shptr<AST::NameSpace> nns = new AST::NameSpace(name);
 
-			if (!t->Operator("{"/*}*/))
+			if (!t->accept(Token::LBrace))
 			{
 				err("namespace need {"/*}*/);
 			}
 
-			while (!t->Operator(/*{*/"}"))
+			while (!t->accept(Token::RBrace))
 			{
 				if (t->isEnd())
 				{
@@ -495,15 +612,19 @@ private:
 			}
 
 			ns.Add(nns);
+			break;
 		}
-		else if (t->Keyword("typedef"))
+		case Token::Typedef:
 		{
+			t->next();
 			// typedef type identifier;
 			// typedef identifier : type; こっちだな
+			break;
 		}
-		else if (t->Keyword("struct"))
+		case Token::Struct:
 		{
-			if (!t->isIdentifier())
+			t->next();
+			if (!t->is(Token::Identifier))
 			{
 				err("need identifier after 'struct' keyword");
 				t->skipToLineEnd();
@@ -512,13 +633,13 @@ private:
 			string name = t->getIdentifier();
 			AST::Struct *s = new AST::Struct(name);
 			AST::element e = s;
-			if (!t->Operator("{"/*}*/))
+			if (!t->accept(Token::LBrace))
 			{
 				err("struct need '{'"/*'}'*/);
 				t->skipToLineEnd();
 				return;
 			}
-			while (!t->Operator(/*{*/"}"))
+			while (!t->accept(Token::RBrace))
 			{
 				if (t->isEnd())
 				{
@@ -527,16 +648,18 @@ private:
 				}
 				Var v = ParseDecVar<AST::VarInfo>();
 				s->add(v);
-				if (!t->Operator(";"))
+				if (!t->accept(Token::Semicolon))
 				{
 					err("no ';' at end of declare member");
 				}
 			}
 			ns.Add(e);
+			break;
 		}
-		else if (t->Keyword("union"))
+		case Token::Union:
 		{
-			if (!t->isIdentifier())
+			t->next();
+			if (!t->is(Token::Identifier))
 			{
 				err("need identifier after 'union' keyword");
 				t->skipToLineEnd();
@@ -545,13 +668,13 @@ private:
 			string name = t->getIdentifier();
 			AST::Union *s = new AST::Union(name);
 			AST::element e = s;
-			if (!t->Operator("{"/*}*/))
+			if (!t->accept(Token::LBrace))
 			{
 				err("union need '{'"/*'}'*/);
 				t->skipToLineEnd();
 				return;
 			}
-			while (!t->Operator(/*{*/"}"))
+			while (!t->accept(Token::RBrace))
 			{
 				if (t->isEnd())
 				{
@@ -560,52 +683,54 @@ private:
 				}
 				Var v = ParseDecVar<AST::VarInfo>();
 				s->add(v);
-				if (!t->Operator(";"))
+				if (!t->accept(Token::Semicolon))
 				{
 					err("no ';' at end of declare member");
 				}
 			}
 			ns.Add(e);
+			break;
 		}
-		else if (t->Keyword("enum"))
+		case Token::Enum:
 		{
-			if (!t->isIdentifier())
+			t->next();
+			if (!t->is(Token::Identifier))
 			{
 				err("need identifier after 'enum' keyword");
 			}
 			string name = t->getIdentifier();
 			AST::Enum *s = new AST::Enum(name);
 			AST::element e = s;
-			if (!t->Operator("{"/*}*/))
+			if (!t->accept(Token::LBrace))
 			{
 				err("enum need '{'"/*'}'*/);
 				t->skipToLineEnd();
 				return;
 			}
-			while (!t->Operator(/*{*/"}"))
+			while (!t->accept(Token::RBrace))
 			{
-				if (!t->isIdentifier())
+				if (!t->is(Token::Identifier))
 				{
 					err("no identifier in enum member");
 					return;
 				}
 				string var_name = t->getIdentifier();
-				if (t->Operator("="))
+				if (t->accept(Token::Assign))
 				{
-					if (!t->isInt())
+					if (!t->is(Token::Int))
 					{
 						err("enum parameter is only int");
 					}
-					s->add(var_name, t->getInt());
+					s->add(var_name, t->is(Token::Int) ? t->next().i : 0);
 					// ParseExpression();
 				}
 				else
 				{
 					s->add(var_name);
 				}
-				if (t->Operator(";"));
-				else if (t->Operator(","));
-				else if (t->Operator(/*{*/"}"))
+				if (t->accept(Token::Semicolon));
+				else if (t->accept(Token::Comma));
+				else if (t->accept(Token::RBrace))
 				{
 					break;
 				}
@@ -616,33 +741,38 @@ private:
 				}
 			}
 			ns.Add(e);
+			break;
 		}
-		else if (t->Keyword("var"))
+		case Token::Var:
 		{
+			t->next();
 			Var v = ParseDecVar<AST::GlobalVar>();
-			if (!t->Operator(";"))
+			if (!t->accept(Token::Semicolon))
 				err("no ';' at end of global declaration");
 			if (ns.Add(v))
 			{
 				err(v->getName() + " is already exists");
 			}
+			break;
 		}
-		else
+		default:
 		{
 			err("unknown global element");
 			t->skipToLineEnd();
+			break;
+		}
 		}
 	}
 	State ParseIf()
 	{
-		if (!t->Operator("("/*)*/))
+		if (!t->accept(Token::LParen))
 		{
 			err("if '(' cond ')' statement [else statement]");
 			t->skipToLineEnd();
 			return NULL;
 		}
 		Exp cond = ParseExpression();
-		if (!t->Operator(/*(*/")"))
+		if (!t->accept(Token::RParen))
 		{
 			err("if '(' cond ')' statement [else statement]");
 			t->skipToLineEnd();
@@ -650,7 +780,7 @@ private:
 		}
 		State if_s = ParseStatement();
 		State else_s;
-		if (t->Keyword("else"))
+		if (t->accept(Token::Else))
 		{
 			else_s = ParseStatement();
 		}
@@ -658,18 +788,18 @@ private:
 	}
 	State ParseWhile()
 	{
-		if (!t->Operator("("/*)*/))
+		if (!t->accept(Token::LParen))
 		{
 			err("while '(' cond ')' statement [else statement]");
 		}
 		Exp cond = ParseExpression();
-		if (!t->Operator(/*(*/")"))
+		if (!t->accept(Token::RParen))
 		{
 			err("if '(' cond ')' statement [else statement]");
 		}
 		State s = ParseStatement();
 		State else_s;
-		if (t->Keyword("else"))
+		if (t->accept(Token::Else))
 		{
 			else_s = ParseStatement();
 		}
@@ -678,74 +808,96 @@ private:
 	State ParseStatement()
 	{
 		State s;
-		if (t->Operator(";"))
+		switch (t->peek().kind)
 		{
+		case Token::Semicolon:
+		{
+			t->next();
 			// empty
+			break;
 		}
-		else if (t->Operator("{"/*}*/))
+		case Token::LBrace:
 		{
+			t->next();
 			s = ParseBlock();
+			break;
 		}
-		else if (t->Keyword("var"))
+		case Token::Var:
 		{
+			t->next();
 			Var v = ParseDecVar<AST::LocalVar>();
 			s = new AST::Declaration(v);
-			if (!t->Operator(";"))
+			if (!t->accept(Token::Semicolon))
 				err("no ';' at end of local declaration");
+			break;
 		}
-		else if (t->Keyword("typedef"))
+		case Token::Typedef:
 		{
+			t->next();
 			// local typedefは可能？
+			break;
 		}
-		else if (t->Keyword("if"))
+		case Token::If:
 		{
+			t->next();
 			s = ParseIf();
+			break;
 		}
-		else if (t->Keyword("while"))
+		case Token::While:
 		{
+			t->next();
 			s = ParseWhile();
+			break;
 		}
-		else if (t->Keyword("return"))
+		case Token::Return:
 		{
-			if (t->Operator(";"))
+			t->next();
+			if (t->accept(Token::Semicolon))
 			{
 				s = new AST::Return();
 			}
 			else
 			{
 				Exp e = ParseExpression();
-				if (!t->Operator(";"))
+				if (!t->accept(Token::Semicolon))
 				{
 					err("no ';' at end of return");
 				}
 				s = new AST::Return(e);
 			}
+			break;
 		}
-		else if (t->Keyword("continue"))
+		case Token::Continue:
 		{
-			if (!t->Operator(";"))
+			t->next();
+			if (!t->accept(Token::Semicolon))
 			{
 				err("continue need ;");
 			}
 			s = new AST::Continue();
+			break;
 		}
-		else if (t->Keyword("break"))
+		case Token::Break:
 		{
-			if (!t->Operator(";"))
+			t->next();
+			if (!t->accept(Token::Semicolon))
 			{
 				err("break need ;");
 			}
 			s = new AST::Break();
+			break;
 		}
-		else
+		default:
 		{
 			Exp e = ParseExpression();
-			if (!t->Operator(";"))
+			if (!t->accept(Token::Semicolon))
 			{
 				err("no ';' at end of expression");
 				t->skipToLineEnd();
 			}
 			s = new AST::ExpressionStatement(e);
+			break;
+		}
 		}
 		return s;
 	}
@@ -754,393 +906,215 @@ private:
 		do
 		{
 			c->Add(ParseExpression());
-		} while (t->Operator(","));
+		} while (t->accept(Token::Comma));
 	}
 	Exp getTerm()
 	{
 		Exp l;
-		if (t->Operator("("/*)*/))
+		const Token &tk = t->peek();
+		switch (tk.kind)
 		{
+		case Token::LParen:
+			t->next();
 			l = ParseExpression();
-			if (t->Operator(/*(*/")"))
-				;
-			else
+			if (!t->accept(Token::RParen))
 				err(/*(*/"need )");
-		}
-		#define PRE_OP(o,a) else if (t->Operator(o)) {l = new AST::a(getTerm());l = getTerm();}
-		PRE_OP("++", PreInc)
-		PRE_OP("--", PreDec)
-		PRE_OP("+",  Plus)
-		PRE_OP("-",  Minus)
-		PRE_OP("!",  Not)
-		PRE_OP("~",  Compl)
-		PRE_OP("*",  Deref)
-		PRE_OP("&",  Ref)
-		#undef PRE_OP
-		else if (t->isIdentifier())
-		{
-			string name = t->getIdentifier();
-			l = new AST::Variable(name);
-		}
-		else if (t->isFloat())
-		{
-			float f = t->getFloat();
-			l = new AST::Float(f);
-		}
-		else if (t->isInt())
-		{
-			int n = t->getInt();
-			l = new AST::Int(n);
-		}
-		else if (t->isChar())
-		{
-			char c = t->getChar();
-			l = new AST::Char(c);
-		}
-		else if (t->isString())
-		{
-			string s = t->getString();
-			l = new  AST::String(s);
-		}
-		else
-		{
+			break;
+		case Token::Inc:	t->next();l = new AST::PreInc(getTerm());	break;
+		case Token::Dec:	t->next();l = new AST::PreDec(getTerm());	break;
+		case Token::Plus:	t->next();l = new AST::Plus(getTerm());	break;
+		case Token::Minus:	t->next();l = new AST::Minus(getTerm());	break;
+		case Token::Not:	t->next();l = new AST::Not(getTerm());	break;
+		case Token::Tilde:	t->next();l = new AST::Compl(getTerm());	break;
+		case Token::Star:	t->next();l = new AST::Deref(getTerm());	break;
+		case Token::Amp:	t->next();l = new AST::Ref(getTerm());	break;
+		case Token::Identifier:
+			t->next();
+			l = new AST::Variable(t->getName(tk.id));
+			break;
+		case Token::Float:
+			t->next();
+			l = new AST::Float(tk.f);
+			break;
+		case Token::Int:
+			t->next();
+			l = new AST::Int(tk.i);
+			break;
+		case Token::Char:
+			t->next();
+			l = new AST::Char(tk.i);
+			break;
+		case Token::String:
+			t->next();
+			l = new AST::String(t->getName(tk.id));
+			break;
+		default:
 			err("unknown term");
 			t->skipToLineEnd();
 			return NULL;
 		}
 
-		while (!t->isEnd())
+		while (true)
 		{
-			if (t->Operator("++"))
+			switch (t->peek().kind)
 			{
+			case Token::Inc:
+				t->next();
 				l = new AST::Inc(l);
-			}
-			else if (t->Operator("--"))
-			{
+				break;
+			case Token::Dec:
+				t->next();
 				l = new AST::Dec(l);
-			}
-			else if (t->Operator("("/*)*/))
+				break;
+			case Token::LParen:
 			{
+				t->next();
 				AST::Call *c = new AST::Call(l);
 				l = c;
-				if (t->Operator(/*(*/")"))
+				if (t->accept(Token::RParen))
 				{
 					// no argument
 				}
 				else
 				{
 					ParseArguments(c);
-					if (!t->Operator(/*(*/")"))
+					if (!t->accept(Token::RParen))
 					{
 						err("call() is not closed");
 						return NULL;
 					}
 				}
+				break;
 			}
-			else if (t->Operator("["))
+			case Token::LBracket:
 			{
+				t->next();
 				Exp e = ParseExpression();
-				if (!t->Operator("]"))
+				if (!t->accept(Token::RBracket))
 				{
 					err("exp[] is not closed");
 					return NULL;
 				}
 				l = new AST::Index(l, e);
+				break;
 			}
-			else if (t->Operator("."))
+			case Token::Dot:
 			{
-				if (!t->isIdentifier())
+				t->next();
+				if (!t->is(Token::Identifier))
 				{
 					err("no member name after '.'");
 					return NULL;
 				}
 				string name = t->getIdentifier();
 				l = new AST::Member(l, name);
-			}
-			else
 				break;
-		}
-		return l;
-	}
-	Exp getexp1()
-	{
-		Exp l = getTerm();
-		while (!t->isEnd())
-		{
-			if (t->Operator("*", "="))
-			{
-				Exp r = getTerm();
-				l = new AST::Mul(l, r);
 			}
-			else if (t->Operator("/", "="))
-			{
-				Exp r = getTerm();
-				l = new AST::Div(l, r);
-			}
-			else if (t->Operator("%", "="))
-			{
-				Exp r = getTerm();
-				l = new AST::Mod(l, r);
+			default:
+				return l;
 			}
-			else
-				break;
 		}
-		return l;
 	}
-	Exp getexp2()
+	// 二項演算子の優先順位表
+	// precが大きいほど強く結合する、?:は別扱い
+	enum
 	{
-		Exp l = getexp1();
-		while (!t->isEnd())
-		{
-			if (t->Operator("+", "="))
-			{
-				Exp r = getexp1();
-				l = new AST::Add(l, r);
-			}
-			else if (t->Operator("-", "="))
-			{
-				Exp r = getexp1();
-				l = new AST::Sub(l, r);
-			}
-			else
-				break;
-		}
-		return l;
-	}
-	Exp getexp3()
-	{
-		Exp l = getexp2();
-		while (!t->isEnd())
-		{
-			if (t->Operator("<<", "="))
-			{
-				Exp r = getexp2();
-				l = new AST::SHL(l, r);
-			}
-			else if (t->Operator(">>", "="))
-			{
-				Exp r = getexp2();
-				l = new AST::SHR(l, r);
-			}
-			else
-				break;
-		}
-		return l;
-	}
-	Exp getexp4()
-	{
-		Exp l = getexp3();
-		while (!t->isEnd())
-		{
-			if (t->Operator("&", "&="))
-			{
-				Exp r = getexp3();
-				l = new AST::AND(l, r);
-			}
-			else
-				break;
-		}
-		return l;
-	}
-	Exp getexp5()
-	{
-		Exp l = getexp4();
-		while (!t->isEnd())
-		{
-			if (t->Operator("^", "="))
-			{
-				Exp r = getexp4();
-				l = new AST::XOR(l, r);
-			}
-			else
-				break;
-		}
-		return l;
-	}
-	Exp getexp6()
-	{
-		Exp l = getexp5();
-		while (!t->isEnd())
-		{
-			if (t->Operator("|", "|="))
-			{
-				Exp r = getexp5();
-				l = new AST::OR(l, r);
-			}
-			else
-				break;
-		}
-		return l;
-	}
-	Exp getexp7()
-	{
-		Exp l = getexp6();
-		while (!t->isEnd())
-		{
-			if (t->Operator("<="))
-			{
-				Exp r = getexp6();
-				l = new AST::LE(l, r);
-			}
-			else if (t->Operator("<"))
-			{
-				Exp r = getexp6();
-				l = new AST::LT(l, r);
-			}
-			else if (t->Operator(">="))
-			{
-				Exp r = getexp6();
-				l = new AST::GE(l, r);
-			}
-			else if (t->Operator(">"))
-			{
-				Exp r = getexp6();
-				l = new AST::GT(l, r);
-			}
-			else
-				break;
-		}
-		return l;
-	}
-	Exp getexp8()
+		PREC_ASSIGN = 1,
+		PREC_TERNARY,
+		PREC_BOOL_OR,
+		PREC_BOOL_AND,
+		PREC_EQUALITY,
+		PREC_RELATIONAL,
+		PREC_OR,
+		PREC_XOR,
+		PREC_AND,
+		PREC_SHIFT,
+		PREC_ADDITIVE,
+		PREC_MULTIPLICATIVE,
+	};
+	struct BinaryOp
 	{
-		Exp l = getexp7();
-		while (!t->isEnd())
-		{
-			if (t->Operator("=="))
-			{
-				Exp r = getexp7();
-				l = new AST::EQ(l, r);
-			}
-			else if (t->Operator("!="))
-			{
-				Exp r = getexp7();
-				l = new AST::NE(l, r);
-			}
-			else
-				break;
-		}
-		return l;
-	}
-	Exp getexp9()
+		int prec;
+		bool right;
+		Exp (*make)(Exp, Exp);
+	};
+	BinaryOp binary[Token::ORAssign + 1];
+	template<class T>static Exp make(Exp l, Exp r){return new T(l, r);}
+	template<class T>void setBinary(Token::Kind k, int prec, bool right = false)
 	{
-		Exp l = getexp8();
-		while (!t->isEnd())
-		{
-			if (t->Operator("&&"))
-			{
-				Exp r = getexp8();
-				l = new AST::BOOL_AND(l, r);
-			}
-			else
-				break;
-		}
-		return l;
+		binary[k].prec = prec;
+		binary[k].right = right;
+		binary[k].make = &make<T>;
 	}
-	Exp getexp10()
+	void initBinary()
 	{
-		Exp l = getexp9();
-		while (!t->isEnd())
-		{
-			if (t->Operator("||"))
-			{
-				Exp r = getexp9();
-				l = new AST::BOOL_OR(l, r);
-			}
-			else
-				break;
-		}
-		return l;
+		for (int i = 0; i <= Token::ORAssign; ++i)
+		{
+			binary[i].prec = 0;
+			binary[i].right = false;
+			binary[i].make = NULL;
+		}
+		setBinary<AST::Mul>			(Token::Star,		PREC_MULTIPLICATIVE);
+		setBinary<AST::Div>			(Token::Slash,		PREC_MULTIPLICATIVE);
+		setBinary<AST::Mod>			(Token::Percent,	PREC_MULTIPLICATIVE);
+		setBinary<AST::Add>			(Token::Plus,		PREC_ADDITIVE);
+		setBinary<AST::Sub>			(Token::Minus,		PREC_ADDITIVE);
+		setBinary<AST::SHL>			(Token::SHL,		PREC_SHIFT);
+		setBinary<AST::SHR>			(Token::SHR,		PREC_SHIFT);
+		setBinary<AST::AND>			(Token::Amp,		PREC_AND);
+		setBinary<AST::XOR>			(Token::Caret,		PREC_XOR);
+		setBinary<AST::OR>			(Token::Pipe,		PREC_OR);
+		setBinary<AST::LE>			(Token::LE,			PREC_RELATIONAL);
+		setBinary<AST::LT>			(Token::LT,			PREC_RELATIONAL);
+		setBinary<AST::GE>			(Token::GE,			PREC_RELATIONAL);
+		setBinary<AST::GT>			(Token::GT,			PREC_RELATIONAL);
+		setBinary<AST::EQ>			(Token::EQ,			PREC_EQUALITY);
+		setBinary<AST::NE>			(Token::NE,			PREC_EQUALITY);
+		setBinary<AST::BOOL_AND>	(Token::AndAnd,		PREC_BOOL_AND);
+		setBinary<AST::BOOL_OR>		(Token::OrOr,		PREC_BOOL_OR);
+		setBinary<AST::Assign>		(Token::Assign,		PREC_ASSIGN, true);
+		setBinary<AST::AddAssign>	(Token::AddAssign,	PREC_ASSIGN, true);
+		setBinary<AST::SubAssign>	(Token::SubAssign,	PREC_ASSIGN, true);
+		setBinary<AST::MulAssign>	(Token::MulAssign,	PREC_ASSIGN, true);
+		setBinary<AST::DivAssign>	(Token::DivAssign,	PREC_ASSIGN, true);
+		setBinary<AST::ModAssign>	(Token::ModAssign,	PREC_ASSIGN, true);
+		setBinary<AST::SHLAssign>	(Token::SHLAssign,	PREC_ASSIGN, true);
+		setBinary<AST::SHRAssign>	(Token::SHRAssign,	PREC_ASSIGN, true);
+		setBinary<AST::ANDAssign>	(Token::ANDAssign,	PREC_ASSIGN, true);
+		setBinary<AST::XORAssign>	(Token::XORAssign,	PREC_ASSIGN, true);
+		setBinary<AST::ORAssign>	(Token::ORAssign,	PREC_ASSIGN, true);
 	}
-	Exp getexp11()
+	// precedence climbing
+	// prec以上の強さの演算子だけを取り込む
+	Exp ParseExpression(int prec = PREC_ASSIGN)
 	{
-		Exp l = getexp10();
-		while (!t->isEnd())
+		Exp l = getTerm();
+		while (true)
 		{
-			if (t->Operator("?"))
+			Token::Kind k = t->peek().kind;
+			if (k == Token::Question)
 			{
-				Exp r1 = getexp11();
-				if (!t->Operator(":"))
+				if (PREC_TERNARY < prec)
+					return l;
+				t->next();
+				Exp r1 = ParseExpression(PREC_TERNARY);
+				if (!t->accept(Token::Colon))
 				{
 					err("need :");
 				}
-				Exp r2 = getexp11();
+				Exp r2 = ParseExpression(PREC_TERNARY);
 				l = new AST::TernaryOperater(l, r1, r2);
+				continue;
 			}
-			else
-				break;
-		}
-		return l;
-	}
-	Exp getexp12()
-	{
-		Exp l = getexp11();
-		while (!t->isEnd())
-		{
-			if (t->Operator("="))
-			{
-				Exp r = getexp12();
-				l = new AST::Assign(l, r);
-			}
-			else if (t->Operator("+="))
-			{
-				Exp r = getexp12();
-				l = new AST::AddAssign(l, r);
-			}
-			else if (t->Operator("-="))
-			{
-				Exp r = getexp12();
-				l = new AST::SubAssign(l, r);
-			}
-			else if (t->Operator("*="))
-			{
-				Exp r = getexp12();
-				l = new AST::MulAssign(l, r);
-			}
-			else if (t->Operator("/="))
-			{
-				Exp r = getexp12();
-				l = new AST::DivAssign(l, r);
-			}
-			else if (t->Operator("%="))
-			{
-				Exp r = getexp12();
-				l = new AST::ModAssign(l, r);
-			}
-			else if (t->Operator("<<="))
-			{
-				Exp r = getexp12();
-				l = new AST::SHLAssign(l, r);
-			}
-			else if (t->Operator(">>="))
-			{
-				Exp r = getexp12();
-				l = new AST::SHRAssign(l, r);
-			}
-			else if (t->Operator("&="))
-			{
-				Exp r = getexp12();
-				l = new AST::ANDAssign(l, r);
-			}
-			else if (t->Operator("^="))
-			{
-				Exp r = getexp12();
-				l = new AST::XORAssign(l, r);
-			}
-			else if (t->Operator("|="))
-			{
-				Exp r = getexp12();
-				l = new AST::ORAssign(l, r);
-			}
-			else
-				break;
+			if (k > Token::ORAssign)
+				return l;
+			const BinaryOp &op = binary[k];
+			if (!op.make || op.prec < prec)
+				return l;
+			t->next();
+			Exp r = ParseExpression(op.right ? op.prec : op.prec + 1);
+			l = op.make(l, r);
 		}
-		return l;
-	}
-	Exp ParseExpression()
-	{
-		Exp e = getexp12();
-		return e;
 	}
 };
 
@@ -0,0 +1,255 @@
+#ifndef NES_X64_H
+#define NES_X64_H
+
+#include "x86.h"
+
+// x86-64のLinuxならx64の方を吐く
+// NES_X86を定義しておけば64bitでも32bitのコードを吐く(exeを作る時とか)
+#if !defined(NES_X86) && defined(__x86_64__)
+#define NES_X64
+#endif
+
+namespace NES{
+
+// x86-64用
+// 値もポインタも32bitのまま、コードとグローバル変数とスタックは下位2GBに置く
+// なので[ebp+stack]とかレジスタ間の演算はx86と同じ機械語でいい
+// 違うのは絶対番地を使うところとスタックの積み方
+struct x64 : x86
+{
+	static void rex_w(code &c)	{write8(c, 0x48);}
+
+	// グローバル変数はRIP相対、memはコードの先頭からの距離
+	static void rip(code &c, int mem, int rest){write32(c, mem - (int)c.size() - 4 - rest);}
+	static void mov_eax_mem(code &c, int mem){write8(c, 0x8B);write8(c, 0x05);rip(c, mem, 0);}	// mov eax, [rip+mem]
+	static void mov_mem_eax(code &c, int mem){write8(c, 0x89);write8(c, 0x05);rip(c, mem, 0);}	// mov [rip+mem], eax
+	static void mov_mem_al (code &c, int mem){write8(c, 0x88);write8(c, 0x05);rip(c, mem, 0);}	// mov [rip+mem], al
+	static void inc_mem      (code &c, int mem){write8(c, 0xFF);write8(c, 0x05);rip(c, mem, 0);}	// inc [rip+mem]
+	static void inc_byte_mem (code &c, int mem){write8(c, 0xFE);write8(c, 0x05);rip(c, mem, 0);}	// inc byte ptr [rip+mem]
+	static void dec_mem      (code &c, int mem){write8(c, 0xFF);write8(c, 0x0D);rip(c, mem, 0);}	// dec [rip+mem]
+	static void dec_byte_mem (code &c, int mem){write8(c, 0xFE);write8(c, 0x0D);rip(c, mem, 0);}	// dec byte ptr [rip+mem]
+	static void add_mem_int  (code &c, int mem, int val){write8(c, imm8(val) ? 0x83 : 0x81);write8(c, 0x05);rip(c, mem, imm8(val) ? 1 : 4);imm(c, val);}	// add [rip+mem], val
+	static void lea_eax_mem  (code &c, int mem){write8(c, 0x8D);write8(c, 0x05);rip(c, mem, 0);}	// lea eax, [rip+mem]
+
+	// 引数は4byteずつ積む
+	static void push_reg  (code &c, int r    ){sub_rsp_4(c);write8(c, 0x89);write8(c, 0x04|r<<3);write8(c, 0x24);}	// sub rsp, 4 / mov [rsp], r
+	static void push_stack(code &c, int stack){mov_eax_stack(c, stack);push_reg(c, eax);}	// mov eax, [rbp+stack] / push eax
+	static void sub_rsp_4 (code &c           ){rex_w(c);write8(c, 0x83);write8(c, 0xEC);write8(c, 0x04);}	// sub rsp, 4
+	static void add_esp_int(code &c, int val ){rex_w(c);x86::add_esp_int(c, val);}	// add rsp, val
+
+	// rbpは戻り番地を指す様にして、引数が[rbp+8]から並ぶのはx86と同じにする
+	// 呼んだ側のrbpはローカル変数の下に置いておく
+	static void enter(code &c, int frame)
+	{
+		rex_w(c);write8(c, 0x89);write8(c, 0xE8);	// mov rax, rbp
+		rex_w(c);write8(c, 0x89);write8(c, 0xE5);	// mov rbp, rsp
+		add_esp_int(c, -(frame+8));
+		rex_w(c);write8(c, 0x89);rm_stack(c, eax, -(frame+8));	// mov [rbp-frame-8], rax
+	}
+	static void leave(code &c, int frame)
+	{
+		rex_w(c);write8(c, 0x8B);rm_stack(c, ecx, -(frame+8));	// mov rcx, [rbp-frame-8]
+		rex_w(c);write8(c, 0x89);write8(c, 0xEC);	// mov rsp, rbp
+		rex_w(c);write8(c, 0x89);write8(c, 0xCD);	// mov rbp, rcx
+		retn(c);
+	}
+
+	// System Vの引数レジスタ edi, esi, edx, ecx, r8d, r9d
+	static int arg_reg(int i)
+	{
+		const int r[] = {edi, esi, edx, ecx, 8, 9};
+		return r[i];
+	}
+	// floatはxmmで渡す、スクリプトの方は4byteのビットのままなのでmovdで移すだけ
+	static void movd_xmm_stack(code &c, int x, int stack){write8(c, 0x66);write8(c, 0x0F);write8(c, 0x6E);rm_stack(c, x, stack);}	// movd xmm, [rbp+stack]
+	static void movd_rsp_xmm(code &c, int off, int x){write8(c, 0x66);write8(c, 0x0F);write8(c, 0x7E);write8(c, 0x84|x<<3);write8(c, 0x24);write32(c, off);}	// movd [rsp+off], xmm
+	static void movd_xmm0_eax(code &c){write8(c, 0x66);write8(c, 0x0F);write8(c, 0x6E);write8(c, 0xC0);}	// movd xmm0, eax
+	static void movd_eax_xmm0(code &c){write8(c, 0x66);write8(c, 0x0F);write8(c, 0x7E);write8(c, 0xC0);}	// movd eax, xmm0
+	static void write64(code &c, const void *p)
+	{
+		unsigned long long i = (unsigned long long)(size_t)p;
+		write32(c, (dword)i);write32(c, (dword)(i>>32));
+	}
+
+	// Cから呼ばれる入口
+	// 下位2GBのスタックに乗り換えて、レジスタの引数を積み直してから関数を呼ぶ
+	// 既にそっちのスタックにいる(スクリプト→C→スクリプト)ならそのまま
+	// func, stackはコードの先頭からの位置と絶対番地
+	// fuelなら燃料を数えるので、exit(グローバル変数、コードの先頭からの距離)に燃料が切れた時に戻ってくるrspを置く
+	// 距離はグローバル変数がコードより下にあれば負
+	// floatsはfloatの引数(1番目が最下位ビット)、fretならfloatを返す
+	static void entry_thunk(code &c, int func, int args, int floats, bool fret, int stack, int exit, bool fuel)
+	{
+		int size = (args * 4 + 15) / 16 * 16;
+		write8(c, 0x55);	// push rbp
+		rex_w(c);write8(c, 0x89);write8(c, 0xE5);	// mov rbp, rsp
+		write8(c, 0x53);	// push rbx (ebxは32bitでしか退避しないので)
+		rex_w(c);write8(c, 0x89);write8(c, 0xE0);	// mov rax, rsp
+		rex_w(c);write8(c, 0xC1);write8(c, 0xE8);write8(c, 31);	// shr rax, 31
+		write8(c, 0x74);write8(c, 0x07);	// jz short 7
+		rex_w(c);write8(c, 0xC7);write8(c, 0xC4);write32(c, stack);	// mov rsp, stack
+		rex_w(c);write8(c, 0x83);write8(c, 0xE4);write8(c, 0xF0);	// and rsp, -16
+		enter_thunk(c, exit, fuel, false);
+		rex_w(c);write8(c, 0x81);write8(c, 0xEC);write32(c, size);	// sub rsp, size
+		copy_args(c, args, floats, 0);
+		call_thunk(c, func, size, fret, exit, fuel, false);
+	}
+	// インスタンスの入口、f(global, stack, 引数...)で呼ぶ
+	// global(rdi)はそのまま関数の中でグローバル変数の場所に使う、stackは乗り換えるスタックの底
+	// exitはglobalからの距離
+	static void instance_thunk(code &c, int func, int args, int floats, bool fret, int exit, bool fuel)
+	{
+		int size = (args * 4 + 15) / 16 * 16;
+		write8(c, 0x55);	// push rbp
+		rex_w(c);write8(c, 0x89);write8(c, 0xE5);	// mov rbp, rsp
+		write8(c, 0x53);	// push rbx
+		write8(c, 0x89);write8(c, 0xFF);	// mov edi, edi (intで渡されるので上位を0に)
+		write8(c, 0x89);write8(c, 0xF6);	// mov esi, esi
+		rex_w(c);write8(c, 0x89);write8(c, 0xE0);	// mov rax, rsp
+		rex_w(c);write8(c, 0xC1);write8(c, 0xE8);write8(c, 31);	// shr rax, 31
+		write8(c, 0x74);write8(c, 0x03);	// jz short 3
+		rex_w(c);write8(c, 0x89);write8(c, 0xF4);	// mov rsp, rsi
+		rex_w(c);write8(c, 0x83);write8(c, 0xE4);write8(c, 0xF0);	// and rsp, -16
+		enter_thunk(c, exit, fuel, true);
+		rex_w(c);write8(c, 0x81);write8(c, 0xEC);write32(c, size);	// sub rsp, size
+		copy_args(c, args, floats, 2);
+		call_thunk(c, func, size, fret, exit, fuel, true);
+	}
+	// Cの引数をスクリプトの引数として[rsp]から並べる、整数のレジスタはskip個目から
+	// 整数はレジスタ6個、floatはxmm8個を順に使って、溢れた分は並び順にCのスタックに乗ってる
+	static void copy_args(code &c, int args, int floats, int skip)
+	{
+		int n = skip, x = 0, s = 0;
+		for (int i = 0; i < args; i++)
+		{
+			int r = eax;
+			if (floats >> i & 1 && x < 8)
+			{
+				movd_rsp_xmm(c, i * 4, x++);
+				continue;
+			}
+			if (!(floats >> i & 1) && n < 6)
+				r = arg_reg(n++);
+			else
+				mov_reg_stack(c, eax, 16 + 8 * s++);
+			if (r >= 8)
+				write8(c, 0x44);
+			write8(c, 0x89);write8(c, 0x84|(r&7)<<3);write8(c, 0x24);write32(c, i * 4);	// mov [rsp+i*4], r
+		}
+	}
+	// floatを返す時はxmm0にも置く(eaxにも残るのでインスタンスの入口はintとして受けていい)
+	static void call_thunk(code &c, int func, int size, bool fret, int exit, bool fuel, bool base)
+	{
+		write8(c, 0xE8);write32(c, func - (int)c.size() - 4);	// call func
+		if (fret)
+			movd_xmm0_eax(c);
+		if (!fuel)
+		{
+			leave_entry(c);
+			return;
+		}
+		rex_w(c);write8(c, 0x81);write8(c, 0xC4);write32(c, size);	// add rsp, size
+		leave_thunk(c, exit, base);
+	}
+
+	// 入口と出口でグローバル変数を触る、baseならrdiからの距離でそうでなければRIP相対
+	static void op_global(code &c, int op, int r, int a, bool base){write8(c, op);if (base) rm_base(c, r, a); else {write8(c, 0x05|r<<3);rip(c, a, 0);}}
+	// 呼ばれた時の戻り先を取っておいて、燃料が切れたら戻ってくる所を置く(2つ積むので16byteに揃ったまま)
+	static void enter_thunk(code &c, int exit, bool fuel, bool base)
+	{
+		if (!fuel)
+			return;
+		op_global(c, 0x8B, eax, exit, base);	// mov eax, [exit]
+		write8(c, 0x50);	// push rax
+		write8(c, 0x55);	// push rbp
+		op_global(c, 0x89, esp, exit, base);	// mov [exit], esp
+	}
+	// 燃料が切れた時に飛んでくる所、一番内側の入口のrspに戻って0を返す
+	static void exit_thunk(code &c, int exit, bool base)
+	{
+		op_global(c, 0x8B, esp, exit, base);	// mov esp, [exit] (上位は0になる)
+		write8(c, 0x31);write8(c, 0xC0);	// xor eax, eax
+		write8(c, 0x0F);write8(c, 0x57);write8(c, 0xC0);	// xorps xmm0, xmm0
+		leave_thunk(c, exit, base);
+	}
+	static void leave_thunk(code &c, int exit, bool base)
+	{
+		write8(c, 0x5D);	// pop rbp
+		write8(c, 0x59);	// pop rcx
+		op_global(c, 0x89, ecx, exit, base);	// mov [exit], ecx
+		leave_entry(c);
+	}
+	static void leave_entry(code &c)
+	{
+		rex_w(c);write8(c, 0x8D);write8(c, 0x65);write8(c, 0xF8);	// lea rsp, [rbp-8]
+		write8(c, 0x5B);	// pop rbx
+		write8(c, 0x5D);	// pop rbp
+		retn(c);
+	}
+
+	// スクリプトから呼ぶCの関数
+	// 積まれた引数を整数はレジスタ、floatはxmmに移して、溢れた分は並び順に積んで、スタックを16byteに揃えて呼ぶ
+	// esi, ediはスクリプトの方では壊されない前提なので退避する
+	static void native_thunk(code &c, const void *func, int args, int floats, bool fret)
+	{
+		write8(c, 0x55);	// push rbp
+		rex_w(c);write8(c, 0x89);write8(c, 0xE5);	// mov rbp, rsp
+		write8(c, 0x56);	// push rsi
+		write8(c, 0x57);	// push rdi
+		rex_w(c);write8(c, 0x83);write8(c, 0xE4);write8(c, 0xF0);	// and rsp, -16
+		std::vector<int> reg(args);	// 引数ごとのレジスタ、xmmは8から、スタックに積むのは-1
+		int n = 0, x = 0, s = 0;
+		for (int i = 0; i < args; i++)
+		{
+			if (floats >> i & 1)
+				reg[i] = x < 8 ? 8 + x++ : -1;
+			else
+				reg[i] = n < 6 ? n++ : -1;
+			if (reg[i] < 0)
+				s++;
+		}
+		if (s % 2)
+		{
+			rex_w(c);write8(c, 0x83);write8(c, 0xEC);write8(c, 0x08);	// sub rsp, 8
+		}
+		for (int i = args - 1; i >= 0; i--)
+		{
+			if (reg[i] >= 0)
+				continue;
+			mov_reg_stack(c, eax, 16 + i * 4);
+			write8(c, 0x50);	// push rax
+		}
+		for (int i = 0; i < args; i++)
+		{
+			if (reg[i] >= 8)
+			{
+				movd_xmm_stack(c, reg[i] - 8, 16 + i * 4);	// movd xmm, [rbp+16+i*4]
+				continue;
+			}
+			if (reg[i] < 0)
+				continue;
+			int r = arg_reg(reg[i]);
+			if (r >= 8)
+				write8(c, 0x44);
+			mov_reg_stack(c, r & 7, 16 + i * 4);	// mov r, [rbp+16+i*4]
+		}
+		rex_w(c);write8(c, 0xB8);write64(c, func);	// mov rax, func
+		call_eax(c);	// call rax
+		if (fret)
+			movd_eax_xmm0(c);
+		rex_w(c);write8(c, 0x8D);write8(c, 0x65);write8(c, 0xF0);	// lea rsp, [rbp-16]
+		write8(c, 0x5F);	// pop rdi
+		write8(c, 0x5E);	// pop rsi
+		write8(c, 0x5D);	// pop rbp
+		retn(c);
+	}
+};
+
+#ifdef NES_X64
+typedef x64 cpu;
+#else
+typedef x86 cpu;
+#endif
+
+}
+#endif
@@ -13,55 +13,94 @@ struct x86
 	static void write8(code &c, byte b)	{c.push_back(b);}
 	static void write32(code &c, dword i)	{c.push_back(i);c.push_back(i>>8);c.push_back(i>>16);c.push_back(i>>24);}
 
-	static void mov_eax_stack(code &c, int stack){write8(c, 0x8B);write8(c, 0x85);write32(c, stack);}	// mov eax, [ebp+stack]
-	static void mov_ecx_stack(code &c, int stack){write8(c, 0x8B);write8(c, 0x8D);write32(c, stack);}	// mov ecx, [ebp+stack]
-	static void mov_stack_eax(code &c, int stack){write8(c, 0x89);write8(c, 0x85);write32(c, stack);}	// mov [ebp+stack], eax
-	static void mov_stack_edx(code &c, int stack){write8(c, 0x89);write8(c, 0x95);write32(c, stack);}	// mov [ebp+stack], edx
-
-	static void mov_al_stack(code &c, int stack){write8(c, 0x8A);write8(c, 0x85);write32(c, stack);}	// mov al, [ebp+stack]
-	static void mov_stack_al(code &c, int stack){write8(c, 0x88);write8(c, 0x85);write32(c, stack);}	// mov [ebp+stack], al
+	enum reg
+	{
+		eax = 0, ecx, edx, ebx, esp, ebp, esi, edi,
+	};
+	// 即値と[ebp+stack]の変位は8bitに収まるなら短い方で吐く
+	static bool imm8(int val){return -128 <= val && val <= 127;}
+	static void imm(code &c, int val){if (imm8(val)) write8(c, val); else write32(c, val);}	// 0x83/0x81の即値
+	static void rm_stack(code &c, int r, int stack)	// ModR/Mの[ebp+stack]、rはレジスタか/digit
+	{
+		if (imm8(stack))
+		{
+			write8(c, 0x45|r<<3);write8(c, stack);
+		}
+		else
+		{
+			write8(c, 0x85|r<<3);write32(c, stack);
+		}
+	}
+	static void mov_reg_reg  (code &c, int to, int from){write8(c, 0x89);write8(c, 0xC0|from<<3|to);}	// mov to, from
+	static void mov_reg_stack(code &c, int r, int stack){write8(c, 0x8B);rm_stack(c, r, stack);}	// mov r, [ebp+stack]
+	static void mov_stack_reg(code &c, int stack, int r){write8(c, 0x89);rm_stack(c, r, stack);}	// mov [ebp+stack], r
+	static void mov_reg_int  (code &c, int r, int val  ){write8(c, 0xB8|r);write32(c, val);}	// mov r, val
+	static void add_reg_int  (code &c, int r, int val  ){write8(c, imm8(val) ? 0x83 : 0x81);write8(c, 0xC0|r);imm(c, val);}	// add r, val
+	static void inc_reg      (code &c, int r           ){write8(c, 0xFF);write8(c, 0xC0|r);}	// inc r
+	static void dec_reg      (code &c, int r           ){write8(c, 0xFF);write8(c, 0xC8|r);}	// dec r
+	static void push_reg     (code &c, int r           ){write8(c, 0x50|r);}	// push r
+
+	static void mov_eax_stack(code &c, int stack){write8(c, 0x8B);rm_stack(c, eax, stack);}	// mov eax, [ebp+stack]
+	static void mov_ecx_stack(code &c, int stack){write8(c, 0x8B);rm_stack(c, ecx, stack);}	// mov ecx, [ebp+stack]
+	static void mov_stack_eax(code &c, int stack){write8(c, 0x89);rm_stack(c, eax, stack);}	// mov [ebp+stack], eax
+	static void mov_stack_edx(code &c, int stack){write8(c, 0x89);rm_stack(c, edx, stack);}	// mov [ebp+stack], edx
+
+	static void mov_al_stack(code &c, int stack){write8(c, 0x8A);rm_stack(c, eax, stack);}	// mov al, [ebp+stack]
+	static void mov_stack_al(code &c, int stack){write8(c, 0x88);rm_stack(c, eax, stack);}	// mov [ebp+stack], al
 
 //	static void mov_ecx_mem(code &c, int mem){write8(c, 0x8B);write8(c, 0x0D);write32(c, mem);}	// mov ecx, [mem]
 	static void mov_eax_mem(code &c, int mem){write8(c, 0xA1);write32(c, mem);}	// mov eax, [mem]
 	static void mov_mem_eax(code &c, int mem){write8(c, 0xA3);write32(c, mem);}	// mov [mem], eax
 	static void mov_mem_al (code &c, int mem){write8(c, 0xA2);write32(c, mem);}	// mov [mem], al
 
-	static void push_stack(code &c, int stack){write8(c, 0xFF);write8(c, 0xB5);write32(c, stack);}	// push [ebp+stack]
-	static void inc_stack (code &c, int stack){write8(c, 0xFF);write8(c, 0x85);write32(c, stack);}	// inc [ebp+stack]
+	static void push_stack(code &c, int stack){write8(c, 0xFF);rm_stack(c, 6, stack);}	// push [ebp+stack]
+	static void inc_stack (code &c, int stack){write8(c, 0xFF);rm_stack(c, 0, stack);}	// inc [ebp+stack]
 	static void inc_mem   (code &c, int mem  ){write8(c, 0xFF);write8(c, 0x05);write32(c, mem);}	// inc [mem]
 	static void inc_ecx   (code &c           ){write8(c, 0xFF);write8(c, 0x01);}	// inc [ecx]
-	static void inc_byte_stack(code &c, int stack){write8(c, 0xFE);write8(c, 0x85);write32(c, stack);}	// inc byte ptr ss:[ebp+stack]
+	static void inc_byte_stack(code &c, int stack){write8(c, 0xFE);rm_stack(c, 0, stack);}	// inc byte ptr ss:[ebp+stack]
 	static void inc_byte_mem  (code &c, int mem  ){write8(c, 0xFE);write8(c, 0x05);write32(c, mem);}	// inc byte ptr ds:[mem]
 	static void inc_byte_ecx  (code &c           ){write8(c, 0xFE);write8(c, 0x01);}	// inc byte ptr ds:[ecx]
-	static void dec_stack (code &c, int stack){write8(c, 0xFF);write8(c, 0x8D);write32(c, stack);}	// dec [ebp+stack]
+	static void dec_stack (code &c, int stack){write8(c, 0xFF);rm_stack(c, 1, stack);}	// dec [ebp+stack]
 	static void dec_mem   (code &c, int mem  ){write8(c, 0xFF);write8(c, 0x0D);write32(c, mem);}	// dec [mem]
 	static void dec_ecx   (code &c           ){write8(c, 0xFF);write8(c, 0x09);}	// dec [ecx]
-	static void dec_byte_stack(code &c, int stack){write8(c, 0xFE);write8(c, 0x8D);write32(c, stack);}	// dec byte ptr ss:[ebp+stack]
+	static void dec_byte_stack(code &c, int stack){write8(c, 0xFE);rm_stack(c, 1, stack);}	// dec byte ptr ss:[ebp+stack]
 	static void dec_byte_mem  (code &c, int mem  ){write8(c, 0xFE);write8(c, 0x0D);write32(c, mem);}	// dec byte ptr ds:[mem]
 	static void dec_byte_ecx  (code &c           ){write8(c, 0xFE);write8(c, 0x09);}	// dec byte ptr ds:[ecx]
 
-	static void mov_stack_int(code &c, int stack, int val){write8(c, 0xC7);write8(c, 0x85);write32(c, stack);write32(c, val);}	// mov [ebp+stack], val
-	static void mov_stack_char(code &c, int stack, char val){write8(c, 0xC6);write8(c, 0x85);write32(c, stack);write8(c, val);}	// mov byte ptr ss:[ebp+stack], val
+	static void mov_stack_int(code &c, int stack, int val){write8(c, 0xC7);rm_stack(c, 0, stack);write32(c, val);}	// mov [ebp+stack], val
+	static void mov_stack_char(code &c, int stack, char val){write8(c, 0xC6);rm_stack(c, 0, stack);write8(c, val);}	// mov byte ptr ss:[ebp+stack], val
 
-//	static void neg_stack(code &c, int stack){write8(c, 0xF7);write8(c, 0x9D);write32(c, stack);}	// neg [ebp+stack]
-//	static void not_stack(code &c, int stack){write8(c, 0xF7);write8(c, 0x95);write32(c, stack);}	// not [ebp+stack]
+//	static void neg_stack(code &c, int stack){write8(c, 0xF7);rm_stack(c, 3, stack);}	// neg [ebp+stack]
+//	static void not_stack(code &c, int stack){write8(c, 0xF7);rm_stack(c, 2, stack);}	// not [ebp+stack]
 	static void neg_eax(code &c){write8(c, 0xF7);write8(c, 0xD8);}	// neg eax
 	static void not_eax(code &c){write8(c, 0xF7);write8(c, 0xD0);}	// not eax
 
-	static void add_stack_int(code &c, int stack, int val){write8(c, 0x81);write8(c, 0x85);write32(c, stack);write32(c, val);}	// add [ebp+stack], val
-	static void add_mem_int  (code &c, int mem  , int val){write8(c, 0xC7);write8(c, 0x05);write32(c, mem);write32(c, val);}	// add [mem], val
-	static void add_ecx_int  (code &c,            int val){write8(c, 0xC7);write8(c, 0x01);write32(c, val);}	// add [ecx], val
+	static void add_stack_int(code &c, int stack, int val){write8(c, imm8(val) ? 0x83 : 0x81);rm_stack(c, 0, stack);imm(c, val);}	// add [ebp+stack], val
+	static void add_mem_int  (code &c, int mem  , int val){write8(c, imm8(val) ? 0x83 : 0x81);write8(c, 0x05);write32(c, mem);imm(c, val);}	// add [mem], val
+	static void add_ecx_int  (code &c,            int val){write8(c, imm8(val) ? 0x83 : 0x81);write8(c, 0x01);imm(c, val);}	// add [ecx], val
 
-	static void fld_stack(code &c, int stack){write8(c, 0xD9);write8(c, 0x85);write32(c, stack);}	// fld [ebp+stack]
-	static void fstp_stack(code &c, int stack){write8(c, 0xD9);write8(c, 0x9D);write32(c, stack);}	// fstp [ebp+stack]
-	static void fadd_stack(code &c, int stack){write8(c, 0xD8);write8(c, 0x85);write32(c, stack);}	// fadd [ebp+stack]
-	static void fsub_stack(code &c, int stack){write8(c, 0xD8);write8(c, 0xA5);write32(c, stack);}	// fsub [ebp+stack]
-	static void fmul_stack(code &c, int stack){write8(c, 0xD8);write8(c, 0x8D);write32(c, stack);}	// fmul [ebp+stack]
-	static void fdiv_stack(code &c, int stack){write8(c, 0xD8);write8(c, 0xB5);write32(c, stack);}	// fdiv [ebp+stack]
+	static void fld_stack(code &c, int stack){write8(c, 0xD9);rm_stack(c, 0, stack);}	// fld [ebp+stack]
+	static void fstp_stack(code &c, int stack){write8(c, 0xD9);rm_stack(c, 3, stack);}	// fstp [ebp+stack]
+	static void fadd_stack(code &c, int stack){write8(c, 0xD8);rm_stack(c, 0, stack);}	// fadd [ebp+stack]
+	static void fsub_stack(code &c, int stack){write8(c, 0xD8);rm_stack(c, 4, stack);}	// fsub [ebp+stack]
+	static void fmul_stack(code &c, int stack){write8(c, 0xD8);rm_stack(c, 1, stack);}	// fmul [ebp+stack]
+	static void fdiv_stack(code &c, int stack){write8(c, 0xD8);rm_stack(c, 6, stack);}	// fdiv [ebp+stack]
 
-	static void lea_eax_stack(code &c, int stack){write8(c, 0x8D);write8(c, 0x85);write32(c, stack);}	// lea eax, [ebp+stack]
+	static void lea_eax_stack(code &c, int stack){write8(c, 0x8D);rm_stack(c, eax, stack);}	// lea eax, [ebp+stack]
 	static void lea_eax_mem  (code &c, int mem  ){write8(c, 0x8D);write8(c, 0x05);write32(c, mem);}	// lea eax, [mem]
-	static void add_esp_int  (code &c, int val  ){write8(c, 0x81);write8(c, 0xC4);write32(c, val);}	// add esp, val
+	static void add_esp_int  (code &c, int val  ){write8(c, imm8(val) ? 0x83 : 0x81);write8(c, 0xC4);imm(c, val);}	// add esp, val
+
+	// インスタンス用、グローバル変数はediからの距離(x64でも同じ機械語で[rdi+off])
+	static void rm_base(code &c, int r, int off){write8(c, 0x80|r<<3|edi);write32(c, off);}	// ModR/Mの[edi+off]
+	static void mov_eax_base (code &c, int off){write8(c, 0x8B);rm_base(c, eax, off);}	// mov eax, [edi+off]
+	static void mov_base_eax (code &c, int off){write8(c, 0x89);rm_base(c, eax, off);}	// mov [edi+off], eax
+	static void mov_base_al  (code &c, int off){write8(c, 0x88);rm_base(c, eax, off);}	// mov [edi+off], al
+	static void inc_base     (code &c, int off){write8(c, 0xFF);rm_base(c, 0, off);}	// inc [edi+off]
+	static void inc_byte_base(code &c, int off){write8(c, 0xFE);rm_base(c, 0, off);}	// inc byte ptr [edi+off]
+	static void dec_base     (code &c, int off){write8(c, 0xFF);rm_base(c, 1, off);}	// dec [edi+off]
+	static void dec_byte_base(code &c, int off){write8(c, 0xFE);rm_base(c, 1, off);}	// dec byte ptr [edi+off]
+	static void add_base_int (code &c, int off, int val){write8(c, imm8(val) ? 0x83 : 0x81);rm_base(c, 0, off);imm(c, val);}	// add [edi+off], val
+	static void lea_eax_base (code &c, int off){write8(c, 0x8D);rm_base(c, eax, off);}	// lea eax, [edi+off]
 
 	static void xor_eax_1  (code &c){write8(c, 0x83);write8(c, 0xF0);write8(c, 0x01);}	// xor eax, 1
 	static void xor_edx_1  (code &c){write8(c, 0x83);write8(c, 0xF2);write8(c, 0x01);}	// xor edx, 1
@@ -87,6 +126,11 @@ struct x86
 	static void cmp_al_cl  (code &c){write8(c, 0x38);write8(c, 0xC8);}	// cmp  al, cl
 	//static void call_eax   (code &c){write8(c, 0xFF);write8(c, 0x10);}	// call [eax]
 	static void call_eax   (code &c){write8(c, 0xFF);write8(c, 0xD0);}	// call eax
+	static void call_rel   (code &c, int to){write8(c, 0xE8);write32(c, to - (int)c.size() - 4);}	// call to(コードの先頭からの距離)
+
+	// 関数の出入り、frameはローカル変数と一時変数の大きさ
+	static void enter(code &c, int frame){push_ebp(c);mov_ebp_esp(c);add_esp_int(c, -frame);}
+	static void leave(code &c, int frame){mov_esp_ebp(c);pop_ebp(c);retn(c);}
 
 	static void push_ebp   (code &c){write8(c, 0x55);}	// push ebp
 	static void mov_ebp_esp(code &c){write8(c, 0x89);write8(c, 0xE5);}	// mov ebp, esp
@@ -97,6 +141,10 @@ struct x86
 	static void jmp(code &c, int j){write8(c, 0xE9);write32(c, j);}	// jmp j
 	static void jnz(code &c, int j){write8(c, 0x0F);write8(c, 0x85);write32(c, j);}	// jnz j
 	static void je (code &c, int j){write8(c, 0x0F);write8(c, 0x84);write32(c, j);}	// je j
+	enum{B = 2, AE, E, NE, BE, A, S = 8, L = 12, GE, LE, G};	// 条件
+	static void jcc(code &c, int cc, int j){write8(c, 0x0F);write8(c, 0x80|cc);write32(c, j);}	// jcc j
+	static void jmp8(code &c, int j){write8(c, 0xEB);write8(c, j);}	// jmp short j
+	static void jcc8(code &c, int cc, int j){write8(c, 0x70|cc);write8(c, j);}	// jcc short j
 	static void jl3(code &c){write8(c, 0x7C);write8(c, 0x03);}	// jl short 3
 	static void jle3(code &c){write8(c, 0x7E);write8(c, 0x03);}	// jle short 3
 	static void jg3(code &c){write8(c, 0x7F);write8(c, 0x03);}	// jg short 3
@@ -108,6 +156,61 @@ struct x86
 	static void je3(code &c){write8(c, 0x74);write8(c, 0x03);}	// je short 3
 	static void jnz3(code &c){write8(c, 0x75);write8(c, 0x03);}	// jnz short 3
 
+	// 入口と出口でグローバル変数を触る、baseならediからの距離でそうでなければ絶対番地
+	static void op_global(code &c, int op, int r, int a, bool base){write8(c, op);if (base) rm_base(c, r, a); else {write8(c, 0x05|r<<3);write32(c, a);}}
+
+	// Cから呼ぶ入口、インスタンス用か燃料を数える時だけ置く(そうでなければ関数をそのまま呼べる)
+	// instanceならf(global, stack, 引数...)で呼ばれるので、ediにglobalを入れる(stackはx64用)
+	// fuelなら燃料を数えるので、exit(グローバル変数)に燃料が切れた時に戻ってくるespを置く
+	static void entry_thunk(code &c, int func, int args, bool instance, int exit, bool fuel)
+	{
+		push_ebp(c);
+		mov_ebp_esp(c);
+		push_reg(c, ebx);
+		push_reg(c, esi);
+		push_reg(c, edi);
+		if (instance)
+			mov_reg_stack(c, edi, 8);	// mov edi, [ebp+8]
+		if (fuel)
+		{
+			op_global(c, 0xFF, 6, exit, instance);	// push [exit] 呼ばれた時のを取っておく
+			push_ebp(c);
+			op_global(c, 0x89, esp, exit, instance);	// mov [exit], esp
+		}
+		for (int i = args - 1; i >= 0; i--)
+			push_stack(c, (instance ? 16 : 8) + i * 4);
+		call_rel(c, func);
+		if (args)
+			add_esp_int(c, args * 4);
+		if (fuel)
+			leave_thunk(c, exit, instance);
+		else
+			leave_entry(c);
+	}
+	// 燃料が切れた時に飛んでくる所、一番内側の入口のespに戻って0を返す
+	static void exit_thunk(code &c, int exit, bool base)
+	{
+		op_global(c, 0x8B, esp, exit, base);	// mov esp, [exit]
+		write8(c, 0x31);write8(c, 0xC0);	// xor eax, eax
+		leave_thunk(c, exit, base);
+	}
+	static void leave_thunk(code &c, int exit, bool base)
+	{
+		pop_ebp(c);
+		write8(c, 0x59);	// pop ecx
+		op_global(c, 0x89, ecx, exit, base);	// mov [exit], ecx
+		leave_entry(c);
+	}
+	static void leave_entry(code &c)
+	{
+		write8(c, 0x8D);write8(c, 0x65);write8(c, 0xF4);	// lea esp, [ebp-12]
+		write8(c, 0x5F);	// pop edi
+		write8(c, 0x5E);	// pop esi
+		write8(c, 0x5B);	// pop ebx
+		pop_ebp(c);
+		retn(c);
+	}
+
 };
 
 }
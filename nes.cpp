@@ -1,5 +1,7 @@
 #include <windows.h>
 
+#define NES_X86	// 32bitのexeを吐くので64bitでもx86のコード
+
 #include "include/nes.h"
 
 using namespace std;
@@ -35,7 +35,12 @@ int main(void)
 	x = env->call("add", 10, 20);
 	printf("%d\n", x);
 
-	*env->getGlobal("printint") = (int)printint;
+	// 何度も呼ぶなら先に引いておく
+	IL::Handle<int (int, int)> add = env->lookup<int (int, int)>("add");
+	if (add)
+		printf("%d\n", env->call(add, 30, 40));
+
+	env->setNative("printint", (const void*)printint);
 	env->call("embed");
 
 	printf("%d\n", *env->getGlobal("initvar"));